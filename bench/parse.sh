@@ -0,0 +1,24 @@
+#!/bin/bash
+# times lexing and parsing of generated scripts, 1MB, 10MB and 100MB by default
+# usage: bench/parse.sh [path/to/output] [sizes in MB...]
+bin=${1:-build/output}
+shift
+sizes=${@:-1 10 100}
+
+for mb in $sizes; do
+    file=$(mktemp /tmp/parse_bench.XXXXXX)
+    awk -v target=$((mb * 1024 * 1024)) 'BEGIN {
+        for (n = 0; bytes < target; n++) {
+            line = sprintf("v%d: int = %d + 2 * 3;\n", n, n)
+            line = line sprintf("f%d = => (a: int, b: str) { x: int = a + 1; return x; }\n", n)
+            line = line sprintf("o%d: object = { k: \"v\", n: [1, 2, 3] };\n", n)
+            line = line sprintf("if v%d == 1 { print(f%d(v%d, \"s\")); }\n", n, n, n)
+            printf "%s", line
+            bytes += length(line)
+        }
+    }' > "$file"
+
+    printf "%4dMB: " $mb
+    "$bin" --parse-only "$file"
+    rm -f "$file"
+done
@@ -0,0 +1,38 @@
+#!/bin/bash
+# times filling an array used as a work queue and draining it again, each
+# item taken off the front puts a smaller one back on the end until it
+# reaches 0, so 3n items go through a queue of n. the time should grow
+# linearly with the queue size
+# usage: bench/queue.sh [path/to/output] [queue sizes...]
+bin=${1:-build/output}
+shift
+sizes=${@:-25000 50000 100000 200000}
+
+for n in $sizes; do
+    file=$(mktemp /tmp/queue_bench.XXXXXX)
+    cat > "$file" <<EOF
+q: array = [2];
+i: int = 1;
+while i < $n {
+    array.push(q, 2);
+    i = i + 1;
+}
+done: int = 0;
+left: int = array.len(q);
+while left > 0 {
+    item: int = array.shift(q);
+    if item > 0 { array.push(q, item - 1); }
+    done = done + 1;
+    left = array.len(q);
+}
+print(done);
+EOF
+
+    for engine in tree --vm; do
+        flag=${engine#tree}
+        TIMEFORMAT=%R
+        secs=$( { time "$bin" $flag --no-cache "$file" > /dev/null; } 2>&1 )
+        printf "%7d %-5s %ss\n" $n "${engine#--}" "$secs"
+    done
+    rm -f "$file"
+done
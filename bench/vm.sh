@@ -0,0 +1,59 @@
+#!/bin/bash
+# times the same scripts on the tree walker and on the vm and prints how
+# many times faster the vm ran each: recursive calls, a counting loop,
+# member reads and string building
+# usage: bench/vm.sh [path/to/output] [scale]
+bin=${1:-build/output}
+scale=${2:-1}
+dir=$(mktemp -d /tmp/vm_bench.XXXXXX)
+
+cat > "$dir/calls.du" <<EOF
+fib: func = => (n: int) {
+    if n < 2 { return n; }
+    a: int = fib(n - 1);
+    b: int = fib(n - 2);
+    return a + b;
+}
+print(fib($((24 + scale))));
+EOF
+
+cat > "$dir/loop.du" <<EOF
+i: int = 0;
+total: int = 0;
+while i < $((2000000 * scale)) {
+    total = total + i;
+    i = i + 1;
+}
+print(total);
+EOF
+
+cat > "$dir/members.du" <<EOF
+p: object = { x: 1, y: 2, z: 3 };
+i: int = 0;
+total: int = 0;
+while i < $((500000 * scale)) {
+    y: int = p.y;
+    total = total + y;
+    i = i + 1;
+}
+print(total);
+EOF
+
+cat > "$dir/strings.du" <<EOF
+s: str = "";
+i: int = 0;
+while i < $((200000 * scale)) {
+    s = s + "x";
+    i = i + 1;
+}
+print(string.length(s));
+EOF
+
+TIMEFORMAT=%R
+for name in calls loop members strings; do
+    file="$dir/$name.du"
+    tree=$( { time "$bin" --no-cache "$file" > /dev/null; } 2>&1 )
+    vm=$( { time "$bin" --no-cache --vm "$file" > /dev/null; } 2>&1 )
+    printf "%-8s tree %6ss  vm %6ss  %sx\n" $name "$tree" "$vm" "$(awk -v t=$tree -v v=$vm 'BEGIN { printf "%.2f", (v > 0 ? t / v : 0) }')"
+done
+rm -rf "$dir"
@@ -0,0 +1,57 @@
+/*
+ * example native extension, fnv-1a hashing
+ *
+ *     cc -O2 -shared -fPIC -Iinclude examples/ext/fnv.c -o libfnv.so
+ *
+ *     import "./libfnv.so" as fnv;
+ *     print(fnv.hash("hello"));
+ */
+
+#include "du_native.h"
+
+static uint64_t fnv1a(const char* data, size_t len, uint64_t h)
+{
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+static du_value hash(const du_api* api, const du_value* args, size_t argc)
+{
+    size_t len;
+    const char* data = api->string_data(args[0], &len);
+    return api->from_int((int64_t)fnv1a(data, len, 0xcbf29ce484222325ull));
+}
+
+/* one hash over every string in an array */
+static du_value hash_all(const du_api* api, const du_value* args, size_t argc)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t n = api->array_length(args[0]);
+
+    for (size_t i = 0; i < n; i++) {
+        du_value elem = api->array_get(args[0], i);
+        if (api->type_of(elem) != DU_STRING) return api->fail("expected an array of strings");
+
+        size_t len;
+        const char* data = api->string_data(elem, &len);
+        h = fnv1a(data, len, h);
+    }
+
+    return api->from_int((int64_t)h);
+}
+
+DU_EXPORT uint32_t du_module_init(const du_api* api, du_module* mod)
+{
+    static const du_type hash_types[] = {DU_STRING};
+    static const du_type hash_all_types[] = {DU_ARRAY};
+
+    if (api->version >> 16 != DU_NATIVE_ABI_MAJOR) return 0;
+
+    api->define(mod, "hash", hash, 1, hash_types);
+    api->define(mod, "all", hash_all, 1, hash_all_types);
+    return DU_NATIVE_ABI_VERSION;
+}
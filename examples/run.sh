@@ -0,0 +1,147 @@
+#!/bin/bash
+# runs every example on the tree walker and on the vm and checks both print
+# the same and exit the same way, and that an example with a .out file
+# next to it prints exactly that. a directory of scripts runs as one
+# program of isolates, one at a time and all at once. gc_churn.du also
+# runs for 20 and 200 rounds, the peak rss of the longer run has to stay
+# within a quarter of the shorter one's. a 1MB script running 2000 tasks
+# at once has to stay within 64MB of the same script running 2. packed.du,
+# which declares packed array types, has to reuse its .duc on a second run.
+# a lone script waiting on a channel nothing sends to has to fail, not hang
+# usage: examples/run.sh [path/to/output]
+bin=$(realpath "${1:-build/output}")
+cd "$(dirname "$0")/.."
+
+failed=0
+
+# prints the command's output, then its exit status on a line of its own
+run() {
+    timeout 120 "$bin" --no-cache "$@" 2>/dev/null
+    echo "exit $?"
+}
+
+# the peak rss of the command in KB, read off /proc while it runs
+peak_rss() {
+    "$@" > /dev/null 2>&1 &
+    local pid=$! peak=0 kb
+    while kill -0 $pid 2>/dev/null; do
+        kb=$(awk '/VmHWM/ { print $2 }' /proc/$pid/status 2>/dev/null)
+        [ -n "$kb" ] && peak=$kb
+        sleep 0.01
+    done
+    wait $pid
+    echo $peak
+}
+
+# name, expected .out file, then the outputs of every run
+check() {
+    local name=$1 expected=$2 first=$3
+    shift 3
+
+    for out in "$@"; do
+        if [ "$out" != "$first" ]; then
+            echo "FAIL $name: engines or isolate counts disagree"
+            diff <(echo "$first") <(echo "$out") | head -n 10
+            failed=$((failed + 1))
+            return
+        fi
+    done
+
+    if [ -f "$expected" ] && [ "$first" != "$(cat "$expected"; echo "exit 0")" ]; then
+        echo "FAIL $name: differs from $expected"
+        diff <(cat "$expected"; echo "exit 0") <(echo "$first") | head -n 10
+        failed=$((failed + 1))
+        return
+    fi
+
+    echo "ok   $name"
+}
+
+for file in examples/*.du; do
+    check "$file" "${file%.du}.out" "$(run "$file")" "$(run --vm "$file")"
+done
+
+for dir in examples/*/; do
+    dir=${dir%/}
+    scripts=("$dir"/*.du)
+    [ -f "${scripts[0]}" ] || continue
+
+    check "$dir" "$dir.out" \
+        "$(run --isolates=1 "${scripts[@]}")" "$(run --isolates=${#scripts[@]} "${scripts[@]}")" \
+        "$(run --vm --isolates=1 "${scripts[@]}")" "$(run --vm --isolates=${#scripts[@]} "${scripts[@]}")"
+done
+
+lone=$(mktemp /tmp/lone.XXXXXX)
+printf 'c = channel.open("lone", 4);\nprint(channel.recv(c));\n' > "$lone"
+for engine in "" --vm; do
+    status=$(timeout 10 "$bin" --no-cache $engine "$lone" 2>&1)
+    if [ $? -ne 1 ] || [[ "$status" != *"no running script sends to"* ]]; then
+        echo "FAIL lone channel recv${engine:+ $engine}: did not fail with the deadlock error"
+        failed=$((failed + 1))
+    else
+        echo "ok   lone channel recv${engine:+ $engine}"
+    fi
+done
+rm -f "$lone"
+
+# a .duc that is rewritten on every run was rejected when it was read back
+cached=$(mktemp -d /tmp/cached.XXXXXX)
+cp examples/packed.du "$cached"
+timeout 120 "$bin" "$cached/packed.du" > /dev/null 2>&1
+written=$(stat -c %y "$cached/packed.duc" 2>/dev/null)
+timeout 120 "$bin" "$cached/packed.du" > /dev/null 2>&1
+if [ -z "$written" ] || [ "$(stat -c %y "$cached/packed.duc")" != "$written" ]; then
+    echo "FAIL packed.duc: not reused on the second run"
+    failed=$((failed + 1))
+else
+    echo "ok   packed.duc reused"
+fi
+rm -rf "$cached"
+
+churn=$(mktemp /tmp/churn.XXXXXX)
+for rounds in 20 200; do
+    sed "s/round < 50/round < $rounds/" examples/gc_churn.du > "$churn"
+    rss[$rounds]=$(peak_rss "$bin" --no-cache --gc-heap=4096 "$churn")
+done
+rm -f "$churn"
+
+if [ $((rss[200] * 4)) -gt $((rss[20] * 5)) ]; then
+    echo "FAIL gc_churn rss: ${rss[20]}KB at 20 rounds, ${rss[200]}KB at 200"
+    failed=$((failed + 1))
+else
+    echo "ok   gc_churn rss: ${rss[20]}KB at 20 rounds, ${rss[200]}KB at 200"
+fi
+
+# tasks share the script's source and tree, each only adds its stacks
+many=$(mktemp /tmp/many.XXXXXX)
+for n in 2 2000; do
+    {
+        yes "# padding, every task used to get a copy of the whole script" | head -n 16000
+        cat <<EOF
+wait: func = async => (v: int) {
+    await io.sleep(50);
+    return v;
+}
+tasks = [0];
+array.pop_back(tasks);
+i: int = 0;
+while i < $n {
+    array.push(tasks, wait(i));
+    i = i + 1;
+}
+await io.all(tasks);
+EOF
+    } > "$many"
+    rss[$n]=$(peak_rss "$bin" --no-cache "$many")
+done
+rm -f "$many"
+
+if [ $((rss[2000] - rss[2])) -gt 65536 ]; then
+    echo "FAIL task rss: ${rss[2]}KB for 2 tasks, ${rss[2000]}KB for 2000"
+    failed=$((failed + 1))
+else
+    echo "ok   task rss: ${rss[2]}KB for 2 tasks, ${rss[2000]}KB for 2000"
+fi
+
+[ $failed -eq 0 ] || echo "$failed failed"
+exit $((failed > 0))
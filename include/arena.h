@@ -0,0 +1,65 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// bump allocator for things that live and die together, like the nodes of
+// one parsed program. allocation is a pointer bump inside 64KB blocks and
+// the whole arena is freed at once, so nothing allocated in it gets its
+// destructor run
+typedef struct arena {
+    static constexpr size_t BLOCK_SIZE = 64 << 10;
+
+    std::vector<char*> blocks;
+    char* at;
+    char* end;
+    size_t used;
+
+    arena() : at(nullptr), end(nullptr), used(0) {};
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    ~arena() {
+        for (char* block : blocks) std::free(block);
+    }
+
+    void* alloc(size_t bytes, size_t align) {
+        char* ptr = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(at) + align - 1) & ~(align - 1));
+
+        if (at == nullptr || ptr + bytes > end) {
+            size_t size = bytes + align > BLOCK_SIZE ? bytes + align : BLOCK_SIZE;
+            char* block = static_cast<char*>(std::malloc(size));
+            if (block == nullptr) throw std::bad_alloc();
+
+            blocks.push_back(block);
+            end = block + size;
+            ptr = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(block) + align - 1) & ~(align - 1));
+        }
+
+        at = ptr + bytes;
+        used += bytes;
+        return ptr;
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    T* make_array(size_t count) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        if (count == 0) return nullptr;
+        return static_cast<T*>(alloc(sizeof(T) * count, alignof(T)));
+    }
+} arena_t;
+
+#endif // ARENA_H_
@@ -2,15 +2,16 @@
 #define AST_H_
 
 #include "position.h"
+#include "symbol.h"
 #include "token.h"
 #include "types.h"
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <string>
-#include <vector>
-#include "types.h"
+#include <string_view>
 
-typedef enum struct ast_type {
+typedef enum struct ast_type : uint8_t {
         ast_compound,
         ast_noop,
 
@@ -30,36 +31,112 @@ typedef enum struct ast_type {
         ast_import,
         ast_if,
         ast_while,
-        ast_bool
+        ast_bool,
+
+        // binops rewrite themselves into one of these the first time they
+        // run, after the operand types they saw. a quickened node that sees
+        // other types falls back to ast_binop_generic for good. these never
+        // come out of the parser or go into a .duc file
+        ast_add_int,
+        ast_sub_int,
+        ast_mul_int,
+        ast_div_int,
+        ast_eq_int,
+        ast_ge_int,
+        ast_le_int,
+        ast_lt_int,
+        ast_gt_int,
+        ast_add_float,
+        ast_sub_float,
+        ast_mul_float,
+        ast_div_float,
+        ast_eq_float,
+        ast_ge_float,
+        ast_le_float,
+        ast_lt_float,
+        ast_gt_float,
+        ast_add_str,
+        ast_eq_str,
+        ast_binop_generic
 } ast_type_t;
 
+// same order as the _int and _float node types above
+typedef enum struct binop : uint8_t {
+        add,
+        sub,
+        mul,
+        div,
+        eq,
+        ge,
+        le,
+        lt,
+        gt
+} binop_t;
+
+inline binop_t binop_from(std::string_view op) {
+    if (op == "+") return binop::add;
+    if (op == "-") return binop::sub;
+    if (op == "*") return binop::mul;
+    if (op == "/") return binop::div;
+    if (op == "==") return binop::eq;
+    if (op == ">=") return binop::ge;
+    if (op == "<=") return binop::le;
+    if (op == "<") return binop::lt;
+    return binop::gt;
+}
+
+struct ast_node;
+
+// children of a node, allocated in the same arena as the node itself
+typedef struct node_list {
+    ast_node** items;
+    uint32_t count;
+
+    node_list() : items(nullptr), count(0) {};
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    ast_node*& operator[](size_t i) const { return items[i]; }
+    ast_node** begin() const { return items; }
+    ast_node** end() const { return items + count; }
+} node_list_t;
+
+// nodes live in the parser's arena and go away with it. symbol views the
+// source (identifier and member names, string literals, operators) and is
+// only meaningful on those nodes. number literals keep integer or number,
+// whichever their data_type (int or float) says
 struct ast_node {
-    std::vector<ast_node*> children;
-    ast_type_t type;
-    position_t pos;
+    node_list_t children;
     ast_node* value;
-    std::string symbol;
-    float number;
-    dtype_t data_type;
     ast_node* svalue;
 
-    ast_node(ast_type_t type, position_t p) : type(type), pos(p) {};
-    ast_node() : type(
-        ast_type::ast_noop
-    ), pos() {};
-
-    ast_node(bool a) : type(
-        ast_type::ast_compound
-    ), pos() {
-        this->children.push_back(new ast_node());
-        this->children.push_back(new ast_node());
-        this->children.push_back(new ast_node());
-        this->children.push_back(new ast_node());
-        this->children.push_back(new ast_node());
-        this->children.push_back(new ast_node());
-        this->children.push_back(new ast_node());
-        this->data_type = dtype::cfunction;
+    union {
+        std::string_view symbol;
+        double number;
+        int64_t integer;
     };
+
+    position_t pos;
+    // interned symbol, set on nodes that name a variable
+    atom_t atom = 0;
+
+    // filled in by the resolver: how many frames out a name lives and its
+    // slot there. function nodes record their frame size and whether a
+    // nested function can reach their frame (so it has to live on the heap)
+    int depth = 0;
+    int slot = -1;
+    int locals = 0;
+
+    ast_type_t type;
+    dtype_t data_type;
+    bool captured = false;
+    // operator of a binop, decoded once by the parser
+    binop_t op = binop::add;
+    // member names and object literals: their entry in member_caches()
+    // or object_layouts(), handed out by the resolver
+    uint32_t site = 0;
+
+    ast_node(ast_type_t type, position_t p) : value(nullptr), svalue(nullptr), symbol(), pos(p), type(type), data_type(dtype::any) {};
 };
 
 inline std::string ast_to_string(ast_type_t type) {
@@ -92,6 +169,27 @@ inline std::string ast_to_string(ast_type_t type) {
             return "call expression";
 
         case ast_type::ast_binop:
+        case ast_type::ast_add_int:
+        case ast_type::ast_sub_int:
+        case ast_type::ast_mul_int:
+        case ast_type::ast_div_int:
+        case ast_type::ast_eq_int:
+        case ast_type::ast_ge_int:
+        case ast_type::ast_le_int:
+        case ast_type::ast_lt_int:
+        case ast_type::ast_gt_int:
+        case ast_type::ast_add_float:
+        case ast_type::ast_sub_float:
+        case ast_type::ast_mul_float:
+        case ast_type::ast_div_float:
+        case ast_type::ast_eq_float:
+        case ast_type::ast_ge_float:
+        case ast_type::ast_le_float:
+        case ast_type::ast_lt_float:
+        case ast_type::ast_gt_float:
+        case ast_type::ast_add_str:
+        case ast_type::ast_eq_str:
+        case ast_type::ast_binop_generic:
             return "binary operation";
 
         case ast_type::ast_array:
@@ -122,12 +220,14 @@ inline std::string ast_to_string(ast_type_t type) {
 
 inline void print_node(ast_node* node, int tl) {
     std::string idents = std::string(tl, ' ');
-    printf(
-        "%s<type:%s, pos:%d:%d, symbol:%s, number: %f, dtype:%s>\n",
-        idents.c_str(), ast_to_string(node->type).c_str(),
-        node->pos.ln, node->pos.col, node->symbol.c_str(),
-        node->number, dtype_to_str(node->data_type).c_str()
-    );
+    if (node->type == ast_type::ast_num_expr) {
+        double number = node->data_type == dtype::integer ? static_cast<double>(node->integer) : node->number;
+        printf("%s<type:%s, pos:%d:%d, number: %f, dtype:%s>\n", idents.c_str(), ast_to_string(node->type).c_str(),
+            node->pos.ln, node->pos.col, number, dtype_to_str(node->data_type).c_str());
+    } else {
+        printf("%s<type:%s, pos:%d:%d, symbol:%.*s, dtype:%s>\n", idents.c_str(), ast_to_string(node->type).c_str(),
+            node->pos.ln, node->pos.col, (int)node->symbol.size(), node->symbol.data(), dtype_to_str(node->data_type).c_str());
+    }
 
     if (node->children.size() >= 1) {
         printf("%sCHILDREN:\n", idents.c_str());
@@ -150,12 +250,14 @@ inline void print_node(ast_node* node, int tl) {
 
 inline void print_node(ast_node* node) {
     std::string idents = std::string(0, ' ');
-    printf(
-        "%s<type:%s, pos:%d:%d, symbol:%s, number: %f, dtype:%s>\n",
-        idents.c_str(), ast_to_string(node->type).c_str(),
-        node->pos.ln, node->pos.col, node->symbol.c_str(),
-        node->number, dtype_to_str(node->data_type).c_str()
-    );
+    if (node->type == ast_type::ast_num_expr) {
+        double number = node->data_type == dtype::integer ? static_cast<double>(node->integer) : node->number;
+        printf("%s<type:%s, pos:%d:%d, number: %f, dtype:%s>\n", idents.c_str(), ast_to_string(node->type).c_str(),
+            node->pos.ln, node->pos.col, number, dtype_to_str(node->data_type).c_str());
+    } else {
+        printf("%s<type:%s, pos:%d:%d, symbol:%.*s, dtype:%s>\n", idents.c_str(), ast_to_string(node->type).c_str(),
+            node->pos.ln, node->pos.col, (int)node->symbol.size(), node->symbol.data(), dtype_to_str(node->data_type).c_str());
+    }
 
     if (node->children.size() >= 1) {
         printf("%sCHILDREN:\n", idents.c_str());
@@ -0,0 +1,179 @@
+#ifndef ASYNC_H_
+#define ASYNC_H_
+
+#include "interpreter.h"
+#include "native_stack.h"
+#include "runtime.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// values a task's stack holds for each call it may nest. a task gets room
+// for as deep a recursion as --max-depth allows, the stack is reserved
+// rather than committed so the room it doesn't use costs nothing
+constexpr size_t TASK_SLOTS_PER_CALL = 16;
+// threads blocking file work is handed to, regular files are always
+// readable as far as epoll is concerned
+constexpr size_t OFFLOAD_THREADS = 4;
+// idle interpreters kept for the next tasks of the same program
+constexpr size_t SPARE_TASK_INTERPRETERS = 64;
+
+inline size_t task_stack_size() {
+    return std::max<size_t>(1 << 18, max_call_depth() * TASK_SLOTS_PER_CALL);
+}
+
+// a coroutine nobody holds on to: it runs from the call up to its first
+// co_await and frees itself once its body ends. every native operation on
+// the loop is one, and settles the task it was started for on its way out
+typedef struct io_op {
+    struct promise_type {
+        io_op get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { throw; }
+    };
+} io_op_t;
+
+// a script task, along with the interpreter and fiber it runs on. the tree
+// walker is in the middle of a call when an await suspends it, so the task
+// keeps a native stack of its own until it's done
+typedef struct task_run {
+    rt_task* task;
+    // the interpreter that started it, the one it runs on is a copy
+    interpreter* origin;
+    interpreter* inter;
+    native_stack::fiber_t* fiber;
+    // what the await that suspended it waits for
+    rt_task* waiting;
+    rt_value result;
+    bool failed;
+    std::string report;
+    // the loop is going away, the await it's suspended in throws
+    bool cancelled;
+} task_run_t;
+
+// runs an isolate's tasks on the thread the isolate runs on. coroutines
+// that can carry on wait in ready, the others on a timer, a file
+// descriptor through epoll, a job on the offload threads or a task.
+// nothing runs until the program awaits something or comes to its end
+typedef struct event_loop {
+    typedef struct timer {
+        std::chrono::steady_clock::time_point due;
+        // timers due at the same time fire in the order they were set
+        uint64_t seq;
+        std::coroutine_handle<> co;
+
+        bool operator>(const timer& other) const {
+            return due != other.due ? due > other.due : seq > other.seq;
+        }
+    } timer_t;
+
+    // at most one reader and one writer per descriptor
+    typedef struct watch {
+        std::coroutine_handle<> reader;
+        std::coroutine_handle<> writer;
+    } watch_t;
+
+    typedef struct job {
+        std::function<void()> work;
+        std::coroutine_handle<> co;
+    } job_t;
+
+    int poller;
+    // the offload threads bump it when they finish a job
+    int wakeup;
+    std::deque<std::coroutine_handle<>> ready;
+    std::priority_queue<timer_t, std::vector<timer_t>, std::greater<timer_t>> timers;
+    uint64_t timer_seq;
+    std::unordered_map<int, watch_t> watched;
+
+    std::vector<std::thread> offload;
+    std::mutex lock;
+    std::condition_variable queued;
+    std::deque<job_t*> jobs;
+    std::vector<job_t*> finished;
+    // jobs handed out whose coroutine hasn't been made ready yet
+    size_t in_flight;
+    bool stopping;
+
+    // interpreters tasks ran on, by the interpreter the tasks came from
+    std::unordered_map<interpreter*, std::vector<interpreter*>> spare;
+    std::unordered_set<task_run_t*> runs;
+    // the task this thread is in, nullptr on the program's own stack
+    task_run_t* running;
+    // failed tasks no await has seen yet, oldest first
+    std::vector<rt_task*> unseen;
+
+    event_loop();
+    // cancels the tasks still running and frees every coroutine that is
+    // still waiting, with the isolate entered
+    ~event_loop();
+
+    event_loop(const event_loop&) = delete;
+    event_loop& operator=(const event_loop&) = delete;
+
+    // a pending task the heap keeps alive until it settles
+    rt_task* track(rt_value work);
+    // starts func() as a task on the next turn
+    rt_task* spawn(rt_value func);
+    void settle(rt_task* task, rt_value result);
+    void fail(rt_task* task, std::string report);
+    // the task's result once an await has seen it, failures throw
+    rt_value outcome(rt_task* task);
+    void outcome_seen(rt_task* task);
+
+    // runs the task until it suspends or returns, true once it returned
+    bool enter(task_run_t* run);
+    interpreter* lend(interpreter* origin);
+    void give_back(interpreter* origin, interpreter* inter);
+
+    // one turn: waits for fds, timers and jobs unless something is ready
+    // already, then runs everything that is. false when there was nothing
+    // left that could ever run
+    bool step();
+    void run_until(rt_task* task);
+    // turns until nothing is left, then reports the first failure no
+    // await saw
+    void run_all();
+
+    void watch(int fd, bool write, std::coroutine_handle<> co);
+    void submit(job_t* job);
+    void work();
+} event_loop_t;
+
+// the loop of the isolate running on this thread, made the first time
+// something needs it
+event_loop_t& current_loop();
+
+// async(f), what calling an async function comes down to
+rt_value async_start(rt_value func);
+// await(v), the result of a task once it has settled, anything else is
+// handed back as it is
+rt_value async_await(rt_value val);
+
+// io.sleep(ms)
+rt_value io_sleep(int64_t ms);
+// io.read(path), the whole file as a string
+rt_value io_read(std::string path);
+// io.write(path, text), replaces the file
+rt_value io_write(std::string path, std::string text);
+// io.exec(command[, input]), runs command through /bin/sh with input on
+// its stdin, settles with {status, out}
+rt_value io_exec(args_t args, void* env, void* data);
+// io.all(tasks), settles with their results in order once every one has
+rt_value io_all(rt_array* tasks);
+
+#endif // ASYNC_H_
@@ -0,0 +1,176 @@
+#ifndef BIND_H_
+#define BIND_H_
+
+#include "runtime.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// natives written as plain c++ functions. bind<f>("name") works out the
+// signature the script sees from f's parameter types, and instantiates a
+// thunk that unpacks the arguments straight off the value stack, calls f
+// and boxes what it returns. the engines check arity and types against the
+// signature before the thunk runs, so the thunk itself checks nothing.
+// a leading environment* parameter gets the calling environment instead
+// of a script argument
+//
+//     int64_t count(std::string_view text, int64_t from);
+//     env->assign("count", bind<count>("count"));
+
+// how each c++ type maps to a script type
+template<typename T>
+struct native_type;
+
+template<>
+struct native_type<rt_value> {
+    static constexpr dtype_t type = dtype::any;
+    static rt_value from(rt_value v) { return v; }
+    static rt_value to(rt_value v) { return v; }
+};
+
+template<>
+struct native_type<int64_t> {
+    static constexpr dtype_t type = dtype::integer;
+    static int64_t from(rt_value v) { return v.integer(); }
+    static rt_value to(int64_t i) { return make_int(i); }
+};
+
+template<>
+struct native_type<double> {
+    static constexpr dtype_t type = dtype::floating;
+    static double from(rt_value v) { return v.num(); }
+    static rt_value to(double d) { return rt_value(d); }
+};
+
+template<>
+struct native_type<bool> {
+    static constexpr dtype_t type = dtype::boolean;
+    static bool from(rt_value v) { return v.boolean(); }
+    static rt_value to(bool b) { return rt_value(b); }
+};
+
+// views into a string are only good until the native returns
+template<>
+struct native_type<std::string_view> {
+    static constexpr dtype_t type = dtype::string;
+    static std::string_view from(rt_value v) { return v.str(); }
+    static rt_value to(std::string_view s) { return make_string(std::string(s)); }
+};
+
+template<>
+struct native_type<std::string> {
+    static constexpr dtype_t type = dtype::string;
+    static std::string from(rt_value v) { return v.str(); }
+    static rt_value to(std::string s) { return make_string(std::move(s)); }
+};
+
+// the heap string itself, for natives that build ropes out of it
+template<>
+struct native_type<rt_string*> {
+    static constexpr dtype_t type = dtype::string;
+    static rt_string* from(rt_value v) { return static_cast<rt_string*>(v.obj()); }
+    static rt_value to(rt_string* s) { return rt_value(s); }
+};
+
+template<>
+struct native_type<rt_array*> {
+    static constexpr dtype_t type = dtype::array;
+    static rt_array* from(rt_value v) { return static_cast<rt_array*>(v.obj()); }
+    static rt_value to(rt_array* a) { return rt_value(a); }
+};
+
+template<>
+struct native_type<rt_i64array*> {
+    static constexpr dtype_t type = dtype::i64array;
+    static rt_i64array* from(rt_value v) { return static_cast<rt_i64array*>(v.obj()); }
+    static rt_value to(rt_i64array* a) { return rt_value(a); }
+};
+
+template<>
+struct native_type<rt_f64array*> {
+    static constexpr dtype_t type = dtype::f64array;
+    static rt_f64array* from(rt_value v) { return static_cast<rt_f64array*>(v.obj()); }
+    static rt_value to(rt_f64array* a) { return rt_value(a); }
+};
+
+template<>
+struct native_type<rt_channel*> {
+    static constexpr dtype_t type = dtype::channel;
+    static rt_channel* from(rt_value v) { return static_cast<rt_channel*>(v.obj()); }
+    static rt_value to(rt_channel* c) { return rt_value(c); }
+};
+
+template<>
+struct native_type<rt_task*> {
+    static constexpr dtype_t type = dtype::task;
+    static rt_task* from(rt_value v) { return static_cast<rt_task*>(v.obj()); }
+    static rt_value to(rt_task* t) { return rt_value(t); }
+};
+
+template<>
+struct native_type<rt_object*> {
+    static constexpr dtype_t type = dtype::object;
+    static rt_object* from(rt_value v) { return v.object(); }
+    static rt_value to(rt_object* o) { return rt_value(o); }
+};
+
+template<typename F>
+struct native_signature;
+
+template<typename R, typename... Args>
+struct native_signature<R (*)(Args...)> {
+    using ret = R;
+    using params = std::tuple<Args...>;
+    static constexpr bool with_env = false;
+};
+
+template<typename R, typename... Args>
+struct native_signature<R (*)(environment*, Args...)> {
+    using ret = R;
+    using params = std::tuple<Args...>;
+    static constexpr bool with_env = true;
+};
+
+template<auto F, typename P, size_t... I>
+inline rt_value native_call(args_t args, void* env, std::index_sequence<I...>) {
+    using sig = native_signature<decltype(F)>;
+    using R = typename sig::ret;
+
+    auto invoke = [&]() -> R {
+        if constexpr (sig::with_env) {
+            return F(static_cast<environment*>(env), native_type<std::decay_t<std::tuple_element_t<I, P>>>::from(args[I])...);
+        } else {
+            return F(native_type<std::decay_t<std::tuple_element_t<I, P>>>::from(args[I])...);
+        }
+    };
+
+    if constexpr (std::is_void_v<R>) {
+        invoke();
+        return rt_value();
+    } else {
+        return native_type<std::decay_t<R>>::to(invoke());
+    }
+}
+
+template<auto F>
+rt_value native_thunk(args_t args, void* env, void*) {
+    using params = typename native_signature<decltype(F)>::params;
+    return native_call<F, params>(args, env, std::make_index_sequence<std::tuple_size_v<params>>{});
+}
+
+template<typename P, size_t... I>
+inline std::vector<dtype_t> native_types(std::index_sequence<I...>) {
+    return {native_type<std::decay_t<std::tuple_element_t<I, P>>>::type...};
+}
+
+template<auto F>
+rt_value bind(const char* name) {
+    using params = typename native_signature<decltype(F)>::params;
+    return make_cfunction(name, &native_thunk<F>, native_types<params>(std::make_index_sequence<std::tuple_size_v<params>>{}));
+}
+
+#endif // BIND_H_
@@ -1,90 +1,238 @@
 #ifndef __BUILTIN_H__
 #define __BUILTIN_H__
 
+#include "async.h"
+#include "bind.h"
+#include "channel.h"
 #include "env.h"
 #include "futil.h"
 #include "interpreter.h"
+#include "iter.h"
+#include "parallel.h"
+#include "kernels.h"
 #include "runtime.h"
 #include "types.h"
 #include <string>
 #include <vector>
 
-inline rt_value* string_concat(std::vector<rt_value*> args, void* env) {
-    return new rt_value(args[0]->str + args[1]->str);
+inline rt_value string_concat(rt_string* left, rt_string* right) {
+    return concat_strings(rt_value(left), rt_value(right));
 }
 
-inline rt_value* string_to_string(std::vector<rt_value*> args, void* env) {
-    return new rt_value(args[0]->ts());
+// ropes know their length without being flattened
+inline int64_t string_length(rt_string* str) {
+    return str->length;
 }
 
-inline rt_value* array_push(std::vector<rt_value*> args, void* env) {
-    args[0]->arr.push_back(args[1]);
-    return args[1];
+inline std::string string_to_string(rt_value val) {
+    return val.ts();
 }
 
-inline rt_value* array_remove(std::vector<rt_value*> args, void* env) {
-    args[0]->arr.erase(args[0]->arr.begin() + args[1]->num);
-    return new rt_value();
+inline rt_value array_push(rt_array* arr, rt_value val) {
+    arr->arr.push_back(val);
+    gc_heap().grew(arr);
+    gc_heap().barrier(arr);
+    return val;
 }
 
-inline rt_value* array_pop(std::vector<rt_value*> args, void* env) {
-    rt_value* saved = *(args[0]->arr.begin());
-    args[0]->arr.erase(args[0]->arr.begin() + 0);
-    return saved;
+inline int64_t array_len(rt_array* arr) {
+    return arr->arr.size();
 }
 
-inline rt_value* array_foreach(std::vector<rt_value*> args, void* env) {
-    // Check if args contains at least two elements
-    if (args.size() < 2) {
-        // Handle the error appropriately (e.g., return an error code)
-        return new rt_value();
-    }
+inline rt_value array_unshift(rt_array* arr, rt_value val) {
+    arr->arr.push_front(val);
+    gc_heap().grew(arr);
+    gc_heap().barrier(arr);
+    return val;
+}
 
-    rt_value* arr = args[0];
-    rt_value* func = args[1];
+inline void array_remove(rt_array* arr, int64_t index) {
+    if (index < 0 || static_cast<uint64_t>(index) >= arr->arr.size()) error_util::spit(string_format("array.remove index %lld out of range", (long long)index));
+    arr->arr.erase(index);
+}
 
-    // Ensure that arr and func pointers are valid
-    if (!arr || !func) {
-        // Handle the error appropriately (e.g., return an error code)
-        return new rt_value();
-    }
+// pop takes from the front like shift, arrays used as queues push at the
+// back and pop at the front
+inline rt_value array_shift(rt_array* arr) {
+    if (arr->arr.empty()) error_util::spit("array.shift of an empty array");
+    return arr->arr.pop_front();
+}
 
-    // Check if arr is a valid rt_value with an array
-    if (arr->type != dtype::array) {
-        // Handle the error appropriately (e.g., return an error code)
-        return new rt_value();
-    }
+inline rt_value array_pop(rt_array* arr) {
+    if (arr->arr.empty()) error_util::spit("array.pop of an empty array");
+    return arr->arr.pop_front();
+}
 
-    environment_t* env_cast = static_cast<environment*>(env);
+inline rt_value array_pop_back(rt_array* arr) {
+    if (arr->arr.empty()) error_util::spit("array.pop_back of an empty array");
+    return arr->arr.pop_back();
+}
 
-    // Ensure that env_cast is a valid pointer
-    if (!env_cast) {
-        // Handle the error appropriately (e.g., return an error code)
-        return new rt_value();
-    }
+// i64array and f64array share their builtins, A is the packed array type
+template<typename A>
+using element_of = typename decltype(A::data)::value_type;
 
-    interpreter_t* inter = static_cast<interpreter*>(env_cast->get_interpreter());
+template<typename A>
+inline const char* packed_name() {
+    return std::is_same_v<A, rt_i64array> ? "i64array" : "f64array";
+}
 
-    // Ensure that inter is a valid pointer
-    if (!inter) {
-        // Handle the error appropriately (e.g., return an error code)
-        return new rt_value();
-    }
+template<typename A>
+inline const kernels::ops<element_of<A>>& packed_ops() {
+    if constexpr (std::is_same_v<A, rt_i64array>) return kernels::best().i64;
+    else return kernels::best().f64;
+}
 
-    // Iterate through the array and call the function for each element
-    for (rt_value* idx : arr->arr) {
-        // Check if idx is a valid pointer
-        if (!idx) {
-            // Handle the error appropriately (e.g., return an error code)
-            return new rt_value();
-        }
+template<typename A>
+inline rt_value make_packed(std::vector<element_of<A>> data) {
+    if constexpr (std::is_same_v<A, rt_i64array>) return make_i64array(std::move(data));
+    else return make_f64array(std::move(data));
+}
 
-        inter->call_func(func, {idx}, env_cast);
+// f64arrays take any number, i64arrays only ints
+template<typename A>
+inline element_of<A> packed_element(rt_value val, const char* fn) {
+    if constexpr (std::is_same_v<A, rt_i64array>) {
+        if (val.type() != dtype::integer) error_util::spit(string_format("%s.%s expected an int, got %s", packed_name<A>(), fn, dtype_to_str(val.type()).c_str()));
+        return val.integer();
+    } else {
+        if (!val.is_number()) error_util::spit(string_format("%s.%s expected a number, got %s", packed_name<A>(), fn, dtype_to_str(val.type()).c_str()));
+        return val.to_double();
     }
+}
 
-    return new rt_value();
+template<typename A>
+inline size_t packed_index(A* arr, int64_t at, const char* fn) {
+    if (at < 0 || static_cast<uint64_t>(at) >= arr->data.size()) error_util::spit(string_format("%s.%s index %lld out of range", packed_name<A>(), fn, (long long)at));
+    return at;
 }
 
+template<typename A>
+inline void packed_same_length(A* a, A* b, const char* fn) {
+    if (a->data.size() != b->data.size()) error_util::spit(string_format("%s.%s lengths differ, %zu and %zu", packed_name<A>(), fn, a->data.size(), b->data.size()));
+}
+
+template<typename A>
+inline rt_value packed_from(rt_array* arr) {
+    std::vector<element_of<A>> data;
+    data.reserve(arr->arr.size());
+    for (rt_value val : arr->arr) data.push_back(packed_element<A>(val, "from"));
+    return make_packed<A>(std::move(data));
+}
+
+template<typename A>
+inline rt_value packed_zeros(int64_t length) {
+    if (length < 0) error_util::spit(string_format("%s.zeros negative length %lld", packed_name<A>(), (long long)length));
+    return make_packed<A>(std::vector<element_of<A>>(length));
+}
+
+template<typename A>
+inline rt_value packed_to_array(A* arr) {
+    std::vector<rt_value> items;
+    items.reserve(arr->data.size());
+    for (element_of<A> x : arr->data) items.push_back(native_type<element_of<A>>::to(x));
+    return make_array(std::move(items));
+}
+
+template<typename A>
+inline int64_t packed_len(A* arr) {
+    return arr->data.size();
+}
+
+template<typename A>
+inline element_of<A> packed_at(A* arr, int64_t at) {
+    return arr->data[packed_index(arr, at, "get")];
+}
+
+template<typename A>
+inline void packed_set(A* arr, int64_t at, rt_value val) {
+    arr->data[packed_index(arr, at, "set")] = packed_element<A>(val, "set");
+}
+
+template<typename A>
+inline void packed_push(A* arr, rt_value val) {
+    arr->data.push_back(packed_element<A>(val, "push"));
+    gc_heap().grew(arr);
+}
+
+template<typename A>
+inline element_of<A> packed_sum(A* arr) {
+    return packed_ops<A>().sum(arr->data.data(), arr->data.size());
+}
+
+template<typename A>
+inline element_of<A> packed_min(A* arr) {
+    if (arr->data.empty()) error_util::spit(string_format("%s.min of an empty array", packed_name<A>()));
+    return packed_ops<A>().min(arr->data.data(), arr->data.size());
+}
+
+template<typename A>
+inline element_of<A> packed_max(A* arr) {
+    if (arr->data.empty()) error_util::spit(string_format("%s.max of an empty array", packed_name<A>()));
+    return packed_ops<A>().max(arr->data.data(), arr->data.size());
+}
+
+template<typename A>
+inline element_of<A> packed_dot(A* a, A* b) {
+    packed_same_length(a, b, "dot");
+    return packed_ops<A>().dot(a->data.data(), b->data.data(), a->data.size());
+}
+
+template<typename A>
+inline rt_value packed_add(A* a, A* b) {
+    packed_same_length(a, b, "add");
+    std::vector<element_of<A>> out(a->data.size());
+    packed_ops<A>().add(a->data.data(), b->data.data(), out.data(), out.size());
+    return make_packed<A>(std::move(out));
+}
+
+template<typename A>
+inline rt_value packed_mul(A* a, A* b) {
+    packed_same_length(a, b, "mul");
+    std::vector<element_of<A>> out(a->data.size());
+    packed_ops<A>().mul(a->data.data(), b->data.data(), out.data(), out.size());
+    return make_packed<A>(std::move(out));
+}
+
+template<typename A>
+inline rt_value packed_scale(A* arr, rt_value k) {
+    std::vector<element_of<A>> out(arr->data.size());
+    packed_ops<A>().scale(arr->data.data(), packed_element<A>(k, "scale"), out.data(), out.size());
+    return make_packed<A>(std::move(out));
+}
+
+template<typename A>
+inline rt_value packed_prefix_sum(A* arr) {
+    std::vector<element_of<A>> out(arr->data.size());
+    packed_ops<A>().prefix_sum(arr->data.data(), out.data(), out.size());
+    return make_packed<A>(std::move(out));
+}
+
+template<typename A>
+inline rt_value packed_base() {
+    // natives keep a pointer to their name, interned names live as long as
+    // the isolate
+    const char* name = packed_name<A>();
+    auto full = [name](const char* fn) { return symbols().name(symbols().intern(std::string(name) + "." + fn)).data(); };
+
+    return make_object({
+        {"from", with_effect(native_effect::pure, bind<packed_from<A>>(full("from")))},
+        {"zeros", with_effect(native_effect::pure, bind<packed_zeros<A>>(full("zeros")))},
+        {"to_array", with_effect(native_effect::pure, bind<packed_to_array<A>>(full("to_array")))},
+        {"len", with_effect(native_effect::pure, bind<packed_len<A>>(full("len")))},
+        {"get", with_effect(native_effect::pure, bind<packed_at<A>>(full("get")))},
+        {"set", with_effect(native_effect::own_first, bind<packed_set<A>>(full("set")))},
+        {"push", with_effect(native_effect::own_first, bind<packed_push<A>>(full("push")))},
+        {"sum", with_effect(native_effect::pure, bind<packed_sum<A>>(full("sum")))},
+        {"min", with_effect(native_effect::pure, bind<packed_min<A>>(full("min")))},
+        {"max", with_effect(native_effect::pure, bind<packed_max<A>>(full("max")))},
+        {"dot", with_effect(native_effect::pure, bind<packed_dot<A>>(full("dot")))},
+        {"add", with_effect(native_effect::pure, bind<packed_add<A>>(full("add")))},
+        {"mul", with_effect(native_effect::pure, bind<packed_mul<A>>(full("mul")))},
+        {"scale", with_effect(native_effect::pure, bind<packed_scale<A>>(full("scale")))},
+        {"prefix_sum", with_effect(native_effect::pure, bind<packed_prefix_sum<A>>(full("prefix_sum")))}
+    });
+}
 
 inline void def_on_env(environment_t* env) {
     // std::map<std::string, rt_value*> stringbase = {
@@ -93,9 +241,10 @@ inline void def_on_env(environment_t* env) {
     //     })}
     // };
 
-    rt_value* sbase = new rt_value(std::map<std::string, rt_value*>{
-        {"concat", new rt_value((std::function<rt_value*(std::vector<rt_value*>, void*)>)string_concat)},
-        {"to_string", new rt_value((std::function<rt_value*(std::vector<rt_value*>, void*)>)string_to_string)}
+    rt_value sbase = make_object({
+        {"concat", with_effect(native_effect::pure, bind<string_concat>("string.concat"))},
+        {"length", with_effect(native_effect::pure, bind<string_length>("string.length"))},
+        {"to_string", with_effect(native_effect::pure, bind<string_to_string>("string.to_string"))}
     });
 
     // std::map<std::string, rt_value*> arrbase = {
@@ -104,15 +253,51 @@ inline void def_on_env(environment_t* env) {
     //     })}
     // };
 
-    rt_value* abase =  new rt_value(std::map<std::string, rt_value*>{
-        {"push", new rt_value((std::function<rt_value*(std::vector<rt_value*>, void*)>)array_push)},
-        {"remove", new rt_value((std::function<rt_value*(std::vector<rt_value*>, void*)>)array_remove)},
-        {"pop", new rt_value((std::function<rt_value*(std::vector<rt_value*>, void*)>)array_pop)},
-        {"foreach", new rt_value((std::function<rt_value*(std::vector<rt_value*>, void*)>)array_foreach)}
+    rt_value abase = make_object({
+        {"len", with_effect(native_effect::pure, bind<array_len>("array.len"))},
+        {"push", with_effect(native_effect::own_first, bind<array_push>("array.push"))},
+        {"remove", with_effect(native_effect::own_first, bind<array_remove>("array.remove"))},
+        {"pop", with_effect(native_effect::own_first, bind<array_pop>("array.pop"))},
+        {"shift", with_effect(native_effect::own_first, bind<array_shift>("array.shift"))},
+        {"unshift", with_effect(native_effect::own_first, bind<array_unshift>("array.unshift"))},
+        {"pop_back", with_effect(native_effect::own_first, bind<array_pop_back>("array.pop_back"))},
+        {"foreach", bind<iter_foreach>("array.foreach")},
+        {"range", with_effect(native_effect::pure, bind<iter_range>("array.range"))},
+        {"map", with_effect(native_effect::pure, bind<iter_map>("array.map"))},
+        {"filter", with_effect(native_effect::pure, bind<iter_filter>("array.filter"))},
+        {"take", with_effect(native_effect::pure, bind<iter_take>("array.take"))},
+        {"reduce", bind<iter_reduce>("array.reduce")},
+        {"collect", bind<iter_collect>("array.collect")},
+        {"parallel_map", make_variadic("array.parallel_map", parallel_map)},
+        {"parallel_foreach", make_variadic("array.parallel_foreach", parallel_foreach)},
+        {"parallel_reduce", make_variadic("array.parallel_reduce", parallel_reduce)}
+    });
+
+    rt_value cbase = make_object({
+        {"open", bind<channel_open>("channel.open")},
+        {"send", bind<channel_send>("channel.send")},
+        {"recv", make_variadic("channel.recv", channel_recv)},
+        {"try_recv", bind<channel_try_recv>("channel.try_recv")},
+        {"close", bind<channel_close>("channel.close")}
+    });
+
+    rt_value iobase = make_object({
+        {"sleep", bind<io_sleep>("io.sleep")},
+        {"read", bind<io_read>("io.read")},
+        {"write", bind<io_write>("io.write")},
+        {"exec", make_variadic("io.exec", io_exec)},
+        {"all", bind<io_all>("io.all")}
     });
 
     env->assign("string", sbase);
     env->assign("array", abase);
+    env->assign("i64array", packed_base<rt_i64array>());
+    env->assign("f64array", packed_base<rt_f64array>());
+    env->assign("channel", cbase);
+    env->assign("io", iobase);
+    // reached through the async and await keywords only
+    env->assign("async", bind<async_start>("async"));
+    env->assign("await", bind<async_await>("await"));
 }
 
 #endif // __BUILTIN_H__
\ No newline at end of file
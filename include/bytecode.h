@@ -0,0 +1,190 @@
+#ifndef BYTECODE_H_
+#define BYTECODE_H_
+
+#include "ast.h"
+#include "position.h"
+#include "value.h"
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+typedef enum struct opcode : uint8_t {
+    op_const,
+    op_nil,
+    op_pop,
+
+    op_get_local,
+    op_set_local,
+    op_get_env,
+    op_check_type,
+    op_closure,
+
+    op_add, op_sub, op_mul, op_div,
+    op_eq, op_ge, op_le, op_lt, op_gt,  // same order as binop_t
+    // an operator on a local and a local or a constant, read straight from
+    // where they are. see binary_local
+    op_binary_local,
+
+    op_jump,
+    op_jump_if_false,
+
+    op_call,
+    op_tail_call,
+    op_return,
+
+    op_array,
+    op_object,
+    op_get_member,
+    op_index,
+    op_import,
+} opcode_t;
+
+// instructions are one 32-bit word: the opcode in the low byte and a 24-bit
+// operand (constant index, jump target, argument count...) above it
+typedef uint32_t instr_t;
+
+constexpr uint32_t INSTR_ARG_MAX = (1u << 24) - 1;
+
+// op_binary_local's operand: the binop in the low 4 bits, then whether the
+// right side is a constant, then the left local's slot. the right side's
+// slot or constant index is the word after it
+constexpr uint32_t BINARY_CONST = 1u << 4;
+constexpr uint32_t BINARY_SLOT_SHIFT = 5;
+
+inline uint32_t binary_local(binop_t op, bool constant, uint32_t slot) {
+    return static_cast<uint32_t>(op) | (constant ? BINARY_CONST : 0) | (slot << BINARY_SLOT_SHIFT);
+}
+
+inline instr_t encode(opcode_t op, uint32_t arg = 0) {
+    return static_cast<uint32_t>(op) | (arg << 8);
+}
+
+inline opcode_t instr_op(instr_t in) {
+    return static_cast<opcode_t>(in & 0xff);
+}
+
+inline uint32_t instr_arg(instr_t in) {
+    return in >> 8;
+}
+
+// net number of values an instruction leaves on the operand stack
+inline int stack_effect(opcode_t op, uint32_t arg) {
+    switch (op) {
+        case opcode::op_const:
+        case opcode::op_nil:
+        case opcode::op_get_local:
+        case opcode::op_get_env:
+        case opcode::op_closure:
+        case opcode::op_import:
+        case opcode::op_binary_local:
+            return 1;
+
+        case opcode::op_pop:
+        case opcode::op_set_local:
+        case opcode::op_jump_if_false:
+        case opcode::op_return:
+        case opcode::op_index:
+        case opcode::op_add: case opcode::op_sub: case opcode::op_mul: case opcode::op_div:
+        case opcode::op_eq: case opcode::op_ge: case opcode::op_le: case opcode::op_lt: case opcode::op_gt:
+            return -1;
+
+        case opcode::op_call:
+        case opcode::op_tail_call:
+            return -static_cast<int>(arg);
+
+        case opcode::op_array:
+            return 1 - static_cast<int>(arg);
+
+        case opcode::op_object:
+            return 1 - static_cast<int>(arg);
+
+        default:
+            return 0;
+    }
+}
+
+typedef struct chunk {
+    std::vector<instr_t> code;
+    std::vector<position_t> positions;
+    std::vector<rt_value> constants;
+    std::map<size_t, std::string> symbols;
+    std::string name;
+    int depth;
+    int max_stack;
+
+    chunk(std::string name) : name(name), depth(0), max_stack(0) {};
+
+    size_t emit(opcode_t op, uint32_t arg, position_t pos) {
+        code.push_back(encode(op, arg));
+        positions.push_back(pos);
+
+        depth += stack_effect(op, arg);
+        if (depth > max_stack) max_stack = depth;
+
+        return code.size() - 1;
+    }
+
+    // raw operand word for instructions that need more than 24 bits
+    void emit_word(uint32_t word, position_t pos) {
+        code.push_back(word);
+        positions.push_back(pos);
+    }
+
+    void patch(size_t at, uint32_t arg) {
+        code[at] = encode(instr_op(code[at]), arg);
+    }
+} chunk_t;
+
+inline std::string opcode_to_str(opcode_t op) {
+    switch (op) {
+        case opcode::op_const: return "const";
+        case opcode::op_nil: return "nil";
+        case opcode::op_pop: return "pop";
+        case opcode::op_get_local: return "get_local";
+        case opcode::op_set_local: return "set_local";
+        case opcode::op_get_env: return "get_env";
+        case opcode::op_check_type: return "check_type";
+        case opcode::op_closure: return "closure";
+        case opcode::op_add: return "add";
+        case opcode::op_sub: return "sub";
+        case opcode::op_mul: return "mul";
+        case opcode::op_div: return "div";
+        case opcode::op_eq: return "eq";
+        case opcode::op_ge: return "ge";
+        case opcode::op_le: return "le";
+        case opcode::op_lt: return "lt";
+        case opcode::op_gt: return "gt";
+        case opcode::op_binary_local: return "binary_local";
+        case opcode::op_jump: return "jump";
+        case opcode::op_jump_if_false: return "jump_if_false";
+        case opcode::op_call: return "call";
+        case opcode::op_tail_call: return "tail_call";
+        case opcode::op_return: return "return";
+        case opcode::op_array: return "array";
+        case opcode::op_object: return "object";
+        case opcode::op_get_member: return "get_member";
+        case opcode::op_index: return "index";
+        case opcode::op_import: return "import";
+    }
+
+    return "unknown";
+}
+
+inline void print_chunk(chunk_t* c) {
+    printf("== %s ==\n", c->name.c_str());
+    for (size_t i = 0; i < c->code.size(); i++) {
+        instr_t in = c->code[i];
+        printf(
+            "%04zu %4d:%-3d %-14s %u",
+            i, c->positions[i].ln, c->positions[i].col,
+            opcode_to_str(instr_op(in)).c_str(), instr_arg(in)
+        );
+
+        if (instr_op(in) == opcode::op_get_env || instr_op(in) == opcode::op_object || instr_op(in) == opcode::op_binary_local) printf(" %u", c->code[++i]);
+        printf("\n");
+    }
+}
+
+#endif // BYTECODE_H_
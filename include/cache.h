@@ -0,0 +1,73 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include "ast.h"
+#include "parser.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// parsed programs are cached next to their script (foo.du -> foo.duc) so a
+// later run can map the tree back in instead of lexing and parsing again.
+// the file is keyed by a hash of the source, symbols are stored as offsets
+// into it, and anything that doesn't check out (other version, stale hash,
+// bad index) is ignored so the caller just parses
+namespace cache {
+    // bump whenever ast_type, dtype or the layout below changes
+    constexpr uint32_t VERSION = 4;
+    constexpr uint32_t NONE = UINT32_MAX;
+
+    typedef struct header {
+        char magic[4];
+        uint32_t version;
+        uint64_t source_hash;
+        uint64_t source_size;
+        uint64_t payload_hash;
+        uint32_t node_count;
+        uint32_t child_count;
+        uint32_t name_count;
+        uint32_t root;
+    } header_t;
+
+    // children index a table of node indices that follows the nodes, value
+    // and svalue are node indices or NONE, symbols are offsets into the
+    // source with NONE standing for the root's name. name indexes the table
+    // of distinct identifiers after that, each one is interned once on load
+    // and becomes the atom of every node naming it
+    typedef struct span {
+        uint32_t offset;
+        uint32_t length;
+    } span_t;
+
+    typedef struct node {
+        uint32_t children;
+        uint32_t count;
+        uint32_t value;
+        uint32_t svalue;
+        union {
+            span_t symbol;
+            double number;
+            int64_t integer;
+        };
+        int32_t ln, col;
+        uint8_t type;
+        uint8_t data_type;
+        uint8_t op;
+        uint8_t reserved;
+        uint32_t name;
+    } node_t;
+
+    static_assert(sizeof(header_t) == 48 && sizeof(node_t) == 40, "cache layout changed, bump VERSION");
+
+    bool& enabled();
+    uint64_t hash(const char* data, size_t len);
+
+    std::string path_for(const std::string& script);
+
+    // the tree is allocated in the parser's arena, nullptr when there is no
+    // usable cache
+    ast_node* load(parser_t& p, const std::string& script);
+    bool store(parser_t& p, ast_node* root, const std::string& script);
+}
+
+#endif // CACHE_H_
@@ -0,0 +1,183 @@
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+
+#include "runtime.h"
+#include "types.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// bounded queue for any number of producers and consumers that never takes
+// a lock, after dmitry vyukov's. every cell carries a sequence number that
+// says whose turn it is: a producer may fill the cell at tail once its
+// sequence equals tail, a consumer may empty the one at head once it equals
+// head + 1. claiming a cell is one compare and swap on tail or head, which
+// sit on cache lines of their own, so producers only contend with
+// producers and consumers with consumers
+template<typename T>
+struct bounded_queue {
+    typedef struct cell {
+        std::atomic<size_t> seq;
+        T data;
+    } cell_t;
+
+    std::unique_ptr<cell_t[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+
+    // capacity is rounded up to a power of two
+    bounded_queue(size_t capacity) : head(0), tail(0) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+
+        cells = std::make_unique<cell_t[]>(size);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+    // false when it's full
+    bool push(T& val) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        cell_t* at;
+
+        for (;;) {
+            at = &cells[pos & mask];
+            intptr_t diff = static_cast<intptr_t>(at->seq.load(std::memory_order_acquire)) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        at->data = std::move(val);
+        at->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // false when it's empty
+    bool pop(T& out) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        cell_t* at;
+
+        for (;;) {
+            at = &cells[pos & mask];
+            intptr_t diff = static_cast<intptr_t>(at->seq.load(std::memory_order_acquire)) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        out = std::move(at->data);
+        at->seq.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// a value copied out of one isolate's heap into plain c++ memory, so it
+// can be rebuilt in another's. object keys travel as names, atoms mean
+// something different in every isolate. nothing in it points back into
+// the heap it came from
+typedef struct message {
+    dtype_t type = dtype::nil;
+    union {
+        int64_t integer = 0;
+        double number;
+        bool boolean;
+    };
+    // strings
+    std::string text;
+    // array elements, object members
+    std::vector<message> items;
+    std::vector<std::string> keys;
+    // packed arrays
+    std::vector<int64_t> ints;
+    std::vector<double> floats;
+    std::shared_ptr<struct channel> chan;
+} message_t;
+
+// a bounded queue of messages between isolates. receivers wait for a
+// message and senders for room by parking on a counter the other side
+// bumps, never by spinning, and only wake them when one is parked
+typedef struct channel {
+    bounded_queue<message_t> queue;
+    std::atomic<bool> closed;
+    // bumped after every send and every receive
+    std::atomic<uint32_t> sent;
+    std::atomic<uint32_t> taken;
+    std::atomic<uint32_t> receivers_parked;
+    std::atomic<uint32_t> senders_parked;
+
+    channel(size_t capacity) : queue(capacity), closed(false), sent(0), taken(0), receivers_parked(0), senders_parked(0) {};
+
+    // waits while it's full, false when it's closed. waiting with every
+    // other isolate parked or done is an error
+    bool send(message_t& msg);
+    // waits while it's empty, false once it's closed and empty
+    bool recv(message_t& out);
+    bool try_recv(message_t& out);
+    // wakes everything parked on it, messages already sent can still be
+    // received
+    void close();
+    // wakes everything parked on it without closing it
+    void wake();
+} channel_t;
+
+// the channel name stands for in this process. the first open makes it
+// with room for capacity messages, later ones get the same channel
+std::shared_ptr<channel_t> open_channel(const std::string& name, size_t capacity);
+// wakes everything parked on any channel of the process
+void wake_channels();
+
+// snapshot of val, an error for values that can't leave their isolate
+message_t pack(rt_value val);
+// rebuilds msg in the current isolate's heap
+rt_value unpack(message_t& msg);
+
+// channel.open(name, capacity)
+inline rt_value channel_open(std::string name, int64_t capacity) {
+    if (capacity < 1) error_util::spit(string_format("channel.open expected a capacity of at least 1, got %lld", (long long)capacity));
+    return make_channel(open_channel(name, capacity));
+}
+
+inline void channel_send(rt_channel* ch, rt_value val) {
+    message_t msg = pack(val);
+    if (!ch->chan->send(msg)) error_util::spit("channel.send on a closed channel");
+}
+
+// channel.recv(ch[, otherwise]), otherwise is what it returns once the
+// channel is closed and empty, without it that's an error
+inline rt_value channel_recv(args_t args, void*, void*) {
+    if (args.size() != 1 && args.size() != 2) error_util::spit(string_format("channel.recv expected 1 or 2 args, got %zu", args.size()));
+    if (args[0].type() != dtype::channel) error_util::spit(string_format("channel.recv expected type channel for argument 1, got %s", dtype_to_str(args[0].type()).c_str()));
+
+    message_t msg;
+    if (static_cast<rt_channel*>(args[0].obj())->chan->recv(msg)) return unpack(msg);
+    if (args.size() == 1) error_util::spit("channel.recv on a closed channel");
+    return args[1];
+}
+
+// channel.try_recv(ch, otherwise), otherwise when nothing is waiting
+inline rt_value channel_try_recv(rt_channel* ch, rt_value otherwise) {
+    message_t msg;
+    return ch->chan->try_recv(msg) ? unpack(msg) : otherwise;
+}
+
+inline void channel_close(rt_channel* ch) {
+    ch->chan->close();
+}
+
+#endif // CHANNEL_H_
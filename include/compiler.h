@@ -0,0 +1,47 @@
+#ifndef COMPILER_H_
+#define COMPILER_H_
+
+#include "ast.h"
+#include "bytecode.h"
+#include "runtime.h"
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// lowers the tree produced by parser::parse() into bytecode chunks for the vm.
+// every function literal gets its own chunk, stored on the function value
+typedef struct compiler {
+    std::string_view source;
+    chunk_t* current;
+    ast_node* function;
+    std::map<std::string, uint32_t, std::less<>> strings;
+    // every chunk made, whoever runs them frees them
+    std::vector<chunk_t*> chunks;
+
+    compiler(std::string_view source) : source(source), current(nullptr), function(nullptr) {};
+
+    chunk_t* compile(ast_node* root);
+    chunk_t* compile_chunk(ast_node* body, std::string name, ast_node* fn);
+
+    void compile_stmt(ast_node* node);
+    void compile_body(ast_node* body);
+    void compile_expr(ast_node* node);
+    void compile_load(ast_node* node);
+    void compile_assign(ast_node* node);
+    void compile_call(ast_node* node, opcode_t op = opcode::op_call);
+    void compile_return(ast_node* node);
+    void compile_member(ast_node* node);
+    void compile_binary(ast_node* node);
+    void compile_if(ast_node* node);
+    void compile_while(ast_node* node);
+    void compile_import(ast_node* node);
+    rt_value compile_function(ast_node* node);
+
+    uint32_t add_constant(rt_value value, position_t pos);
+    uint32_t add_string(std::string_view str, position_t pos);
+    size_t emit(opcode_t op, uint32_t arg, position_t pos);
+    void emit_member(ast_node* link);
+} compiler_t;
+
+#endif // COMPILER_H_
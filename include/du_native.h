@@ -0,0 +1,115 @@
+#ifndef DU_NATIVE_H_
+#define DU_NATIVE_H_
+
+/*
+ * c abi for native extension modules, loaded by
+ *
+ *     import "libfoo.so" as foo;
+ *
+ * the library exports du_module_init. it is called once, the first time
+ * any script imports the library, and defines the module's functions
+ * with api->define. foo is then an object with one member per function.
+ * a library only ever touches script values through the api table, so
+ * it keeps working across interpreter versions as long as the major
+ * version matches:
+ *
+ *     static du_value add(const du_api* api, const du_value* args, size_t argc) {
+ *         return api->from_int(api->to_int(args[0]) + api->to_int(args[1]));
+ *     }
+ *
+ *     DU_EXPORT uint32_t du_module_init(const du_api* api, du_module* mod) {
+ *         static const du_type types[] = {DU_INT, DU_INT};
+ *         api->define(mod, "add", add, 2, types);
+ *         return DU_NATIVE_ABI_VERSION;
+ *     }
+ *
+ * values handed to a native, and ones it makes, are only good until it
+ * returns. nothing is collected while a native runs
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* major in the high 16 bits, minor in the low. minor versions only append
+ * members to du_api, a library built against an older minor runs on a
+ * newer host */
+#define DU_NATIVE_ABI_MAJOR 1
+#define DU_NATIVE_ABI_MINOR 0
+#define DU_NATIVE_ABI_VERSION ((DU_NATIVE_ABI_MAJOR << 16) | DU_NATIVE_ABI_MINOR)
+
+#ifdef __cplusplus
+#define DU_EXPORT extern "C" __attribute__((visibility("default")))
+extern "C" {
+#else
+#define DU_EXPORT __attribute__((visibility("default")))
+#endif
+
+/* opaque, never look at the bits */
+typedef struct du_value {
+    uint64_t bits;
+} du_value;
+
+typedef enum du_type {
+    DU_ANY,
+    DU_NIL,
+    DU_BOOL,
+    DU_INT,
+    DU_FLOAT,
+    DU_STRING,
+    DU_ARRAY,
+    DU_OBJECT,
+    DU_FUNCTION,
+} du_type;
+
+typedef struct du_api du_api;
+typedef struct du_module du_module;
+
+/* args have already been checked against the arity and types given to
+ * define */
+typedef du_value (*du_native_fn)(const du_api* api, const du_value* args, size_t argc);
+
+struct du_api {
+    uint32_t version;
+    /* sizeof(du_api) on the host */
+    uint32_t size;
+
+    /* arity -1 takes any number of arguments. types has arity entries,
+     * or is NULL to accept anything. name is copied */
+    void (*define)(du_module* mod, const char* name, du_native_fn fn, int arity, const du_type* types);
+
+    du_type (*type_of)(du_value v);
+
+    du_value (*nil)(void);
+    du_value (*from_bool)(int b);
+    du_value (*from_int)(int64_t i);
+    du_value (*from_float)(double d);
+    /* data is copied */
+    du_value (*from_string)(const char* data, size_t len);
+    du_value (*new_array)(void);
+
+    int (*to_bool)(du_value v);
+    int64_t (*to_int)(du_value v);
+    double (*to_float)(du_value v);
+    /* not nul terminated */
+    const char* (*string_data)(du_value v, size_t* len);
+
+    size_t (*array_length)(du_value v);
+    du_value (*array_get)(du_value v, size_t i);
+    void (*array_push)(du_value arr, du_value elem);
+
+    /* makes the running call a script error once the native returns,
+     * whatever it returns is ignored. message is copied */
+    du_value (*fail)(const char* message);
+};
+
+typedef uint32_t (*du_module_init_fn)(const du_api* api, du_module* mod);
+
+/* returns the DU_NATIVE_ABI_VERSION it was built with, or 0 when it
+ * can't run on this host */
+#define DU_MODULE_INIT "du_module_init"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DU_NATIVE_H_ */
@@ -1,44 +1,134 @@
 #ifndef __ENV_H__
 #define __ENV_H__
 
+#include <algorithm>
+#include <cstdlib>
 #include <map>
+#include <new>
+#include <string>
 #include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include "gc.h"
 #include "runtime.h"
 
-typedef struct environment {
-    std::shared_ptr<environment> parent;
-    std::map<std::string, rt_value*> variables;
-    void* interpret;
+// a frame of variable slots. function frames that no nested function can
+// reach point into the interpreter's value stack, everything else (the
+// global frame, frames captured by closures) owns its slots on the heap
+// and is managed by the collector
+typedef struct environment : rt_heap {
+    environment* parent;
+    rt_value* slots;
+    std::vector<rt_value> storage;
+    std::map<std::string, int>* names;
 
-    environment(environment* parent = nullptr) : parent(parent) {}
+    // global frame, slots are handed out by name
+    environment() : rt_heap(dtype::env), parent(nullptr), slots(nullptr), names(new std::map<std::string, int>()) {}
 
-    void assign(const std::string& key, rt_value* val) {
-        variables[key] = val;
+    // frame whose slots live on the value stack
+    environment(environment* parent, rt_value* slots) : rt_heap(dtype::env), parent(parent), slots(slots), names(nullptr) {}
+
+    // heap frame
+    environment(environment* parent, size_t size) : rt_heap(dtype::env), parent(parent), storage(size, rt_value::undefined()), names(nullptr) {
+        slots = storage.data();
+    }
+
+    ~environment() {
+        delete names;
+    }
+
+    int define(const std::string& key) {
+        auto it = names->find(key);
+        if (it != names->end()) return it->second;
+
+        int slot = storage.size();
+        storage.push_back(rt_value::undefined());
+        slots = storage.data();
+        (*names)[key] = slot;
+
+        return slot;
     }
 
-    rt_value* get_var(const std::string& key) {
-        // Check if the variable exists in the current environment
-        auto it = variables.find(key);
-        if (it != variables.end()) {
-            return it->second;
-        }
+    void assign(const std::string& key, rt_value val) {
+        int slot = define(key);
+        slots[slot] = val;
+        gc_heap().barrier(this);
+    }
 
-        // If not found in the current environment, check in the parent environment
-        if (parent != nullptr) {
-            return parent->get_var(key);
-        }
+    rt_value& at(int depth, int slot) {
+        environment* env = this;
+        while (depth-- > 0) env = env->parent;
+        return env->slots[slot];
+    }
 
-        // Return nullptr if the variable is not found
-        return nullptr; // Changed to return nullptr for better error handling
+    void set(int depth, int slot, rt_value val) {
+        environment* env = this;
+        while (depth-- > 0) env = env->parent;
+        env->slots[slot] = val;
+        gc_heap().barrier(env);
     }
 
-    void* get_interpreter() {
-        if (interpret == nullptr && parent != nullptr) return parent->get_interpreter();
-        else {
-            if (interpret != nullptr) return interpret;
-            return nullptr;
-        }
+    rt_value get_var(const std::string& key) {
+        // by-name lookups only make sense on the global frame
+        if (names == nullptr) return parent != nullptr ? parent->get_var(key) : rt_value::undefined();
+
+        auto it = names->find(key);
+        if (it != names->end()) return slots[it->second];
+
+        return rt_value::undefined();
     }
 } environment_t;
 
-#endif // __ENV_H__
\ No newline at end of file
+inline environment_t* make_environment() {
+    return gc_heap().track(new environment(), sizeof(environment));
+}
+
+inline environment_t* make_environment(environment_t* parent, size_t size) {
+    return gc_heap().track(new environment(parent, size), sizeof(environment) + size * sizeof(rt_value));
+}
+
+// contiguous storage for stack frames (and, in the vm, operands). it is
+// allocated once and never moves, so frames can keep raw slot pointers
+typedef struct value_stack {
+    rt_value* base;
+    rt_value* top;
+    rt_value* limit;
+
+    // the whole size is reserved up front but pages are only committed as
+    // the stack grows into them, so a big limit costs nothing until used
+    value_stack(size_t size) {
+        void* at = mmap(nullptr, size * sizeof(rt_value), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (at == MAP_FAILED) throw std::bad_alloc();
+        base = static_cast<rt_value*>(at);
+        top = base;
+        limit = base + size;
+    }
+
+    value_stack(const value_stack&) = delete;
+    value_stack& operator=(const value_stack&) = delete;
+
+    ~value_stack() {
+        munmap(base, (limit - base) * sizeof(rt_value));
+    }
+
+    bool fits(size_t n) {
+        return static_cast<size_t>(limit - top) >= n;
+    }
+
+    rt_value* alloc(size_t n) {
+        rt_value* at = top;
+        std::fill(at, at + n, rt_value::undefined());
+        top += n;
+        return at;
+    }
+
+    void push(rt_value val) {
+        *top++ = val;
+    }
+
+    rt_value pop() {
+        return *--top;
+    }
+} value_stack_t;
+
+#endif // __ENV_H__
@@ -6,8 +6,12 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <stdio.h>
+#include <utility>
+#include <vector>
 
 inline std::vector<std::string> split(std::string s, std::string delimiter) {
     size_t pos_start = 0, pos_end, delim_len = delimiter.length();
@@ -24,29 +28,61 @@ inline std::vector<std::string> split(std::string s, std::string delimiter) {
     return res;
 }
 
+// what spit throws, carrying the report as it gets printed. it unwinds
+// out of whatever the isolate was running, see isolate::run
+typedef struct script_error : std::runtime_error {
+    // what went wrong, kept when there was no position to report it at so
+    // the call to the native that raised it can add its own
+    std::string unplaced;
+
+    script_error(const std::string& report, std::string unplaced = "") : std::runtime_error(report), unplaced(std::move(unplaced)) {}
+} script_error_t;
+
 typedef struct error {
     std::string what;
     position_t position;
-    std::string source;
+    // the script's text, owned by its parser. an error is reported before
+    // anything can free it
+    std::string_view source;
     bool has_pos;
 
     error(std::string w) : what(w), has_pos(false) {}
-    error(std::string w, position_t pos, std::string src) : what(w), has_pos(true), source(src), position(pos) {};
+    error(std::string w, position_t pos, std::string_view src) : what(w), position(pos), source(src), has_pos(true) {};
 
-    inline void spit() {
-        if (has_pos) {
-            std::string line = split(source, "\n")[position.ln - 1];
-            std::string arrow = std::string(position.col - 1, ' ') + "^";
-            printf("%s\n%s\n", line.c_str(), arrow.c_str());
-            printf("\nerror: %s\n", what.c_str());
-        } else printf("error: %s\n", what.c_str());
+    std::string report() const {
+        if (!has_pos) return "error: " + what + "\n";
+
+        // the line the error is on, found without splitting the whole source
+        size_t start = 0;
+        for (int ln = 1; ln < position.ln && start != std::string_view::npos; ln++) {
+            start = source.find('\n', start);
+            if (start != std::string_view::npos) start++;
+        }
+        std::string line = start == std::string_view::npos ? "" : std::string(source.substr(start, source.find('\n', start) - start));
+        std::string arrow = std::string(position.col - 1, ' ') + "^";
+        return line + "\n" + arrow + "\n\nerror: " + what + "\n";
+    }
 
-        exit(EXIT_FAILURE);
+    [[noreturn]] inline void spit() {
+        throw script_error(report(), has_pos ? "" : what);
     }
 } error_t;
 
+// calls a native, an error it raises without a position gets the one of
+// the call
+template<typename F>
+inline auto at_call(position_t pos, std::string_view source, F call)
+{
+    try {
+        return call();
+    } catch (const script_error& err) {
+        if (err.unplaced.empty()) throw;
+        error(err.unplaced, pos, source).spit();
+    }
+}
+
 namespace error_util {
-    inline void spit(std::string what) {
+    [[noreturn]] inline void spit(std::string what) {
         error(what).spit();
     }
 }
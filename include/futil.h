@@ -5,15 +5,24 @@
 #include <string>
 
 namespace futil {
+    // reads the whole file in one go, the text always ends in a newline
+    // unless it's empty. a missing file reads as empty
     inline std::string read_file(const char* path) {
-        std::string fin, line;
-        std::ifstream f(path);
+        std::string fin;
+        std::ifstream f(path, std::ios::binary);
 
         if (f.is_open()) {
-            while (std::getline(f, line)) {
-                fin += line + "\n";
+            f.seekg(0, std::ios::end);
+            std::streamoff size = f.tellg();
+            f.seekg(0, std::ios::beg);
+
+            if (size > 0) {
+                fin.resize(size);
+                f.read(fin.data(), size);
+                fin.resize(f.gcount());
             }
 
+            if (!fin.empty() && fin.back() != '\n') fin += '\n';
             f.close();
         }
 
@@ -0,0 +1,179 @@
+#ifndef GC_H_
+#define GC_H_
+
+#include "value.h"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+struct interpreter;
+
+// where a thread running parallel callbacks allocates, and the old objects
+// it wrote young values into, so it never touches the heap's own lists.
+// the heap takes them over once the parallel section ends, and doesn't
+// collect on a thread that has one
+typedef struct local_heap {
+    rt_heap* young = nullptr;
+    size_t bytes = 0;
+    size_t objects = 0;
+    // growth of old objects the callbacks were allowed to change
+    size_t old_bytes = 0;
+    std::vector<rt_heap*> remembered;
+} local_heap_t;
+
+inline thread_local local_heap_t* local_young = nullptr;
+
+// points this thread's allocations at local until it goes out of scope
+typedef struct local_scope {
+    local_scope(local_heap_t* local) {
+        local_young = local;
+    }
+
+    ~local_scope() {
+        local_young = nullptr;
+    }
+} local_scope_t;
+
+// sizes given on the command line, every heap starts out with them. 0
+// keeps the built in default
+typedef struct gc_config {
+    size_t nursery = 0;
+    size_t old_size = 0;
+    double growth = 0;
+} gc_config_t;
+
+inline gc_config_t& gc_defaults() {
+    static gc_config_t config;
+    return config;
+}
+
+typedef struct gc_stats {
+    size_t minor_collections = 0;
+    size_t major_collections = 0;
+    size_t allocated_objects = 0;
+    size_t allocated_bytes = 0;
+    size_t freed_objects = 0;
+    size_t freed_bytes = 0;
+    size_t promoted_objects = 0;
+    size_t peak_bytes = 0;
+    double minor_ms = 0;
+    double major_ms = 0;
+} gc_stats_t;
+
+// precise, non-moving generational mark-sweep collector. new objects go
+// into the young generation and are promoted to the old one once they
+// survive a minor collection. old objects that get a young value written
+// into them are remembered by the write barrier, so a minor collection
+// only has to trace the roots, the remembered set and the young objects.
+// collections only run at safepoints, where every live value is reachable
+// from an interpreter's value stack, environments or vm frames
+typedef struct gc {
+    rt_heap* young;
+    rt_heap* old;
+    size_t young_bytes;
+    size_t old_bytes;
+
+    // bytes allocated before a minor collection, old generation size that
+    // triggers a major one, and how far the latter grows past live data
+    size_t nursery_size;
+    size_t old_threshold;
+    size_t old_min;
+    double growth;
+
+    std::vector<rt_heap*> remembered;
+    std::vector<rt_heap*> pinned;
+    // objects something outside the heap still needs for a while, like
+    // tasks the event loop hasn't settled yet
+    std::unordered_set<rt_heap*> held;
+    std::vector<rt_heap*> gray;
+    std::vector<interpreter*> roots;
+    gc_stats_t stats;
+
+    gc() : young(nullptr), old(nullptr), young_bytes(0), old_bytes(0), nursery_size(4 << 20), old_threshold(32 << 20), old_min(32 << 20), growth(2.0) {
+        configure(gc_defaults().nursery, gc_defaults().old_size, gc_defaults().growth);
+    };
+
+    // frees everything still on the heap, pinned objects included
+    ~gc();
+
+    template <typename T>
+    T* track(T* obj, size_t bytes) {
+        obj->bytes = bytes;
+
+        if (local_young != nullptr) {
+            obj->next = local_young->young;
+            local_young->young = obj;
+            local_young->bytes += bytes;
+            local_young->objects++;
+            return obj;
+        }
+
+        obj->next = young;
+        young = obj;
+        young_bytes += bytes;
+        stats.allocated_objects++;
+        stats.allocated_bytes += bytes;
+        return obj;
+    }
+
+    // keeps a value alive for the life of the heap, used for constants
+    // the compiler bakes into chunks
+    rt_value pin(rt_value val) {
+        if (val.is_obj()) pinned.push_back(val.obj());
+        return val;
+    }
+
+    void hold(rt_heap* obj) {
+        held.insert(obj);
+    }
+
+    void release(rt_heap* obj) {
+        held.erase(obj);
+    }
+
+    // containers call this after adding to themselves. storage they grew
+    // into counts as allocated, so filling them up brings the next
+    // collection closer like allocating new objects does
+    void grew(rt_heap* obj);
+
+    void barrier(rt_heap* obj) {
+        if (obj->old && !obj->remembered) {
+            obj->remembered = true;
+            if (local_young != nullptr) local_young->remembered.push_back(obj);
+            else remembered.push_back(obj);
+        }
+    }
+
+    void safepoint() {
+        if (young_bytes >= nursery_size) collect();
+    }
+
+    void add_root(interpreter* inter);
+    void remove_root(interpreter* inter);
+    void configure(size_t nursery, size_t old_size, double grow);
+
+    void adopt(local_heap_t& local);
+    void collect();
+    void minor();
+    void major();
+    void mark_roots(bool full);
+    void mark_value(rt_value val, bool full);
+    void mark_object(rt_heap* obj, bool full);
+    void trace(bool full);
+    rt_heap* sweep(rt_heap* list, bool promote, size_t& survivors);
+    void settle(rt_heap* obj);
+    void dump();
+} gc_t;
+
+// the heap of the isolate running on this thread, see isolate.h
+inline thread_local gc_t* current_heap = nullptr;
+
+inline gc_t& gc_heap() {
+    return *current_heap;
+}
+
+size_t object_size(rt_heap* obj);
+void free_object(rt_heap* obj);
+
+#endif // GC_H_
@@ -3,35 +3,116 @@
 
 #include "ast.h"
 #include "env.h"
+#include "gc.h"
+#include "module.h"
+#include "native_stack.h"
 #include "parser.h"
 #include "runtime.h"
 #include "types.h"
+#include "vm.h"
+
+constexpr size_t VALUE_STACK_SIZE = 1 << 24;
 
 typedef struct interpreter {
-    std::string source;
+    // where the script came from, empty for source that isn't in a file
+    std::string path;
+    // owns the script's text, source looks into it
     parser_t p;
+    std::string_view source;
+    vm_t* machine;
+    // what the compiler made for run_vm
+    std::vector<chunk_t*> chunks;
+    environment_t* globals;
+    value_stack_t stack;
+    // heap frames the tree walker is running in, they are collector roots
+    std::vector<environment_t*> scopes;
+    // shared by the program and every module it imports, owned by the
+    // interpreter that made it
+    module_registry_t* modules;
+    bool owns_modules;
+    // script calls running, and the call a return in tail position left
+    // on the stack for the frame it returns from to run instead
+    size_t depth;
+    rt_value* tail;
+    // set on the helpers running parallel callbacks next to each other,
+    // they leave node types and member caches as they find them
+    bool shared;
+    // one per pool thread, made the first time a parallel builtin runs
+    std::vector<interpreter*> helpers;
+
+    interpreter(std::string source, std::string path = "", module_registry_t* modules = nullptr, size_t stack_size = VALUE_STACK_SIZE)
+    : path(path), p(std::move(source)), source(p.source), machine(nullptr), globals(nullptr), stack(stack_size),
+      modules(modules != nullptr ? modules : new module_registry()), owns_modules(modules == nullptr), depth(0), tail(nullptr), shared(false) {
+        gc_heap().add_root(this);
+
+        // the program itself is the first link of every import chain
+        if (owns_modules && !path.empty()) this->modules->loading.push_back(this->modules->add(canonical_path(path)));
+    };
+
+    // runs code origin already parsed: it reads origin's source and shares
+    // its modules, only the stacks are its own
+    interpreter(interpreter* origin, size_t stack_size = VALUE_STACK_SIZE)
+    : path(origin->path), p(""), source(origin->source), machine(nullptr), globals(nullptr), stack(stack_size),
+      modules(origin->modules), owns_modules(false), depth(0), tail(nullptr), shared(false) {
+        gc_heap().add_root(this);
+    };
 
-    interpreter(std::string source) : source(source), p(source) {};
+    ~interpreter() {
+        gc_heap().remove_root(this);
+        for (interpreter* helper : helpers) delete helper;
+        if (owns_modules) delete modules;
+        for (chunk_t* code : chunks) delete code;
+        delete machine;
+    }
 
-    rt_value_t* run();
+    ast_node* program();
+    rt_value_t run();
+    rt_value_t run_vm();
+    environment_t* global_scope();
+    rt_value_t load_module(const std::string& path, position_t pos);
     
-    rt_value_t* eval(ast_node* node, environment_t* env);
-    rt_value_t* eval_assign(ast_node* node, environment_t* env);
-    rt_value_t* eval_object(ast_node* node, environment_t* env);
-    rt_value_t* eval_array(ast_node* node, environment_t* env);
-    rt_value_t* eval_function(ast_node* node, environment_t* env);
-    rt_value_t* eval_scope(ast_node* node, environment_t* env);
-    rt_value_t* eval_call(ast_node* node, environment_t* env);
-    rt_value* call_func(rt_value* func, std::vector<rt_value*> args, environment_t* env);
-    rt_value_t* eval_call(ast_node* node, environment_t* env, rt_value* func);
-    rt_value_t* eval_cfunc(rt_value* cfunc);
-    rt_value_t* eval_member(ast_node* node, environment_t* env);
-    rt_value_t* eval_arrindex(ast_node* node, environment_t* env);
-    rt_value_t* eval_import(ast_node* node, environment_t* env);
-    rt_value_t* eval_binary(ast_node* node, environment_t* env);
-    rt_value_t* eval_if(ast_node* node, environment_t* env);
-    rt_value_t* eval_while(ast_node* node, environment_t* env);
-    rt_value_t* eval_scope_samenv(ast_node* node, environment_t* env);
+    rt_value_t eval(ast_node* node, environment_t* env);
+    rt_value_t eval_identifier(ast_node* node, environment_t* env);
+    rt_value_t eval_assign(ast_node* node, environment_t* env);
+    rt_value_t eval_object(ast_node* node, environment_t* env);
+    rt_value_t eval_array(ast_node* node, environment_t* env);
+    rt_value_t eval_function(ast_node* node, environment_t* env);
+    rt_value_t eval_scope(ast_node* node, environment_t* env);
+    rt_value_t eval_call(ast_node* node, environment_t* env);
+    rt_value call_func(rt_value func, args_t args, environment_t* env);
+    rt_value_t eval_call(ast_node* node, environment_t* env, rt_value func);
+    rt_value* push_args(ast_node* node, environment_t* env, rt_value func);
+    rt_value_t tail_call(ast_node* node, environment_t* env);
+    rt_value_t eval_frame(rt_value func, rt_value* slots, position_t pos);
+    rt_value_t run_frame(rt_value func, rt_value* slots);
+    rt_value_t eval_cfunc(rt_value cfunc);
+    rt_value_t get_member(rt_value obj, ast_node* link, bool required);
+    rt_value_t eval_member(ast_node* node, environment_t* env);
+    rt_value_t eval_arrindex(ast_node* node, environment_t* env);
+    rt_value_t eval_import(ast_node* node, environment_t* env);
+    rt_value_t eval_binary(ast_node* node, environment_t* env);
+    rt_value_t eval_quick(ast_node* node, environment_t* env);
+    rt_value_t binary(ast_node* node, rt_value left, rt_value right);
+    rt_value_t eval_if(ast_node* node, environment_t* env);
+    rt_value_t eval_while(ast_node* node, environment_t* env);
+    rt_value_t eval_scope_samenv(ast_node* node, environment_t* env);
 } interpreter_t;
 
+// the interpreter whose code this thread is running, natives that call
+// back into scripts push onto its stack. run and run_vm set it while they
+// run, the threads of a parallel builtin set it to their helper
+inline thread_local interpreter* running_interpreter = nullptr;
+
+typedef struct running {
+    interpreter* saved;
+
+    running(interpreter* inter) : saved(running_interpreter) {
+        running_interpreter = inter;
+    }
+
+    ~running() {
+        running_interpreter = saved;
+    }
+} running_t;
+
 #endif // __INTERPRETER_H__
\ No newline at end of file
@@ -0,0 +1,170 @@
+#ifndef ISOLATE_H_
+#define ISOLATE_H_
+
+#include "gc.h"
+#include "interpreter.h"
+#include "shape.h"
+#include "symbol.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct isolate;
+struct event_loop;
+
+inline thread_local isolate* current_isolate = nullptr;
+
+// a program with nothing in common with any other: its own heap, atoms,
+// shapes and site tables, and through its interpreter its own globals and
+// module registry. the runtime reaches all of them through thread local
+// pointers that entering the isolate sets, so an isolate can run on any
+// thread but only ever on one at a time, apart from the pool threads a
+// parallel builtin it called lends it
+typedef struct isolate {
+    gc_t heap;
+    symbol_table_t symbols;
+    shape_table_t shapes;
+    site_tables_t sites;
+    interpreter* main;
+    // runs its tasks, made by the first one
+    event_loop* loop;
+    std::string path;
+    // the reports of the errors that stopped it, in the order they came
+    std::vector<std::string> errors;
+    // channels it opened. they are closed when it fails, so whatever waits
+    // on them in other isolates wakes up instead of waiting for good
+    std::vector<std::shared_ptr<channel>> channels;
+
+    // points the thread at an isolate until it goes out of scope, nullptr
+    // points it at none
+    typedef struct scope {
+        isolate* saved;
+
+        scope(isolate* iso) : saved(current_isolate) {
+            enter(iso);
+        }
+
+        ~scope() {
+            enter(saved);
+        }
+
+        static void enter(isolate* iso);
+    } scope_t;
+
+    isolate() : main(nullptr), loop(nullptr) {};
+    ~isolate();
+
+    isolate(const isolate&) = delete;
+    isolate& operator=(const isolate&) = delete;
+
+    // runs source as the isolate's program, false when an error stopped it
+    bool run(const std::string& source, const std::string& path, bool use_vm);
+    void opened(std::shared_ptr<channel> chan);
+    // prints the errors under the script's path
+    void report();
+} isolate_t;
+
+// host threads that each take the next script off a queue and run it in an
+// isolate of its own. an isolate stays on the thread that runs it, the
+// caller gets it back once it's done. at most limit isolates run at once,
+// but one that parks waiting on a channel stops counting until it wakes
+// up, and a thread is started for the next script if none is free. that
+// way scripts blocked on each other's messages can't hold every slot.
+// once nothing runs and nothing is queued but some are still parked, they
+// are all woken to try again, one woken for real while nothing ran may
+// not have unparked yet. if every one of them parks again without
+// anything having run in between, none can ever go on and they're woken
+// to fail
+typedef struct isolate_pool {
+    typedef std::packaged_task<std::unique_ptr<isolate_t>()> task_t;
+
+    std::vector<std::thread> threads;
+    std::deque<task_t> queue;
+    // scripts taken off the queue for a waiting thread
+    std::deque<task_t> handed;
+    std::mutex lock;
+    std::condition_variable ready;
+    size_t limit;
+    // isolates running and not parked
+    size_t active;
+    // threads waiting for a script, less the ones already handed one
+    size_t idle;
+    size_t parked;
+    // woken by the last round and not unparked yet
+    size_t pending;
+    // parked again after trying once more since the last round started
+    size_t rechecked;
+    // something finished or parked fresh since the last round started
+    bool progressed;
+    // bumped every time everything parked is woken to try again
+    uint64_t rounds;
+    // bumped when trying again got none of them anywhere
+    std::atomic<uint64_t> deadlocks;
+    // no more scripts will be submitted
+    bool sealed;
+    bool closing;
+
+    isolate_pool(size_t count);
+    // runs whatever is still queued, then joins
+    ~isolate_pool();
+
+    std::future<std::unique_ptr<isolate_t>> submit(std::string path, bool use_vm);
+    // says every script has been submitted, nothing counts as deadlocked
+    // before
+    void seal();
+    // counts the isolate the calling thread runs as the pool's only one,
+    // for a lone script that runs on the main thread without a pool
+    void adopt();
+    void loop(task_t task);
+    // with lock held, starts queued scripts while there is room
+    void schedule();
+    // with lock held, wakes everything parked if nothing else could.
+    // stalled says the last one to park was trying again
+    void settle(bool stalled);
+    void park(bool recheck, uint64_t& round, uint64_t& deadlock);
+    void unpark(bool recheck, uint64_t round);
+} isolate_pool_t;
+
+inline thread_local isolate_pool_t* current_pool = nullptr;
+
+// tells the pool running this thread's isolate that it's about to block
+// until something another isolate does, for as long as it's in scope.
+// recheck says it already waited once for the same thing and found it
+// still wasn't there
+typedef struct parked {
+    isolate_pool_t* pool;
+    bool recheck;
+    uint64_t round;
+    uint64_t deadlock;
+
+    parked(bool recheck) : pool(current_pool), recheck(recheck), round(0), deadlock(0) {
+        if (pool != nullptr) pool->park(recheck, round, deadlock);
+    }
+
+    // woken because it can never get what it waits for
+    bool deadlocked() const {
+        return pool != nullptr && pool->deadlocks.load() != deadlock;
+    }
+
+    ~parked() {
+        if (pool != nullptr) pool->unpark(recheck, round);
+    }
+} parked_t;
+
+// how many scripts run at the same time when several are given, set with
+// --isolates
+inline size_t& isolate_threads() {
+    static size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    return threads;
+}
+
+#endif // ISOLATE_H_
@@ -0,0 +1,220 @@
+#ifndef ITER_H_
+#define ITER_H_
+
+#include "env.h"
+#include "interpreter.h"
+#include "runtime.h"
+#include "types.h"
+#include <algorithm>
+#include <vector>
+
+// calls one function over and over from inside a builtin. what a call
+// checks about the callee is checked once up front, and a script function
+// run by the tree walker gets its frame laid out at the same spot on the
+// value stack every time, only the arguments are rewritten. bytecode
+// functions and natives go through call_func
+typedef struct callback {
+    interpreter* inter;
+    environment_t* env;
+    rt_value func;
+    // the prototype while the tree walker runs the calls itself
+    ast_node* proto;
+
+    callback() : inter(nullptr), env(nullptr), proto(nullptr) {};
+
+    callback(interpreter* inter, environment_t* env, rt_value func, size_t argc, const char* who)
+    : inter(inter), env(env), func(func), proto(nullptr) {
+        if (func.type() == dtype::cfunction) return;
+        if (func.type() != dtype::func || func.fn()->proto == nullptr) error_util::spit(string_format("%s expected a function, got %s", who, dtype_to_str(func.type()).c_str()));
+        if (inter->machine != nullptr && func.fn()->chunk != nullptr) return;
+
+        proto = func.fn()->proto;
+        if (proto->children.size() != argc) error(string_format("%s expected a function of %zu args, got %zu", who, argc, proto->children.size()), proto->pos, inter->source).spit();
+        if (!inter->stack.fits(proto->locals + 1)) error("stack overflow", proto->pos, inter->source).spit();
+    };
+
+    rt_value operator()(args_t args) {
+        if (proto == nullptr) return inter->call_func(func, args, env);
+
+        // a tail call in the body may have left another callee below the
+        // slots, so the callee is written back along with the arguments
+        rt_value* slots = inter->stack.top + 1;
+        slots[-1] = func;
+        for (size_t i = 0; i < args.size(); i++) {
+            ast_node* id = proto->children[i];
+            if (id->data_type != dtype::any && args[i].type() != id->data_type) error(string_format("expected type %s for argument %s, got %s", dtype_to_str(id->data_type).c_str(), std::string(id->symbol).c_str(), dtype_to_str(args[i].type()).c_str()), proto->pos, inter->source).spit();
+            slots[i] = args[i];
+        }
+
+        inter->stack.top = slots + args.size();
+        return inter->eval_frame(func, slots, proto->pos);
+    }
+
+    rt_value operator()(rt_value arg) {
+        return (*this)(args_t(&arg, 1));
+    }
+
+    rt_value operator()(rt_value a, rt_value b) {
+        rt_value args[2] = {a, b};
+        return (*this)(args_t(args, 2));
+    }
+} callback_t;
+
+inline bool is_iterable(rt_value src) {
+    return src.type() == dtype::array || src.type() == dtype::iter;
+}
+
+inline void check_iterable(rt_value src, const char* who) {
+    if (!is_iterable(src)) error_util::spit(string_format("%s expected an array or iter, got %s", who, dtype_to_str(src.type()).c_str()));
+}
+
+inline void check_callable(rt_value func, const char* who) {
+    if (func.type() != dtype::func && func.type() != dtype::cfunction) error_util::spit(string_format("%s expected a function, got %s", who, dtype_to_str(func.type()).c_str()));
+}
+
+// a map, filter or take stage of a pipeline being drained
+typedef struct iter_step {
+    iter_stage_t stage;
+    callback_t call;
+    // how many more a take lets through
+    int64_t left;
+} iter_step_t;
+
+// pulls every element of src through all of its stages in one pass and
+// hands whatever comes out the far end to sink, nothing in between is
+// collected anywhere. sink returns false to stop early. values the caller
+// keeps across sink calls must sit on the value stack, the callbacks can
+// collect garbage
+template<typename F>
+inline void drain(environment_t* env, rt_value src, const char* who, F sink)
+{
+    interpreter_t* inter = running_interpreter;
+    check_iterable(src, who);
+
+    std::vector<rt_iter*> chain;
+    while (src.type() == dtype::iter && static_cast<rt_iter*>(src.obj())->stage != iter_stage::range) {
+        chain.push_back(static_cast<rt_iter*>(src.obj()));
+        src = chain.back()->source;
+    }
+
+    std::vector<iter_step_t> steps;
+    steps.reserve(chain.size());
+    for (auto it = chain.rbegin(); it != chain.rend(); it++) {
+        rt_iter* link = *it;
+        if (link->stage == iter_stage::take) {
+            if (link->stop <= 0) return;
+            steps.push_back(iter_step{link->stage, callback(), link->stop});
+        } else {
+            steps.push_back(iter_step{link->stage, callback(inter, env, link->func, 1, who), 0});
+        }
+    }
+
+    // false once nothing more can come out of the pipeline
+    auto feed = [&](rt_value val) -> bool {
+        bool last = false;
+
+        for (iter_step_t& step : steps) {
+            switch (step.stage) {
+                case iter_stage::map:
+                    val = step.call(val);
+                    break;
+
+                case iter_stage::filter:
+                    if (!step.call(val).truthy()) return !last;
+                    break;
+
+                case iter_stage::take:
+                    if (--step.left == 0) last = true;
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        return sink(val) && !last;
+    };
+
+    if (src.type() == dtype::iter) {
+        rt_iter* range = static_cast<rt_iter*>(src.obj());
+        for (int64_t i = range->start; i < range->stop; i++) {
+            if (!feed(make_int(i))) return;
+        }
+        return;
+    }
+
+    // the callbacks may grow the array, so walk it by index
+    rt_array* arr = static_cast<rt_array*>(src.obj());
+    for (size_t i = 0; i < arr->arr.size(); i++) {
+        if (!feed(arr->arr[i])) return;
+    }
+}
+
+inline rt_value iter_range(int64_t start, int64_t stop) {
+    return make_iter(iter_stage::range, rt_value(), rt_value(), start, stop);
+}
+
+inline rt_value iter_map(rt_value src, rt_value func) {
+    check_iterable(src, "array.map");
+    check_callable(func, "array.map");
+    return make_iter(iter_stage::map, src, func, 0, 0);
+}
+
+inline rt_value iter_filter(rt_value src, rt_value func) {
+    check_iterable(src, "array.filter");
+    check_callable(func, "array.filter");
+    return make_iter(iter_stage::filter, src, func, 0, 0);
+}
+
+inline rt_value iter_take(rt_value src, int64_t count) {
+    check_iterable(src, "array.take");
+    return make_iter(iter_stage::take, src, rt_value(), 0, count);
+}
+
+// the accumulator is kept in a stack slot between calls so a collection
+// in one of the callbacks sees it
+inline rt_value iter_reduce(environment_t* env, rt_value src, rt_value func, rt_value init) {
+    interpreter_t* inter = running_interpreter;
+    rt_value* acc = inter->stack.top;
+    inter->stack.push(init);
+
+    callback_t call(inter, env, func, 2, "array.reduce");
+    drain(env, src, "array.reduce", [&](rt_value val) {
+        *acc = call(*acc, val);
+        return true;
+    });
+
+    rt_value result = *acc;
+    inter->stack.top = acc;
+    return result;
+}
+
+inline rt_value iter_collect(environment_t* env, rt_value src) {
+    interpreter_t* inter = running_interpreter;
+    rt_value out = make_array({});
+    rt_array* arr = static_cast<rt_array*>(out.obj());
+    rt_value* held = inter->stack.top;
+    inter->stack.push(out);
+
+    drain(env, src, "array.collect", [&](rt_value val) {
+        arr->arr.push_back(val);
+        gc_heap().grew(arr);
+        gc_heap().barrier(arr);
+        return true;
+    });
+
+    inter->stack.top = held;
+    return out;
+}
+
+inline void iter_foreach(environment_t* env, rt_value src, rt_value func) {
+    interpreter_t* inter = running_interpreter;
+    callback_t call(inter, env, func, 1, "array.foreach");
+
+    drain(env, src, "array.foreach", [&](rt_value val) {
+        call(val);
+        return true;
+    });
+}
+
+#endif // ITER_H_
@@ -0,0 +1,39 @@
+#ifndef KERNELS_H_
+#define KERNELS_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// numeric loops over packed arrays. like the lexer's scanners there is a
+// scalar set, and on x86 sse2 and avx2 sets, one of them picked once at
+// runtime. ints wrap around on overflow. the vector sets add doubles up in
+// a different order than the scalar loops, so float sums, dots and prefix
+// sums can differ in the last bits between sets. min and max of arrays
+// holding NaN are unspecified
+namespace kernels {
+    template<typename T>
+    struct ops {
+        T (*sum)(const T* a, size_t n);
+        // n > 0
+        T (*min)(const T* a, size_t n);
+        T (*max)(const T* a, size_t n);
+        T (*dot)(const T* a, const T* b, size_t n);
+        // out may be a, but not overlap it otherwise
+        void (*add)(const T* a, const T* b, T* out, size_t n);
+        void (*mul)(const T* a, const T* b, T* out, size_t n);
+        void (*scale)(const T* a, T k, T* out, size_t n);
+        void (*prefix_sum)(const T* a, T* out, size_t n);
+    };
+
+    typedef struct kernel_set {
+        const char* name;
+        ops<int64_t> i64;
+        ops<double> f64;
+    } kernel_set_t;
+
+    const kernel_set_t& scalar();
+    const kernel_set_t& best();
+    void use(const kernel_set_t& impl);
+}
+
+#endif // KERNELS_H_
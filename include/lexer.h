@@ -2,171 +2,223 @@
 #define LEXER_H_
 
 #include "position.h"
+#include "scan.h"
+#include "symbol.h"
 #include "token.h"
-#include <cctype>
 #include <cstdio>
 #include <error.h>
+#include <algorithm>
+#include <array>
 #include <string>
-#include <map>
+#include <string_view>
 #include <vector>
 
-inline std::map<std::string, token_type_t> KEYWORDS;
-
 namespace lexer {
-    inline void init_kw_def() {
-        KEYWORDS["return"] = token_type::ret;
-        KEYWORDS["import"] = token_type::import;
-        KEYWORDS["as"] = token_type::as;
-        KEYWORDS["if"] = token_type::if_t;
-        KEYWORDS["while"] = token_type::while_t;
-        KEYWORDS["else"] = token_type::else_t;
-
-        KEYWORDS["true"] = token_type::true_t;
-        KEYWORDS["false"] = token_type::false_t;
+    typedef struct keyword {
+        std::string_view text;
+        token_type_t type;
+    } keyword_t;
+
+    constexpr keyword_t KEYWORD_LIST[] = {
+        {"return", token_type::ret},
+        {"import", token_type::import},
+        {"as", token_type::as},
+        {"if", token_type::if_t},
+        {"while", token_type::while_t},
+        {"else", token_type::else_t},
+        {"true", token_type::true_t},
+        {"false", token_type::false_t},
+        {"async", token_type::async_t},
+        {"await", token_type::await_t},
+    };
+
+    constexpr size_t KEYWORD_SLOTS = 16;
+
+    // perfect hash over the keyword list, checked below at compile time.
+    // anything else still has to compare equal to the slot's text
+    constexpr size_t keyword_hash(std::string_view word) {
+        return (static_cast<unsigned char>(word.front()) + static_cast<unsigned char>(word.back()) + word.size() * 2) & (KEYWORD_SLOTS - 1);
     }
-    
-    inline std::vector<token_t> tokenize(const std::string& str) {
-        init_kw_def();
 
-        std::vector<token_t> tokens;
-        std::string buf;
-        position_t pos;
-        
-        for (int i = 0; i < str.length(); i++) {
-            pos.col++;
-            char c = str.at(i);
-
-            if (c == '\n') {pos.ln++; pos.col = 1;}
-            if (std::isspace(c)) {
-                continue;
-            }
+    constexpr std::array<keyword_t, KEYWORD_SLOTS> build_keyword_table() {
+        std::array<keyword_t, KEYWORD_SLOTS> table {};
+        for (const keyword_t& kw : KEYWORD_LIST) table[keyword_hash(kw.text)] = kw;
+        return table;
+    }
 
-            if (std::isalpha(c)) {
-                buf.push_back(c); i++; pos.col++;
-                while (std::isalnum(str.at(i))) {
-                    c = str.at(i);
-                    if (c == '\n') {pos.ln++; pos.col = 1;}
-                    buf.push_back(c); i++; pos.col++;
-                }; i--; pos.col--;
-
-                if (KEYWORDS.find(buf) != KEYWORDS.end()) {
-                    tokens.push_back(token(KEYWORDS[buf], buf, pos));
-                    buf.clear(); continue;
-                } else {
-                    tokens.push_back(token(token_type::identifier, buf, pos));
-                    buf.clear(); continue;
-                }
-            }
+    constexpr std::array<keyword_t, KEYWORD_SLOTS> KEYWORDS = build_keyword_table();
 
-            if (std::isdigit(c)) {
-                buf.push_back(c); i++; pos.col++;
-                while (std::isdigit(str.at(i))) {
-                    c = str.at(i);
-                    if (c == '\n') {pos.ln++; pos.col = 1;}
-                    buf.push_back(c); i++; pos.col++;
-                }; i--; pos.col--;
+    constexpr bool keywords_hash_perfectly() {
+        for (const keyword_t& kw : KEYWORD_LIST) {
+            if (KEYWORDS[keyword_hash(kw.text)].text != kw.text) return false;
+        }
+        return true;
+    }
 
-                tokens.push_back(token(token_type::num_literal, buf, pos));
-                buf.clear(); continue;
-            }
+    static_assert(keywords_hash_perfectly(), "keyword_hash has a collision, pick new constants");
 
-            if (c == '"') {
-                pos.col++; i++;
-                while (str.at(i) != '"') {
-                    c = str.at(i);
-                    if (c == '\n') {pos.ln++; pos.col = 1;}
-                    buf.push_back(c); i++; pos.col++;
-                };
-
-                tokens.push_back(token(token_type::str_literal, buf, pos));
-                buf.clear(); continue;
-            }
+    constexpr bool find_keyword(std::string_view word, token_type_t& type) {
+        const keyword_t& slot = KEYWORDS[keyword_hash(word)];
+        if (slot.text != word) return false;
+        type = slot.type;
+        return true;
+    }
 
-            if (c == ';') {
-                tokens.push_back(token(token_type::semi, ";", pos)); continue;
-            }
+    // most identifiers are names used a few lines up, so a small direct
+    // mapped cache of the last ones seen sits in front of the symbol table.
+    // a hit costs a hash of a few bytes and a compare against text that is
+    // still in cache, instead of a probe into a table of every name
+    constexpr size_t RECENT_SLOTS = 512;
 
-            if (c == '=') {
-                if (str.at(i + 1) == '>') {
-                    i++; pos.col++;
-                    tokens.push_back(token(token_type::f_assign, "=>", pos)); continue;
-                }
+    typedef struct recent_ident {
+        std::string_view word;
+        atom_t atom = 0;
+    } recent_ident_t;
 
-                if (str.at(i + 1) == '=') {
-                    i++; pos.col++;
-                    tokens.push_back(token(token_type::binaryop, "==", pos)); continue;
-                }
+    inline atom_t intern_recent(std::array<recent_ident_t, RECENT_SLOTS>& recent, std::string_view word) {
+        uint32_t h = 2166136261u;
+        for (char c : word) h = (h ^ static_cast<uint8_t>(c)) * 16777619u;
 
-                tokens.push_back(token(token_type::equals, "=", pos)); continue;
-            }
+        recent_ident_t& slot = recent[h & (RECENT_SLOTS - 1)];
+        if (slot.atom != 0 && slot.word == word) return slot.atom;
 
-            if (c == '#') {
-                while (c != '\n') { i++; pos.col++; c = str.at(i); }
-                continue; 
-            }
+        slot.word = word;
+        slot.atom = symbols().intern(word);
+        return slot.atom;
+    }
 
-            if (c == '+' || c == '-' || c == '*' || c == '/') {
-                tokens.push_back(token(token_type::binaryop, std::string(1, c), pos)); continue;
-            }
+    // turns a byte offset into the line:col the rest of the interpreter
+    // uses. a token's position points just past its last character, which
+    // is where error messages put the caret
+    inline position_t locate(const std::vector<uint32_t>& lines, size_t offset) {
+        size_t ln = std::upper_bound(lines.begin(), lines.end(), offset) - lines.begin();
+        return position(ln, offset - lines[ln - 1] + 2);
+    }
 
-            if (c == '>') {
-                if (str.at(i + 1) == '=') {
-                    i++; pos.col++;
-                    tokens.push_back(token(token_type::binaryop, ">=", pos)); continue;
-                }
+    // tokens are offsets into str, the parser reads their text from it. the
+    // only heap allocations are the token vector and first sightings of
+    // identifiers.
+    // runs of whitespace, identifiers, digits, comments and strings are
+    // skipped by the scanner, positions are only worked out on demand
+    inline std::vector<token_t> tokenize(const std::string& str) {
+        const scan::scanner_t& sc = scan::best();
+        const char* src = str.data();
+        size_t len = str.length();
 
-                tokens.push_back(token(token_type::binaryop, std::string(1, c), pos)); continue;
-            }
+        std::vector<token_t> tokens;
+        tokens.reserve(len / 2 + 1);
+        std::array<recent_ident_t, RECENT_SLOTS> recent;
 
-            if (c == '<') {
-                if (str.at(i + 1) == '=') {
-                    i++; pos.col++;
-                    tokens.push_back(token(token_type::binaryop, "<=", pos)); continue;
-                }
+        auto text = [&](size_t from, size_t n) {
+            return std::string_view(src + from, n);
+        };
 
-                tokens.push_back(token(token_type::binaryop, std::string(1, c), pos)); continue;
-            }
+        auto fail = [&](const char* what, size_t at) {
+            error(what, locate(scan::index_lines(src, len), at), str).spit();
+        };
 
-            if (c == '(') {
-                tokens.push_back(token(token_type::lparen, "(", pos)); continue;
-            }
+        size_t i = 0;
+        for (;;) {
+            i = scan::skip(sc.skip_space, scan::SPACE, src, i, len);
+            if (i >= len) break;
 
-            if (c == ')') {
-                tokens.push_back(token(token_type::rparen, ")", pos)); continue;
-            }
+            char c = src[i];
+            char next = i + 1 < len ? src[i + 1] : '\0';
 
-            if (c == '{') {
-                tokens.push_back(token(token_type::lcbrace, "{", pos)); continue;
-            }
+            if (scan::is_alpha(c)) {
+                size_t end = scan::skip(sc.skip_ident, scan::ALPHA | scan::DIGIT, src, i + 1, len);
+                std::string_view word = text(i, end - i);
 
-            if (c == '}') {
-                tokens.push_back(token(token_type::rcbrace, "}", pos)); continue;
-            }
+                token_type_t type;
+                if (find_keyword(word, type)) {
+                    tokens.emplace_back(type, i, end - i);
+                } else {
+                    tokens.emplace_back(token_type::identifier, i, end - i, intern_recent(recent, word));
+                }
 
-            if (c == '[') {
-                tokens.push_back(token(token_type::lbrace, "[", pos)); continue;
+                i = end;
+                continue;
             }
 
-            if (c == ']') {
-                tokens.push_back(token(token_type::rbrace, "]", pos)); continue;
-            }
+            // ints, 0x hex ints and decimals with an optional exponent. the
+            // parser makes sure what was taken is a well formed number
+            if (scan::is_digit(c)) {
+                size_t end;
+                if (c == '0' && i + 2 < len && (src[i + 1] == 'x' || src[i + 1] == 'X') && scan::is_alnum(src[i + 2])) {
+                    end = scan::skip(sc.skip_ident, scan::ALPHA | scan::DIGIT, src, i + 2, len);
+                } else {
+                    end = scan::skip(sc.skip_digits, scan::DIGIT, src, i + 1, len);
+                    if (end + 1 < len && src[end] == '.' && scan::is_digit(src[end + 1])) end = scan::skip(sc.skip_digits, scan::DIGIT, src, end + 1, len);
+
+                    if (end < len && (src[end] == 'e' || src[end] == 'E')) {
+                        size_t at = end + 1;
+                        if (at < len && (src[at] == '+' || src[at] == '-')) at++;
+                        if (at < len && scan::is_digit(src[at])) end = scan::skip(sc.skip_digits, scan::DIGIT, src, at, len);
+                    }
+                }
 
-            if (c == ',') {
-                tokens.push_back(token(token_type::comma, ",", pos)); continue;
+                tokens.emplace_back(token_type::num_literal, i, end - i);
+                i = end;
+                continue;
             }
 
-            if (c == ':') {
-                tokens.push_back(token(token_type::colon, ":", pos)); continue;
+            if (c == '"') {
+                size_t end = sc.find_quote(src, i + 1, len);
+                if (end >= len) fail("unterminated string", i);
+
+                tokens.emplace_back(token_type::str_literal, i + 1, end - i - 1);
+                i = end + 1;
+                continue;
             }
 
-            if (c == '.') {
-                tokens.push_back(token(token_type::dot, ":", pos)); continue;
+            if (c == '#') {
+                i = sc.find_newline(src, i + 1, len);
+                continue;
             }
 
-            error("unexpected character", pos, str).spit();
+            token_type_t type;
+            size_t n = 1;
+
+            switch (c) {
+                case ';': type = token_type::semi; break;
+                case '(': type = token_type::lparen; break;
+                case ')': type = token_type::rparen; break;
+                case '{': type = token_type::lcbrace; break;
+                case '}': type = token_type::rcbrace; break;
+                case '[': type = token_type::lbrace; break;
+                case ']': type = token_type::rbrace; break;
+                case ',': type = token_type::comma; break;
+                case ':': type = token_type::colon; break;
+                case '.': type = token_type::dot; break;
+
+                case '+':
+                case '-':
+                case '*':
+                case '/':
+                    type = token_type::binaryop;
+                    break;
+
+                case '=':
+                    if (next == '>') { type = token_type::f_assign; n = 2; }
+                    else if (next == '=') { type = token_type::binaryop; n = 2; }
+                    else type = token_type::equals;
+                    break;
+
+                case '>':
+                case '<':
+                    type = token_type::binaryop;
+                    if (next == '=') n = 2;
+                    break;
+
+                default:
+                    fail("unexpected character", i);
+            }
+
+            tokens.emplace_back(type, i, n);
+            i += n;
         }
 
-        tokens.push_back(token(token_type::eof, "\0", pos));
+        tokens.emplace_back(token_type::eof, len, 0);
 
         return tokens;
     }
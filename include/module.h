@@ -0,0 +1,73 @@
+#ifndef MODULE_H_
+#define MODULE_H_
+
+#include "du_native.h"
+#include "value.h"
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct interpreter;
+
+// a function a native extension defined, what its natives point at
+typedef struct foreign {
+    du_native_fn fn;
+    std::string name;
+} foreign_t;
+
+// script modules have an interpreter, native extensions a dlopen handle
+typedef struct module {
+    std::string path;
+    interpreter* inter;
+    // what the module's top level returned, handed to every import of it
+    rt_value value;
+    bool loaded;
+    // wall time to parse and run it, imports it made included
+    double load_ms;
+    void* handle = nullptr;
+    std::deque<foreign_t> foreigns;
+} module_t;
+
+// the modules a program has loaded, keyed by canonical path. each one is
+// parsed and run once, later imports of the same file get the value it
+// returned the first time. loading is the chain of imports currently
+// running, an import of anything on it is a cycle
+typedef struct module_registry {
+    std::unordered_map<std::string, module_t*> modules;
+    std::vector<module_t*> order;
+    std::vector<module_t*> loading;
+
+    module_registry() {};
+
+    module_registry(const module_registry&) = delete;
+    module_registry& operator=(const module_registry&) = delete;
+
+    ~module_registry();
+
+    module_t* find(const std::string& path) {
+        auto it = modules.find(path);
+        return it != modules.end() ? it->second : nullptr;
+    }
+
+    module_t* add(const std::string& path) {
+        module_t* mod = new module_t{path, nullptr, rt_value(), false, 0, nullptr, {}};
+        modules[path] = mod;
+        order.push_back(mod);
+        return mod;
+    }
+
+    // "a.du -> b.du -> a.du" for an import of mod while it is loading
+    std::string cycle(module_t* mod);
+    void dump();
+} module_registry_t;
+
+std::string canonical_path(const std::string& path);
+
+// libraries are imported as native extensions, anything else as a script
+bool is_extension(const std::string& path);
+// opens the library at path and runs its du_module_init, mod->value is
+// then the module object. returns what went wrong, empty on success
+std::string load_extension(module_t* mod, const std::string& path);
+
+#endif // MODULE_H_
@@ -0,0 +1,43 @@
+#ifndef NATIVE_STACK_H_
+#define NATIVE_STACK_H_
+
+#include <cstddef>
+
+// the tree walker recurses on the native stack, a handful of frames per
+// script call. instead of running off the end of the thread's stack, a call
+// made when the current stack is nearly used up runs on a fresh segment
+// taken from the heap, so how deep scripts recurse is bounded by
+// max_call_depth() and memory rather than by the thread's stack size
+namespace native_stack {
+    constexpr size_t SEGMENT_SIZE = 1 << 20;
+    // what has to be left on the current stack for a call to stay on it
+    constexpr size_t RESERVE = 128 << 10;
+
+    bool low();
+    // runs fn(arg) on a new segment, errors thrown by it come out here
+    void run(void (*fn)(void*), void* arg);
+
+    template<typename F>
+    void call(F& body) {
+        run([](void* at) { (*static_cast<F*>(at))(); }, &body);
+    }
+
+    // a segment fn(arg) runs on that can be left half way through with
+    // yield and carried on with the next resume. script tasks run on these,
+    // since a call the tree walker is in the middle of lives on the native
+    // stack
+    typedef struct segment fiber_t;
+
+    fiber_t* start(void (*fn)(void*), void* arg);
+    // runs f until it yields or returns, true once it has returned. errors
+    // thrown by it come out here
+    bool resume(fiber_t* f);
+    // back to whatever resumed the fiber this thread is in
+    void yield();
+    // the fiber this thread is in, nullptr outside of them
+    fiber_t* current();
+    // f has returned, its segment goes back for reuse
+    void finish(fiber_t* f);
+}
+
+#endif // NATIVE_STACK_H_
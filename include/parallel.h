@@ -0,0 +1,318 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include "env.h"
+#include "gc.h"
+#include "interpreter.h"
+#include "isolate.h"
+#include "iter.h"
+#include "pool.h"
+#include "runtime.h"
+#include "types.h"
+#include <algorithm>
+#include <exception>
+#include <unordered_set>
+#include <vector>
+
+// a parallel builtin splits an array into this many chunks when it isn't
+// given a grain. it doesn't depend on the thread count, so where chunks
+// start and end, and with that what parallel_reduce adds up in which
+// order, is the same on every machine
+constexpr size_t PARALLEL_CHUNKS = 256;
+
+// how a callback may be run by the parallel builtins, worst last
+typedef enum struct parallel_mode : uint8_t {
+    pure,
+    // changes arrays it was passed, fine as long as no two calls get the
+    // same one
+    own_args,
+    // might write to something shared, runs in order on the calling thread
+    serial,
+} parallel_mode_t;
+
+// works out from a callback's tree whether calls to it can run at the same
+// time. assignments only ever write the function's own frame, so what
+// matters is what it calls: each callee is looked up where the resolver
+// put it, and has to be a pure native or a script function that is pure
+// itself. callees held in the function's own locals or parameters can't be
+// known up front and make it serial, as do imports. a callback that changes
+// its arguments also mustn't read arrays or objects from outside, they
+// could hold what another call is changing
+typedef struct purity {
+    std::vector<rt_function*> seen;
+    bool reads_shared = false;
+
+    parallel_mode_t of(rt_value func) {
+        if (func.type() == dtype::cfunction) return func.cfn()->effect == native_effect::pure ? parallel_mode::pure : parallel_mode::serial;
+        if (func.type() != dtype::func || func.fn()->proto == nullptr) return parallel_mode::serial;
+
+        parallel_mode_t mode = function(func.fn(), true);
+        return mode == parallel_mode::own_args && reads_shared ? parallel_mode::serial : mode;
+    }
+
+    // only the callback itself may change its arguments, whatever it calls
+    // has to be pure
+    parallel_mode_t function(rt_function* fn, bool top) {
+        if (std::find(seen.begin(), seen.end(), fn) != seen.end()) return parallel_mode::pure;
+        seen.push_back(fn);
+
+        std::vector<int> assigned;
+        if (top) written(fn->body, assigned);
+        return walk(fn->body, fn, top, assigned);
+    }
+
+    void written(ast_node* node, std::vector<int>& slots) {
+        if (node == nullptr || node->type == ast_type::ast_function) return;
+        if (node->type == ast_type::ast_assign) slots.push_back(node->slot);
+
+        written(node->value, slots);
+        written(node->svalue, slots);
+        for (ast_node* child : node->children) written(child, slots);
+    }
+
+    // what a name the function reads from an enclosing frame holds now
+    bool resolve(rt_function* fn, ast_node* name, rt_value& out) {
+        if (name->depth == 0 || fn->closure == nullptr) return false;
+        out = fn->closure->at(name->depth - 1, name->slot);
+        return true;
+    }
+
+    parallel_mode_t walk(ast_node* node, rt_function* fn, bool top, std::vector<int>& assigned) {
+        if (node == nullptr) return parallel_mode::pure;
+
+        switch (node->type) {
+            // making a closure runs nothing, calling one held in a local
+            // is serial anyway
+            case ast_type::ast_function:
+                return parallel_mode::pure;
+
+            case ast_type::ast_import:
+                return parallel_mode::serial;
+
+            case ast_type::ast_call: {
+                rt_value callee;
+                if (!resolve(fn, node, callee)) return parallel_mode::serial;
+                return std::max(call(callee, node->value->children, fn, top, assigned), walk_all(node->value->children, fn, top, assigned));
+            }
+
+            case ast_type::ast_member: {
+                ast_node* link = node->value;
+                while (link->type == ast_type::ast_member) link = link->value;
+                bool calls = link->type == ast_type::ast_call;
+
+                // members of the function's own objects are just read
+                rt_value obj;
+                if (!resolve(fn, node, obj)) return calls ? parallel_mode::serial : parallel_mode::pure;
+
+                link = node->value;
+                for (;;) {
+                    if (obj.type() != dtype::object) return parallel_mode::serial;
+                    rt_value* member = obj.object()->get(link->symbol);
+                    obj = member != nullptr ? *member : rt_value();
+
+                    if (link->type != ast_type::ast_member) break;
+                    link = link->value;
+                }
+
+                if (!calls) {
+                    shared_read(obj);
+                    return parallel_mode::pure;
+                }
+
+                return std::max(call(obj, link->value->children, fn, top, assigned), walk_all(link->value->children, fn, top, assigned));
+            }
+
+            case ast_type::ast_identifier:
+            case ast_type::ast_arrindex: {
+                rt_value val;
+                if (resolve(fn, node, val)) shared_read(val);
+                return walk(node->value, fn, top, assigned);
+            }
+
+            default: {
+                parallel_mode_t mode = std::max(walk(node->value, fn, top, assigned), walk(node->svalue, fn, top, assigned));
+                return std::max(mode, walk_all(node->children, fn, top, assigned));
+            }
+        }
+    }
+
+    void shared_read(rt_value val) {
+        if (val.is_obj() && val.type() != dtype::func && val.type() != dtype::cfunction && val.type() != dtype::string) reads_shared = true;
+    }
+
+    parallel_mode_t walk_all(node_list_t& nodes, rt_function* fn, bool top, std::vector<int>& assigned) {
+        parallel_mode_t mode = parallel_mode::pure;
+        for (ast_node* child : nodes) mode = std::max(mode, walk(child, fn, top, assigned));
+        return mode;
+    }
+
+    parallel_mode_t call(rt_value callee, node_list_t& args, rt_function* fn, bool top, std::vector<int>& assigned) {
+        if (callee.type() == dtype::func) {
+            if (callee.fn()->proto == nullptr) return parallel_mode::serial;
+            return function(callee.fn(), false) == parallel_mode::pure ? parallel_mode::pure : parallel_mode::serial;
+        }
+
+        if (callee.type() != dtype::cfunction) return parallel_mode::serial;
+
+        switch (callee.cfn()->effect) {
+            case native_effect::pure:
+                return parallel_mode::pure;
+
+            // the first argument has to be one of the callback's own
+            // parameters, never assigned something else
+            case native_effect::own_first: {
+                if (!top || args.empty()) return parallel_mode::serial;
+
+                ast_node* arg = args[0];
+                bool param = arg->type == ast_type::ast_identifier && arg->depth == 0 && arg->slot >= 0 && static_cast<size_t>(arg->slot) < fn->proto->children.size();
+                if (!param || std::find(assigned.begin(), assigned.end(), arg->slot) != assigned.end()) return parallel_mode::serial;
+                return parallel_mode::own_args;
+            }
+
+            default:
+                return parallel_mode::serial;
+        }
+    }
+} purity_t;
+
+// own_args callbacks only run in parallel over arrays whose elements are
+// all different objects, and none of them the array itself
+inline bool distinct_elements(rt_array* arr) {
+    std::unordered_set<rt_heap*> seen = {arr};
+    for (rt_value val : arr->arr) {
+        if (val.is_obj() && !seen.insert(val.obj()).second) return false;
+    }
+
+    return true;
+}
+
+// runs body(helper, begin, end) over [0, n) in chunks of grain on the
+// pool. every thread enters the calling isolate, calls through a helper
+// interpreter of its own and allocates into a local heap of its own,
+// nothing is collected until the heap takes them all over at the end. an
+// error in any chunk comes out here once the others have stopped
+template<typename F>
+inline void run_parallel(interpreter* inter, size_t n, size_t grain, F body)
+{
+    isolate_t* owner = current_isolate;
+    work_pool_t& pool = worker_pool();
+    while (inter->helpers.size() < pool.size()) {
+        interpreter* helper = new interpreter(inter);
+        helper->shared = true;
+        inter->helpers.push_back(helper);
+    }
+
+    std::vector<local_heap_t> heaps(pool.size());
+    work_pool_t::job_t job = [&](size_t worker, size_t begin, size_t end) {
+        isolate_t::scope_t entered(owner);
+        running_t self(inter->helpers[worker]);
+        local_scope_t local(&heaps[worker]);
+        body(inter->helpers[worker], begin, end);
+    };
+
+    std::exception_ptr failure;
+    try {
+        pool.run(n, grain, job);
+    } catch (...) {
+        failure = std::current_exception();
+    }
+
+    for (local_heap_t& heap : heaps) gc_heap().adopt(heap);
+    if (failure) std::rethrow_exception(failure);
+}
+
+// checks the array, the callback and the optional grain after the fixed
+// arguments, returns the grain
+inline size_t parallel_grain(args_t args, size_t fixed, const char* who) {
+    if (args.size() != fixed && args.size() != fixed + 1) error_util::spit(string_format("%s expected %zu or %zu args, got %zu", who, fixed, fixed + 1, args.size()));
+    if (args[0].type() != dtype::array) error_util::spit(string_format("%s expected type array for argument 1, got %s", who, dtype_to_str(args[0].type()).c_str()));
+    check_callable(args[1], who);
+
+    if (args.size() == fixed) return std::max<size_t>(args[0].arr().size() / PARALLEL_CHUNKS, 1);
+    if (args[fixed].type() != dtype::integer || args[fixed].integer() < 1) error_util::spit(string_format("%s expected a grain of at least 1, got %s", who, args[fixed].ts().c_str()));
+    return args[fixed].integer();
+}
+
+inline parallel_mode_t parallel_mode_of(rt_value func, rt_array* arr) {
+    parallel_mode_t mode = purity().of(func);
+    if (mode == parallel_mode::own_args && !distinct_elements(arr)) return parallel_mode::serial;
+    return mode;
+}
+
+// array.parallel_map(a, f[, grain]), results come back in a's order
+inline rt_value parallel_map(args_t args, void* env, void*) {
+    size_t grain = parallel_grain(args, 2, "array.parallel_map");
+    environment_t* caller = static_cast<environment_t*>(env);
+    interpreter_t* inter = running_interpreter;
+    rt_array* arr = static_cast<rt_array*>(args[0].obj());
+    rt_value func = args[1];
+
+    if (parallel_mode_of(func, arr) == parallel_mode::serial) {
+        inter->stack.push(iter_map(args[0], func));
+        rt_value result = iter_collect(caller, inter->stack.top[-1]);
+        inter->stack.pop();
+        return result;
+    }
+
+    size_t n = arr->arr.size();
+    std::vector<rt_value> out(n);
+    run_parallel(inter, n, grain, [&](interpreter* helper, size_t begin, size_t end) {
+        callback_t call(helper, caller, func, 1, "array.parallel_map");
+        for (size_t i = begin; i < end; i++) out[i] = call(arr->arr[i]);
+    });
+
+    return make_array(std::move(out));
+}
+
+// array.parallel_foreach(a, f[, grain])
+inline rt_value parallel_foreach(args_t args, void* env, void*) {
+    size_t grain = parallel_grain(args, 2, "array.parallel_foreach");
+    environment_t* caller = static_cast<environment_t*>(env);
+    interpreter_t* inter = running_interpreter;
+    rt_array* arr = static_cast<rt_array*>(args[0].obj());
+    rt_value func = args[1];
+
+    if (parallel_mode_of(func, arr) == parallel_mode::serial) {
+        iter_foreach(caller, args[0], func);
+        return rt_value();
+    }
+
+    run_parallel(inter, arr->arr.size(), grain, [&](interpreter* helper, size_t begin, size_t end) {
+        callback_t call(helper, caller, func, 1, "array.parallel_foreach");
+        for (size_t i = begin; i < end; i++) call(arr->arr[i]);
+    });
+
+    return rt_value();
+}
+
+// array.parallel_reduce(a, f, init[, grain]). each chunk is folded on its
+// own starting from its first element, then the chunks are folded in
+// order starting from init, so f has to be associative for the result to
+// match a plain left fold. only pure callbacks run in parallel
+inline rt_value parallel_reduce(args_t args, void* env, void*) {
+    size_t grain = parallel_grain(args, 3, "array.parallel_reduce");
+    environment_t* caller = static_cast<environment_t*>(env);
+    interpreter_t* inter = running_interpreter;
+    rt_array* arr = static_cast<rt_array*>(args[0].obj());
+    rt_value func = args[1];
+
+    if (purity().of(func) != parallel_mode::pure) return iter_reduce(caller, args[0], func, args[2]);
+
+    size_t n = arr->arr.size();
+    size_t chunks = (n + grain - 1) / grain;
+    std::vector<rt_value> partial(chunks);
+    run_parallel(inter, n, grain, [&](interpreter* helper, size_t begin, size_t end) {
+        callback_t call(helper, caller, func, 2, "array.parallel_reduce");
+        rt_value acc = arr->arr[begin];
+        for (size_t i = begin + 1; i < end; i++) acc = call(acc, arr->arr[i]);
+        partial[begin / grain] = acc;
+    });
+
+    // the partial results stay rooted while the last fold runs
+    inter->stack.push(make_array(std::move(partial)));
+    rt_value result = iter_reduce(caller, inter->stack.top[-1], func, args[2]);
+    inter->stack.pop();
+    return result;
+}
+
+#endif // PARALLEL_H_
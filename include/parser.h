@@ -1,16 +1,19 @@
 #ifndef PARSER_H_
 #define PARSER_H_
 
+#include "arena.h"
 #include "ast.h"
 #include "lexer.h"
 #include "position.h"
 #include "token.h"
 #include "types.h"
 #include <algorithm>
+#include <charconv>
 #include <cstddef>
 #include <cstdio>
 #include <error.h>
 #include <string>
+#include <utility>
 #include <vector>
 #include <format>
 
@@ -25,40 +28,107 @@ inline std::string string_format( const std::string& format, Args ... args )
     return std::string( buf.get(), buf.get() + size - 1 ); // We don't want the '\0' inside
 }
 
+// the token stream is never modified once lexed, the parser walks it with a
+// cursor and hands out references into it. the tree it builds lives in its
+// arena, so it is freed in one go along with the parser
 typedef struct parser {
     std::vector<token_t> tokens;
-    token_t last;
+    size_t cursor;
+    std::vector<uint32_t> lines;
+    size_t line;
 
     std::string source;
+    arena_t nodes;
+    // children of the lists being parsed, innermost on top
+    std::vector<ast_node*> pending;
 
-    parser(std::string src) : source(src) {
+    // lexing waits for the first parse, a cached tree never needs it
+    parser(std::string src) : cursor(0), line(0), source(std::move(src)) {};
+
+    void lex() {
         tokens = lexer::tokenize(source);
-        last = tokens.front();
-    };
+        lines = scan::index_lines(source.data(), source.size());
+    }
 
-    token_t eat() {
-        token_t l = tokens.front();
-        tokens.erase(tokens.begin());
-        return l;;
+    // tokens point into source, so the parser can't be copied or moved
+    parser(const parser&) = delete;
+    parser& operator=(const parser&) = delete;
+
+    // fills in a number literal: 64-bit ints, hex ints and doubles
+    void parse_number(ast_node* node, const token_t& num) {
+        std::string_view text = this->text(num);
+        const char* end = text.data() + text.size();
+        std::from_chars_result res;
+
+        if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+            node->data_type = dtype::integer;
+            res = std::from_chars(text.data() + 2, end, node->integer, 16);
+        } else if (text.find_first_of(".eE") != std::string_view::npos) {
+            node->data_type = dtype::floating;
+            res = std::from_chars(text.data(), end, node->number);
+        } else {
+            node->data_type = dtype::integer;
+            res = std::from_chars(text.data(), end, node->integer);
+        }
+
+        if (res.ec == std::errc::result_out_of_range) error(string_format("number literal %.*s out of range", (int)text.size(), text.data()), node->pos, source).spit();
+        if (res.ec != std::errc() || res.ptr != end) error(string_format("invalid number literal %.*s", (int)text.size(), text.data()), node->pos, source).spit();
     }
 
-    token_t expect(token_type_t type) {
-        token_t next = eat();
-        if (next.type != type) error(string_format("expected %s at %d:%d, got %s", token_to_str(type).c_str(), next.pos.ln, next.pos.col, token_to_str(next.type).c_str()), next.pos, source).spit();
-        return next;
+    std::string_view text(const token_t& tok) {
+        return std::string_view(source.data() + tok.start, tok.length);
+    }
+
+    // k tokens ahead, anything past the end reads as the trailing eof
+    const token_t& peek(size_t k = 0) {
+        size_t at = cursor + k;
+        return at < tokens.size() ? tokens[at] : tokens.back();
+    }
+
+    const token_t& eat() {
+        const token_t& tok = peek();
+        if (cursor + 1 < tokens.size()) cursor++;
+        return tok;
+    }
+
+    // tokens are asked for in source order, so the line is found by walking
+    // forward from the last one instead of searching the whole index
+    position_t pos(const token_t& tok) {
+        uint32_t offset = tok.end();
+        if (offset < lines[line]) return lexer::locate(lines, offset);
+        while (line + 1 < lines.size() && lines[line + 1] <= offset) line++;
+        return position(line + 1, offset - lines[line] + 2);
     }
 
-    token_t peek() {
-        token_t l = tokens.front();
-        return l;
+    const token_t& expect(token_type_t type) {
+        const token_t& next = eat();
+        if (next.type != type) {
+            position_t at = pos(next);
+            error(string_format("expected %s at %d:%d, got %s", token_to_str(type).c_str(), at.ln, at.col, token_to_str(next.type).c_str()), at, source).spit();
+        }
+        return next;
     }
 
     bool match(token_type_t type) {
         return peek().type == type;
     }
 
+    ast_node* make(ast_type_t type, position_t at) {
+        return nodes.make<ast_node>(type, at);
+    }
+
+    // moves everything pushed onto pending since mark into the arena
+    node_list_t finish(size_t mark) {
+        node_list_t list;
+        list.count = pending.size() - mark;
+        list.items = nodes.make_array<ast_node*>(list.count);
+        std::copy(pending.begin() + mark, pending.end(), list.items);
+        pending.resize(mark);
+        return list;
+    }
+
     ast_node* parse() {
-        //return ast_node(ast_type_t::ast_noop);
+        if (tokens.empty()) lex();
         ast_node* root = parse_compound();
         root->symbol = "root";
 
@@ -66,11 +136,11 @@ typedef struct parser {
     }
 
     ast_node* parse_if() {
-        token_t start = eat();
+        const token_t& start = eat();
         ast_node* condition = parse_expr();
         ast_node* body = parse_scope();
         
-        ast_node* ifst = new ast_node(ast_type::ast_if, start.pos);
+        ast_node* ifst = make(ast_type::ast_if, pos(start));
         ifst->svalue = condition;
         ifst->value = body;
 
@@ -78,11 +148,11 @@ typedef struct parser {
     }
 
     ast_node* parse_while() {
-        token_t start = eat();
+        const token_t& start = eat();
         ast_node* condition = parse_expr();
         ast_node* body = parse_scope();
         
-        ast_node* ifst = new ast_node(ast_type::ast_while, start.pos);
+        ast_node* ifst = make(ast_type::ast_while, pos(start));
         ifst->svalue = condition;
         ifst->value = body;
 
@@ -90,21 +160,21 @@ typedef struct parser {
     }
 
     ast_node* parse_id() {
-        token_t id = eat();
+        const token_t& id = eat();
         if (match(token_type_t::equals)) {
             eat();
-            ast_node* node = new ast_node(ast_type_t::ast_assign, id.pos);
-            node->symbol = id.value;
+            ast_node* node = make(ast_type_t::ast_assign, pos(id));
+            node->symbol = text(id);
+            node->atom = id.atom;
             node->value = parse_expr();
             node->data_type = node->value->data_type;
 
             return node;
         }
 
-        ast_node* node = new ast_node(ast_type_t::ast_identifier, id.pos);
-        node->symbol = id.value;
-
-        token_t ig = peek();
+        ast_node* node = make(ast_type_t::ast_identifier, pos(id));
+        node->symbol = text(id);
+        node->atom = id.atom;
 
         if (match(token_type::dot)) {
             eat();
@@ -134,15 +204,13 @@ typedef struct parser {
 
         if (match(token_type::colon)) {
             eat();
-            token_t d_type = expect(token_type::identifier);
-            node->data_type = str_to_dtype(d_type.value);
+            const token_t& d_type = expect(token_type::identifier);
+            node->data_type = str_to_dtype(text(d_type));
 
             if (match(token_type_t::equals)) {
                 eat();
-                node = new ast_node(ast_type_t::ast_assign, id.pos);
-                node->symbol = id.value;
+                node->type = ast_type_t::ast_assign;
                 node->value = parse_expr();
-                node->data_type = str_to_dtype(d_type.value);
 
                 return node;
             }
@@ -152,9 +220,10 @@ typedef struct parser {
     }
 
     ast_node* parse_id_raw() {
-        token_t id = eat();
-        ast_node* node = new ast_node(ast_type_t::ast_identifier, id.pos);
-        node->symbol = id.value;
+        const token_t& id = eat();
+        ast_node* node = make(ast_type_t::ast_identifier, pos(id));
+        node->symbol = text(id);
+        node->atom = id.atom;
 
         return node;
     }
@@ -171,18 +240,58 @@ typedef struct parser {
         if (id->type != ast_type::ast_identifier)
             error("invalid import argument", id->pos, source).spit();
 
-        ast_node* inode = new ast_node(ast_type::ast_import, path->pos);
+        ast_node* inode = make(ast_type::ast_import, path->pos);
         inode->value = path;
         inode->svalue = id;
 
         return inode;
     }
 
+    // a call to the global the keyword tok names, keywords can't be
+    // assigned to so it's always the builtin
+    ast_node* make_keyword_call(const token_t& tok, ast_node* arg) {
+        ast_node* call = make(ast_type::ast_call, pos(tok));
+        call->symbol = text(tok);
+        call->atom = symbols().intern(text(tok));
+
+        ast_node* args = make(ast_type::ast_compound, call->pos);
+        size_t mark = pending.size();
+        pending.push_back(arg);
+        args->children = finish(mark);
+        call->value = args;
+
+        return call;
+    }
+
+    // async => (params) { body } becomes
+    // => (params) { return async(=> () { body }) }, calling it starts the
+    // body as a task and hands back the task
+    ast_node* parse_async() {
+        const token_t& start = eat();
+        if (!match(token_type::f_assign)) expect(token_type::f_assign);
+
+        ast_node* fblock = parse_fn();
+        ast_node* inner = make(ast_type::ast_function, fblock->pos);
+        inner->value = fblock->value;
+        inner->data_type = dtype::func;
+
+        ast_node* ret = make(ast_type::ast_return, pos(start));
+        ret->value = make_keyword_call(start, inner);
+
+        ast_node* body = make(ast_type::ast_compound, pos(start));
+        size_t mark = pending.size();
+        pending.push_back(ret);
+        body->children = finish(mark);
+        fblock->value = body;
+
+        return fblock;
+    }
+
     ast_node* parse_fn() {
-        token_t start = eat();
+        const token_t& start = eat();
         ast_node* proto = parse_list();
         ast_node* fbody = parse_scope();
-        ast_node* fblock = new ast_node(ast_type::ast_function, start.pos);
+        ast_node* fblock = make(ast_type::ast_function, pos(start));
         fblock->value = fbody;
         fblock->children = proto->children;
         fblock->data_type = dtype::func;
@@ -191,40 +300,42 @@ typedef struct parser {
     }
     
     ast_node* parse_binary() {
-        token_t num = eat();
-        ast_node* node = new ast_node(ast_type::ast_num_expr, num.pos);
-        node->number = std::stoi(num.value);
+        const token_t& num = eat();
+        ast_node* node = make(ast_type::ast_num_expr, pos(num));
+        parse_number(node, num);
 
         if (match(token_type::binaryop)) {
-            token_t op = eat();
-            ast_node* left = new ast_node(ast_type::ast_num_expr, num.pos);
-            left->number = std::stoi(num.value);
+            const token_t& op = eat();
+            ast_node* left = make(ast_type::ast_num_expr, pos(num));
+            parse_number(left, num);
             //print_node(left);
-            //print_tok(peek());
+            //print_tok(peek(), source);
             ast_node* right = parse_expr();
 
             //print_node(right);
 
             node->type = ast_type::ast_binop;
+            node->data_type = dtype::any;
             node->value = left;
             node->svalue = right;
-            node->symbol = op.value;
+            node->symbol = text(op);
+            node->op = binop_from(text(op));
         }
 
         return node;
     }
 
     ast_node* parse_str_binary() {
-        token_t str = eat();
-        ast_node* node = new ast_node(ast_type::ast_string_expr, str.pos);
-        node->symbol = str.value;
+        const token_t& str = eat();
+        ast_node* node = make(ast_type::ast_string_expr, pos(str));
+        node->symbol = text(str);
 
         if (match(token_type::binaryop)) {
-            token_t op = eat();
-            ast_node* left = new ast_node(ast_type::ast_string_expr, str.pos);
-            left->symbol = str.value;
+            const token_t& op = eat();
+            ast_node* left = make(ast_type::ast_string_expr, pos(str));
+            left->symbol = text(str);
             //print_node(left);
-            //print_tok(peek());
+            //print_tok(peek(), source);
             ast_node* right = parse_expr();
 
             //print_node(right);
@@ -232,7 +343,8 @@ typedef struct parser {
             node->type = ast_type::ast_binop;
             node->value = left;
             node->svalue = right;
-            node->symbol = op.value;
+            node->symbol = text(op);
+            node->op = binop_from(text(op));
         }
 
         //print_node(node);
@@ -244,12 +356,13 @@ typedef struct parser {
         ast_node* node = parse_id();
 
         if (match(token_type::binaryop)) {
-            token_t op = eat();
-            ast_node* left = new ast_node(ast_type::ast_identifier, node->pos);
+            const token_t& op = eat();
+            ast_node* left = make(ast_type::ast_identifier, node->pos);
             left->symbol = node->symbol;
+            left->atom = node->atom;
 
             //print_node(left);
-            //print_tok(peek());
+            //print_tok(peek(), source);
             ast_node* right = parse_expr();
 
             //print_node(right);
@@ -257,7 +370,8 @@ typedef struct parser {
             node->type = ast_type::ast_binop;
             node->value = left;
             node->svalue = right;
-            node->symbol = op.value;
+            node->symbol = text(op);
+            node->op = binop_from(text(op));
         }
 
         //print_node(node);
@@ -266,85 +380,97 @@ typedef struct parser {
     }
 
     ast_node* parse_scope() {
-        token_t start = expect(token_type::lcbrace);
-        ast_node* body = new ast_node(ast_type::ast_compound, start.pos);
-        ast_node* le = new ast_node(ast_type::ast_noop, start.pos);
-
-        while (peek().type != token_type::rcbrace && le->type != ast_type::ast_return) {
-            le = parse_expr();
-            body->children.push_back(le);
+        const token_t& start = expect(token_type::lcbrace);
+        ast_node* body = make(ast_type::ast_compound, pos(start));
+        size_t mark = pending.size();
+
+        // nothing after a return in the same block is parsed
+        while (peek().type != token_type::rcbrace) {
+            ast_node* stmt = parse_expr();
+            pending.push_back(stmt);
             if (match(token_type::semi)) eat();
+            if (stmt->type == ast_type::ast_return) break;
         }
 
+        body->children = finish(mark);
         expect(token_type::rcbrace);
 
         return body;
     }
 
     ast_node* parse_list() {
-        ast_node* list = new ast_node(ast_type_t::ast_compound, eat().pos);
+        ast_node* list = make(ast_type_t::ast_compound, pos(eat()));
+        size_t mark = pending.size();
 
         if (!match(token_type::rparen)) {
-            list->children.push_back(parse_expr());
+            pending.push_back(parse_expr());
             while (match(token_type::comma)) {
                 eat();
-                list->children.push_back(parse_expr());
+                pending.push_back(parse_expr());
             }
 
             expect(token_type::rparen);
         } else eat();
 
+        list->children = finish(mark);
+
         if (match(token_type::colon)) {
             eat();
-            token_t d_type = expect(token_type::identifier);
-            list->data_type = str_to_dtype(d_type.value);
+            const token_t& d_type = expect(token_type::identifier);
+            list->data_type = str_to_dtype(text(d_type));
         }
 
         return list;
     }
 
     ast_node* parse_object() {
-        ast_node* obj = new ast_node(ast_type::ast_object, eat().pos);
+        ast_node* obj = make(ast_type::ast_object, pos(eat()));
+        size_t mark = pending.size();
+
         while (!match(token_type::rcbrace)) {
-            token_t key = expect(token_type::identifier);
+            const token_t& key = expect(token_type::identifier);
             expect(token_type::colon);
 
             ast_node* value = parse_expr();
-            ast_node* entry = new ast_node(ast_type::ast_member, key.pos);
-            entry->symbol = key.value;
+            ast_node* entry = make(ast_type::ast_member, pos(key));
+            entry->symbol = text(key);
+            entry->atom = key.atom;
             entry->value = value;
 
-            obj->children.push_back(entry);
+            pending.push_back(entry);
 
             if (!match(token_type::rcbrace)) {
                 expect(token_type::comma);
             }
         }
 
+        obj->children = finish(mark);
         expect(token_type::rcbrace);
 
         return obj;
     }
 
     ast_node* parse_array() {
-        token_t start = expect(token_type::lbrace);
-        ast_node* list = new ast_node(ast_type_t::ast_array, start.pos);
+        const token_t& start = expect(token_type::lbrace);
+        ast_node* list = make(ast_type_t::ast_array, pos(start));
+        size_t mark = pending.size();
 
         // return [4, 0];
-        list->children.push_back(parse_expr());
+        pending.push_back(parse_expr());
         while (match(token_type::comma)) {
             eat();
-            list->children.push_back(parse_expr());
+            pending.push_back(parse_expr());
         }
 
+        list->children = finish(mark);
         expect(token_type::rbrace);
 
         return list;
     }
 
     ast_node* parse_expr() {
-        token_t at = peek();
-        ast_node* val = new ast_node(ast_type_t::ast_noop, at.pos);
+        const token_t& at = peek();
+        ast_node* val = nullptr;
 
         switch (at.type) {
             case token_type::identifier:
@@ -379,7 +505,7 @@ typedef struct parser {
                 break;
 
             case token_type::ret:
-                val = new ast_node(ast_type::ast_return, eat().pos);
+                val = make(ast_type::ast_return, pos(eat()));
                 val->value = parse_expr();
                 break;
 
@@ -387,6 +513,17 @@ typedef struct parser {
                 val = parse_import();
                 break;
 
+            case token_type::async_t:
+                val = parse_async();
+                break;
+
+            // await takes everything up to the end of the expression
+            case token_type::await_t: {
+                const token_t& start = eat();
+                val = make_keyword_call(start, parse_expr());
+                break;
+            }
+
             case token_type::if_t:
                 val = parse_if();
                 break;
@@ -395,20 +532,26 @@ typedef struct parser {
                 val = parse_while();
                 break;
 
-            default: error(string_format("unexpected %s at %d:%d", token_to_str(at.type).c_str(), at.pos.ln, at.pos.col), at.pos, source).spit();
+            default: {
+                position_t where = pos(at);
+                error(string_format("unexpected %s at %d:%d", token_to_str(at.type).c_str(), where.ln, where.col), where, source).spit();
+            }
         }
 
         return val;
     }
 
     ast_node* parse_compound() {
-        ast_node* compound = new ast_node(ast_type_t::ast_compound, peek().pos);
+        ast_node* compound = make(ast_type_t::ast_compound, pos(peek()));
+        size_t mark = pending.size();
 
         while (!match(token_type_t::eof)) {
-            compound->children.push_back(parse_expr());
+            pending.push_back(parse_expr());
             if (match(token_type::semi)) eat();
         }
 
+        compound->children = finish(mark);
+
         return compound;
     }
 } parser_t;
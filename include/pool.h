@@ -0,0 +1,70 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// how many threads the parallel builtins spread work over, the calling one
+// included, set with --threads
+inline size_t& pool_threads() {
+    static size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    return threads;
+}
+
+// fixed set of threads for the parallel builtins. a job over [0, n) is cut
+// into chunks of grain indices and dealt out up front, a contiguous run of
+// chunks to each thread's deque. a thread works through its own deque from
+// the front, and once that's empty steals from the back of the others', so
+// threads that got cheap chunks take over from ones that got slow ones.
+// isolates on different threads share the pool and take turns with it
+typedef struct work_pool {
+    // worker is the index of the thread running it, 0 for the caller
+    typedef std::function<void(size_t worker, size_t begin, size_t end)> job_t;
+
+    typedef struct lane {
+        std::mutex lock;
+        std::deque<std::pair<size_t, size_t>> chunks;
+    } lane_t;
+
+    std::vector<std::unique_ptr<lane_t>> lanes;
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    // held for the whole of a job
+    std::mutex taken;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const job_t* job;
+    uint64_t generation;
+    // pool threads still inside the current job
+    size_t busy;
+    // the first error a chunk threw, the chunks that hadn't started are
+    // dropped and run throws it once every thread is out
+    std::exception_ptr failure;
+
+    work_pool(size_t count);
+
+    size_t size() const { return lanes.size(); }
+
+    // returns once every chunk has run, one job at a time
+    void run(size_t n, size_t grain, const job_t& fn);
+    void loop(size_t self);
+    void work(size_t self);
+    bool next(size_t self, std::pair<size_t, size_t>& chunk);
+    void fail(std::exception_ptr error);
+} work_pool_t;
+
+// made on first use with pool_threads() threads and never torn down, its
+// threads sleep while no job runs
+work_pool_t& worker_pool();
+
+#endif // POOL_H_
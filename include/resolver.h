@@ -0,0 +1,41 @@
+#ifndef RESOLVER_H_
+#define RESOLVER_H_
+
+#include "ast.h"
+#include "env.h"
+#include "symbol.h"
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+typedef struct scope {
+    ast_node* function;
+    std::map<atom_t, int> names;
+
+    scope(ast_node* function) : function(function) {};
+} scope_t;
+
+// binds every name in the tree to a (depth, slot) pair ahead of execution.
+// names become local to a function at their first assignment, reads see
+// the innermost binding declared before them and fall back to the global
+// frame, where slots are handed out by name
+typedef struct resolver {
+    std::string_view source;
+    environment_t* globals;
+    std::vector<scope_t> scopes;
+
+    resolver(std::string_view source, environment_t* globals) : source(source), globals(globals) {};
+
+    void resolve(ast_node* root);
+    void resolve_node(ast_node* node);
+    void resolve_body(ast_node* body);
+    void resolve_read(ast_node* node);
+    void resolve_member(ast_node* node);
+    void resolve_function(ast_node* node);
+    void declare(ast_node* node);
+    void cache(ast_node* link);
+    void layout(ast_node* node);
+} resolver_t;
+
+#endif // RESOLVER_H_
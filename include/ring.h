@@ -0,0 +1,92 @@
+#ifndef RING_H_
+#define RING_H_
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// growable ring buffer, what arrays keep their elements in. pushing and
+// popping at either end is amortized O(1), so arrays work as queues, and
+// indexing is an add and a mask. removing from the middle moves whichever
+// side of the element is shorter. the buffer's size is zero or a power of
+// two, slots outside [head, head + count) are stale
+template<typename T>
+struct ring {
+    std::vector<T> buf;
+    size_t head;
+    size_t count;
+
+    ring() : head(0), count(0) {};
+
+    ring(std::vector<T> items) : buf(std::move(items)), head(0), count(buf.size()) {
+        size_t cap = 8;
+        while (cap < count) cap *= 2;
+        buf.resize(cap);
+    };
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t capacity() const { return buf.size(); }
+
+    T& operator[](size_t i) { return buf[(head + i) & (buf.size() - 1)]; }
+    T& front() { return (*this)[0]; }
+    T& back() { return (*this)[count - 1]; }
+
+    void push_back(T val) {
+        if (count == buf.size()) grow();
+        buf[(head + count) & (buf.size() - 1)] = val;
+        count++;
+    }
+
+    void push_front(T val) {
+        if (count == buf.size()) grow();
+        head = (head - 1) & (buf.size() - 1);
+        buf[head] = val;
+        count++;
+    }
+
+    // both only on a non-empty ring
+    T pop_front() {
+        T val = front();
+        head = (head + 1) & (buf.size() - 1);
+        count--;
+        return val;
+    }
+
+    T pop_back() {
+        T val = back();
+        count--;
+        return val;
+    }
+
+    void erase(size_t at) {
+        if (at < count / 2) {
+            for (size_t i = at; i > 0; i--) (*this)[i] = (*this)[i - 1];
+            pop_front();
+        } else {
+            for (size_t i = at; i + 1 < count; i++) (*this)[i] = (*this)[i + 1];
+            pop_back();
+        }
+    }
+
+    void grow() {
+        std::vector<T> next(buf.empty() ? 8 : buf.size() * 2);
+        for (size_t i = 0; i < count; i++) next[i] = (*this)[i];
+        buf = std::move(next);
+        head = 0;
+    }
+
+    struct iterator {
+        ring* r;
+        size_t i;
+
+        T& operator*() const { return (*r)[i]; }
+        iterator& operator++() { i++; return *this; }
+        bool operator!=(const iterator& other) const { return i != other.i; }
+    };
+
+    iterator begin() { return iterator{this, 0}; }
+    iterator end() { return iterator{this, count}; }
+};
+
+#endif // RING_H_
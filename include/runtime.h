@@ -2,206 +2,720 @@
 #define __RUNTIME_H__
 
 #include "ast.h"
+#include "bytecode.h"
+#include "gc.h"
 // #include "env.h"
 #include "parser.h"
 #include "position.h"
+#include "shape.h"
 #include "types.h"
+#include "value.h"
+#include <algorithm>
+#include <charconv>
+#include <coroutine>
+#include <cstdint>
 #include <cstdio>
-#include <functional>
+#include <initializer_list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <string>
+#include <utility>
 #include <vector>
 
-#define CFUNC_PROTO new ast_node(true)
+struct environment;
 
-typedef struct rt_value {
-    std::string str;
-    float num;
-    ast_node* body;
-    std::map<std::string, rt_value*> children;
-    std::vector<rt_value*> arr;
-    ast_node* proto;
-    std::function<rt_value*(std::vector<rt_value*>, void*)> cfunc;
-    bool boolean;
+// arguments are a view of the caller's value stack, where they stay rooted
+// for the whole call. natives must not keep the span past returning. data
+// is whatever the native was made with, one function can back many natives
+typedef std::span<rt_value> args_t;
+typedef rt_value (*cfunc_t)(args_t args, void* env, void* data);
 
-    dtype_t type;
+// ints too wide for the value's payload
+typedef struct rt_int : rt_heap {
+    int64_t value;
 
-    rt_value(float num) : num(num), type(dtype::integer) {};
-    rt_value(std::string str) : str(str), type(dtype::string) {};
-    rt_value(ast_node* body, ast_node* proto) : body(body), proto(proto), num(69), str("function"), type(dtype::func) {};
-    rt_value(std::map<std::string, rt_value*> children) : children(children), type(dtype::object) {};
-    rt_value(std::vector<rt_value*> arr) : arr(arr), type(dtype::array) {};
-    rt_value(std::function<rt_value*(std::vector<rt_value*>, void*)> cf) : cfunc(cf), proto(CFUNC_PROTO), type(dtype::cfunction) {};
-    rt_value(bool b) : boolean(b), type(dtype::boolean) {};
-    rt_value() : type(dtype::nil) {};
+    rt_int(int64_t value) : rt_heap(dtype::integer), value(value) {};
+} rt_int_t;
 
-    std::string ts() {
-        switch (type) {
-            case dtype::integer:
-                return std::to_string(this->num);
-
-            case dtype::string:
-                return "\"" + this->str + "\"";
+// a string is either flat or a rope, the concatenation of left and right
+// kept as two pointers until something reads the text. the first read
+// flattens it into str and lets go of the pieces, so building a string one
+// piece at a time is linear however many reads happen at the end
+typedef struct rt_string : rt_heap {
+    std::string str;
+    rt_string* left;
+    rt_string* right;
+    size_t length;
 
-            case dtype::nil:
-                return "nil";
+    rt_string(std::string str) : rt_heap(dtype::string), str(std::move(str)), left(nullptr), right(nullptr), length(this->str.size()) {};
+    rt_string(rt_string* left, rt_string* right) : rt_heap(dtype::string), left(left), right(right), length(left->length + right->length) {};
 
-            case dtype::array: {
-                std::string fin = "[ ";
+    // parallel callbacks can read the same rope at once. whoever gets the
+    // lock first flattens it, left is cleared only once str is complete
+    bool flat() const { return __atomic_load_n(&left, __ATOMIC_ACQUIRE) == nullptr; }
 
-                for (rt_value* item : arr) {
-                    fin += item->ts();
-                }
+    std::string& text() {
+        if (!flat()) flatten();
+        return str;
+    }
 
-                return fin + " ]";
+    // walks the pieces with an explicit stack, a string built by appending
+    // in a loop is a rope as deep as the loop ran
+    void flatten() {
+        static std::mutex lock;
+        std::lock_guard<std::mutex> hold(lock);
+        if (flat()) return;
+
+        std::string fin;
+        fin.reserve(length);
+
+        std::vector<rt_string*> pending = {right, left};
+        while (!pending.empty()) {
+            rt_string* piece = pending.back();
+            pending.pop_back();
+
+            if (piece->flat()) {
+                fin += piece->str;
+            } else {
+                pending.push_back(piece->right);
+                pending.push_back(piece->left);
             }
+        }
 
-            case dtype::object: {
-                std::string fin = "{\n";
-                auto it = children.begin();
+        str = std::move(fin);
+        __atomic_store_n(&right, nullptr, __ATOMIC_RELAXED);
+        __atomic_store_n(&left, nullptr, __ATOMIC_RELEASE);
+        gc_heap().grew(this);
+    }
+} rt_string_t;
+
+typedef struct rt_array : rt_heap {
+    ring<rt_value> arr;
+
+    rt_array(std::vector<rt_value> arr) : rt_heap(dtype::array), arr(std::move(arr)) {};
+} rt_array_t;
+
+// packed arrays hold their elements unboxed and back to back, for the
+// numeric kernels to run over
+typedef struct rt_i64array : rt_heap {
+    std::vector<int64_t> data;
+
+    rt_i64array(std::vector<int64_t> data) : rt_heap(dtype::i64array), data(std::move(data)) {};
+} rt_i64array_t;
+
+typedef struct rt_f64array : rt_heap {
+    std::vector<double> data;
+
+    rt_f64array(std::vector<double> data) : rt_heap(dtype::f64array), data(std::move(data)) {};
+} rt_f64array_t;
+
+// one link of a lazy pipeline. a range is the start of one, map, filter
+// and take pull from the array or iter in source. nothing runs until a
+// consumer drains the whole chain in one pass (iter.h)
+typedef enum struct iter_stage : uint8_t {
+    range,
+    map,
+    filter,
+    take,
+} iter_stage_t;
+
+typedef struct rt_iter : rt_heap {
+    iter_stage_t stage;
+    rt_value source;
+    // map and filter's callback
+    rt_value func;
+    // a range runs from start up to stop, take passes on stop elements
+    int64_t start;
+    int64_t stop;
+
+    rt_iter(iter_stage_t stage, rt_value source, rt_value func, int64_t start, int64_t stop)
+    : rt_heap(dtype::iter), stage(stage), source(source), func(func), start(start), stop(stop) {};
+} rt_iter_t;
+
+struct channel;
+
+// a handle on a channel, every isolate that opened it has one of its own.
+// the channel itself lives as long as the process, see open_channel
+typedef struct rt_channel : rt_heap {
+    std::shared_ptr<channel> chan;
+
+    rt_channel(std::shared_ptr<channel> chan) : rt_heap(dtype::channel), chan(std::move(chan)) {};
+} rt_channel_t;
+
+typedef enum struct task_state : uint8_t {
+    pending,
+    done,
+    failed,
+} task_state_t;
+
+// a call running on the isolate's event loop. it settles once, with the
+// value the call returned or the report of the error that stopped it, and
+// then resumes everything that was waiting on it
+typedef struct rt_task : rt_heap {
+    task_state_t state;
+    // the function it calls, or for io.all the tasks it waits on
+    rt_value work;
+    rt_value result;
+    std::string failure;
+    // an await has seen how it ended, failures nobody saw are reported
+    // when the program ends
+    bool observed;
+    std::vector<std::coroutine_handle<>> waiters;
+
+    rt_task(rt_value work) : rt_heap(dtype::task), state(task_state::pending), work(work), observed(false) {};
+} rt_task_t;
+
+// members live in slots laid out by the object's shape
+typedef struct rt_object : rt_heap {
+    shape_t* shape;
+    std::vector<rt_value> slots;
+
+    rt_object(shape_t* shape, std::vector<rt_value> slots) : rt_heap(dtype::object), shape(shape), slots(std::move(slots)) {};
+
+    rt_value* get(atom_t key) {
+        int slot = shape->find(key);
+        return slot >= 0 ? &slots[slot] : nullptr;
+    }
 
-                while (it != children.end()) {
-                    std::string key = it->first;
-                    rt_value* value = it->second;
+    // for names only known at runtime, a name that was never interned
+    // can't be a key of any object
+    rt_value* get(std::string_view name) {
+        atom_t key = symbols().find(name);
+        return key != 0 ? get(key) : nullptr;
+    }
 
-                    fin += string_format("%s: %s,\n", key.c_str(), value->ts(1).c_str());
-                    it++;
-                }
+    // a new key moves the object on to the next shape
+    void set(atom_t key, rt_value val) {
+        gc_heap().barrier(this);
 
-                return fin + "}";
-            }
+        int slot = shape->find(key);
+        if (slot >= 0) {
+            slots[slot] = val;
+            return;
+        }
 
-            case dtype::func: {
-                std::string fin = "function (";
+        shape = shape->add(key);
+        slots.push_back(val);
+        gc_heap().grew(this);
+    }
+} rt_object_t;
 
-                for (ast_node* parg : proto->children) {
-                    fin += string_format("%s: %s", parg->symbol.c_str(), dtype_to_str(parg->data_type).c_str());
-                }
+typedef struct rt_function : rt_heap {
+    ast_node* body;
+    ast_node* proto;
+    chunk_t* chunk;
+    environment* closure;
+
+    rt_function(ast_node* body, ast_node* proto) : rt_heap(dtype::func), body(body), proto(proto), chunk(nullptr), closure(nullptr) {};
+} rt_function_t;
+
+// what a native can write to, for the parallel builtins to tell whether
+// callbacks calling it may run at the same time. anything unmarked might
+// touch shared state. pure natives only read their arguments and allocate,
+// own_first ones also change the array they get as their first argument
+typedef enum struct native_effect : uint8_t {
+    shared,
+    pure,
+    own_first,
+} native_effect_t;
+
+// a native and what it takes: arity is -1 for any number of arguments,
+// otherwise one entry of types per argument, dtype::any where anything goes.
+// both engines check calls against it before the native runs
+typedef struct rt_cfunction : rt_heap {
+    cfunc_t cfunc;
+    void* data;
+    const char* name;
+    int arity;
+    std::vector<dtype_t> types;
+    native_effect_t effect;
+
+    rt_cfunction(cfunc_t cf, const char* name, int arity, std::vector<dtype_t> types, void* data = nullptr)
+    : rt_heap(dtype::cfunction), cfunc(cf), data(data), name(name), arity(arity), types(std::move(types)), effect(native_effect::shared) {};
+
+    rt_value call(args_t args, void* env) {
+        return cfunc(args, env, data);
+    }
 
-                fin += string_format(") => %s", dtype_to_str(proto->data_type).c_str());
+    // empty when args fit the signature
+    std::string mismatch(args_t args) const {
+        if (arity < 0) return "";
+        if (args.size() != static_cast<size_t>(arity)) return string_format("%s expected %d args, got %zu", name, arity, args.size());
 
-                return fin;
+        for (size_t i = 0; i < args.size(); i++) {
+            dtype_t t = types[i];
+            if (t != dtype::any && args[i].type() != t) {
+                return string_format("%s expected type %s for argument %zu, got %s", name, dtype_to_str(t).c_str(), i + 1, dtype_to_str(args[i].type()).c_str());
             }
+        }
 
-            case dtype::cfunction:
-                return "<c function>";
+        return "";
+    }
+} rt_cfunction_t;
+
+// kept out of line so make_int stays small enough to inline everywhere
+[[gnu::noinline]] inline rt_value box_int(int64_t i) {
+    return rt_value(gc_heap().track(new rt_int(i), sizeof(rt_int)));
+}
+
+inline rt_value make_int(int64_t i) {
+    return rt_value::fits_small(i) ? rt_value::small_int(i) : box_int(i);
+}
+
+inline rt_value make_string(std::string str) {
+    size_t bytes = sizeof(rt_string) + str.size();
+    return rt_value(gc_heap().track(new rt_string(std::move(str)), bytes));
+}
+
+// below this a rope node costs more than copying the text
+constexpr size_t ROPE_MIN = 64;
+
+inline rt_value concat_strings(rt_value left, rt_value right) {
+    rt_string* l = static_cast<rt_string*>(left.obj());
+    rt_string* r = static_cast<rt_string*>(right.obj());
+
+    if (r->length == 0) return left;
+    if (l->length == 0) return right;
+    if (l->length + r->length < ROPE_MIN) return make_string(l->text() + r->text());
+
+    // short pieces appended one after another are merged into the rope's
+    // last leaf instead of each getting a node of their own. l's pieces are
+    // read once, another thread may be flattening it
+    rt_string* head = __atomic_load_n(&l->left, __ATOMIC_ACQUIRE);
+    rt_string* last = __atomic_load_n(&l->right, __ATOMIC_RELAXED);
+    if (head != nullptr && last != nullptr && last->flat() && r->flat() && last->length + r->length < ROPE_MIN) {
+        rt_value leaf = make_string(last->str + r->str);
+        return rt_value(gc_heap().track(new rt_string(head, static_cast<rt_string*>(leaf.obj())), sizeof(rt_string)));
+    }
 
-            case dtype::boolean:
-                std::string ts[2] = {"false", "true"};
-                return ts[static_cast<int>(this->boolean)];
-        }
+    return rt_value(gc_heap().track(new rt_string(l, r), sizeof(rt_string)));
+}
+
+inline rt_value make_array(std::vector<rt_value> arr) {
+    size_t bytes = sizeof(rt_array) + arr.size() * sizeof(rt_value);
+    return rt_value(gc_heap().track(new rt_array(std::move(arr)), bytes));
+}
+
+inline rt_value make_i64array(std::vector<int64_t> data) {
+    size_t bytes = sizeof(rt_i64array) + data.size() * sizeof(int64_t);
+    return rt_value(gc_heap().track(new rt_i64array(std::move(data)), bytes));
+}
+
+inline rt_value make_f64array(std::vector<double> data) {
+    size_t bytes = sizeof(rt_f64array) + data.size() * sizeof(double);
+    return rt_value(gc_heap().track(new rt_f64array(std::move(data)), bytes));
+}
+
+inline bool is_packed(dtype_t t) {
+    return t == dtype::i64array || t == dtype::f64array;
+}
+
+inline size_t packed_length(rt_value arr) {
+    if (arr.type() == dtype::i64array) return static_cast<rt_i64array*>(arr.obj())->data.size();
+    return static_cast<rt_f64array*>(arr.obj())->data.size();
+}
+
+// boxes element at of a packed array, in range
+inline rt_value packed_get(rt_value arr, size_t at) {
+    if (arr.type() == dtype::i64array) return make_int(static_cast<rt_i64array*>(arr.obj())->data[at]);
+    return rt_value(static_cast<rt_f64array*>(arr.obj())->data[at]);
+}
+
+inline rt_value make_iter(iter_stage_t stage, rt_value source, rt_value func, int64_t start, int64_t stop) {
+    return rt_value(gc_heap().track(new rt_iter(stage, source, func, start, stop), sizeof(rt_iter)));
+}
+
+inline rt_value make_channel(std::shared_ptr<channel> chan) {
+    return rt_value(gc_heap().track(new rt_channel(std::move(chan)), sizeof(rt_channel)));
+}
+
+inline rt_task* make_task(rt_value work) {
+    return gc_heap().track(new rt_task(work), sizeof(rt_task));
+}
+
+inline rt_value make_object(shape_t* shape, std::vector<rt_value> slots) {
+    size_t bytes = sizeof(rt_object) + slots.size() * sizeof(rt_value);
+    return rt_value(gc_heap().track(new rt_object(shape, std::move(slots)), bytes));
+}
+
+inline rt_value make_object(std::initializer_list<std::pair<const char*, rt_value>> members) {
+    rt_value obj = make_object(shapes().root(), {});
+    for (auto& [key, val] : members) static_cast<rt_object*>(obj.obj())->set(symbols().intern(key), val);
+    return obj;
+}
+
+inline rt_value make_function(ast_node* body, ast_node* proto) {
+    return rt_value(gc_heap().track(new rt_function(body, proto), sizeof(rt_function)));
+}
+
+inline rt_value make_cfunction(const char* name, cfunc_t cf, std::vector<dtype_t> types, void* data = nullptr) {
+    int arity = types.size();
+    return rt_value(gc_heap().track(new rt_cfunction(cf, name, arity, std::move(types), data), sizeof(rt_cfunction)));
+}
+
+inline rt_value make_variadic(const char* name, cfunc_t cf) {
+    return rt_value(gc_heap().track(new rt_cfunction(cf, name, -1, {}), sizeof(rt_cfunction)));
+}
+
+inline rt_value with_effect(native_effect_t effect, rt_value native) {
+    static_cast<rt_cfunction*>(native.obj())->effect = effect;
+    return native;
+}
+
+inline int64_t rt_value::integer() const {
+    return is_small() ? small() : static_cast<rt_int*>(obj())->value;
+}
+
+inline double rt_value::to_double() const {
+    return is_double() ? num() : static_cast<double>(integer());
+}
+
+inline std::string& rt_value::str() const {
+    return static_cast<rt_string*>(obj())->text();
+}
+
+inline ring<rt_value>& rt_value::arr() const {
+    return static_cast<rt_array*>(obj())->arr;
+}
+
+inline rt_object* rt_value::object() const {
+    return static_cast<rt_object*>(obj());
+}
+
+// objects print their members sorted by name, whatever order they were
+// built in
+inline std::vector<std::pair<std::string, rt_value>> members_by_name(rt_object* obj) {
+    std::vector<std::pair<std::string, rt_value>> members;
+    for (size_t i = 0; i < obj->slots.size(); i++) {
+        members.emplace_back(symbols().name(obj->shape->keys[i]), obj->slots[i]);
     }
 
-    void out() {
-        switch (type) {
-            case dtype::integer:
-                printf("%f", this->num);
+    std::sort(members.begin(), members.end(), [](auto& a, auto& b) { return a.first < b.first; });
+    return members;
+}
+
+inline rt_function* rt_value::fn() const {
+    return static_cast<rt_function*>(obj());
+}
+
+inline rt_cfunction* rt_value::cfn() const {
+    return static_cast<rt_cfunction*>(obj());
+}
+
+// ints as they are, doubles in the shortest form that reads back as the
+// same double, with a ".0" where that would look like an int
+inline std::string number_to_string(rt_value num) {
+    char buf[32];
+    if (num.type() == dtype::integer) return std::string(buf, std::to_chars(buf, buf + sizeof(buf), num.integer()).ptr);
+
+    std::string fin(buf, std::to_chars(buf, buf + sizeof(buf), num.num()).ptr);
+    if (fin.find_first_of(".eEn") == std::string::npos) fin += ".0";
+    return fin;
+}
+
+// arithmetic and comparison once both operands are numbers. two ints stay
+// on the int64 alu and fail on overflow, anything with a double in it is
+// done in doubles. returns what went wrong, nullptr when nothing did
+inline const char* arith(binop_t op, rt_value left, rt_value right, rt_value& out) {
+    if (left.type() == dtype::integer && right.type() == dtype::integer) {
+        int64_t a = left.integer(), b = right.integer(), r = 0;
+
+        switch (op) {
+            case binop::add:
+                if (__builtin_add_overflow(a, b, &r)) return "integer overflow";
                 break;
 
-            case dtype::boolean: {
-                std::string ts[2] = {"false", "true"};
-                printf("%s", ts[static_cast<int>(this->boolean)].c_str());
+            case binop::sub:
+                if (__builtin_sub_overflow(a, b, &r)) return "integer overflow";
                 break;
-            }
 
-            case dtype::string:
-                printf("%s", this->str.c_str());
+            case binop::mul:
+                if (__builtin_mul_overflow(a, b, &r)) return "integer overflow";
                 break;
 
-            case dtype::nil:
-                printf("%s", "nil");
+            case binop::div:
+                if (b == 0) return "division by zero";
+                if (a == INT64_MIN && b == -1) return "integer overflow";
+                r = a / b;
                 break;
 
-            case dtype::array: {
-                std::string fin = "[ ";
+            case binop::eq: out = rt_value(a == b); return nullptr;
+            case binop::ge: out = rt_value(a >= b); return nullptr;
+            case binop::le: out = rt_value(a <= b); return nullptr;
+            case binop::lt: out = rt_value(a < b); return nullptr;
+            case binop::gt: out = rt_value(a > b); return nullptr;
+        }
 
-                for (rt_value* item : arr) {
-                    fin += item->ts() + ", ";
-                }
+        out = make_int(r);
+        return nullptr;
+    }
 
-                printf("%s", (fin + " ]").c_str());
-                break;
+    double a = left.to_double(), b = right.to_double();
+    switch (op) {
+        case binop::add: out = rt_value(a + b); break;
+        case binop::sub: out = rt_value(a - b); break;
+        case binop::mul: out = rt_value(a * b); break;
+        case binop::div: out = rt_value(a / b); break;
+        case binop::eq: out = rt_value(a == b); break;
+        case binop::ge: out = rt_value(a >= b); break;
+        case binop::le: out = rt_value(a <= b); break;
+        case binop::lt: out = rt_value(a < b); break;
+        case binop::gt: out = rt_value(a > b); break;
+    }
+
+    return nullptr;
+}
+
+// two ints that fit the payload, the common case. false when the full path
+// is needed to report an overflowing mul or a division by zero
+inline bool small_arith(binop_t op, int64_t a, int64_t b, rt_value& out) {
+    int64_t r;
+
+    switch (op) {
+        case binop::add: out = make_int(a + b); return true;
+        case binop::sub: out = make_int(a - b); return true;
+        case binop::mul:
+            if (__builtin_mul_overflow(a, b, &r)) return false;
+            out = make_int(r);
+            return true;
+        case binop::div:
+            if (b == 0) return false;
+            out = make_int(a / b);
+            return true;
+        case binop::eq: out = rt_value(a == b); return true;
+        case binop::ge: out = rt_value(a >= b); return true;
+        case binop::le: out = rt_value(a <= b); return true;
+        case binop::lt: out = rt_value(a < b); return true;
+        case binop::gt: out = rt_value(a > b); return true;
+    }
+
+    return false;
+}
+
+// small_arith's comparisons, for a caller that branches on the result
+// rather than keeping it
+inline bool small_compare(binop_t op, int64_t a, int64_t b) {
+    switch (op) {
+        case binop::eq: return a == b;
+        case binop::ge: return a >= b;
+        case binop::le: return a <= b;
+        case binop::lt: return a < b;
+        case binop::gt: return a > b;
+        default: return false;
+    }
+}
+
+std::string repeat(std::string str, const std::size_t n);
+
+// what a binary operator does to any two values, both engines fall back on
+// it once their fast paths don't apply. returns what went wrong, nullptr
+// when nothing did. operands it has no meaning for give nil
+inline const char* binary_op(binop_t op, rt_value left, rt_value right, rt_value& out) {
+    out = rt_value();
+    if (left.is_number() && right.is_number()) return arith(op, left, right, out);
+
+    if (left.type() == dtype::string && right.type() == dtype::string) {
+        switch (op) {
+            case binop::add: out = concat_strings(left, right); return nullptr;
+            case binop::sub: return "cannot sub string by string";
+            case binop::div: return "cannot divide string by string";
+            case binop::mul: return "cannot multiply string by string";
+            case binop::eq: out = rt_value(left.str() == right.str()); return nullptr;
+            case binop::ge: return "cannot check if string is greater than or equal to string";
+            case binop::le: return "cannot check if string is less than or equal to string";
+            case binop::lt: return "cannot check if string is less than string";
+            case binop::gt: return "cannot check if string is greater than string";
+        }
+    }
+
+    if (left.type() == dtype::string && right.is_number()) {
+        switch (op) {
+            case binop::add: out = concat_strings(left, make_string(number_to_string(right))); return nullptr;
+            case binop::sub: return "cannot sub string by number";
+            case binop::div: return "cannot divide string by number";
+            case binop::mul:
+                if (right.type() != dtype::integer) return "cannot multiply string by float";
+                out = make_string(repeat(left.str(), (int)right.integer()));
+                return nullptr;
+            case binop::ge: return "cannot check if string is greater than or equal to number";
+            case binop::le: return "cannot check if string is less than or equal to number";
+            case binop::lt: return "cannot check if string is less than number";
+            case binop::gt: return "cannot check if string is greater than number";
+            default: break;
+        }
+    }
+
+    return nullptr;
+}
+
+inline std::string proto_to_str(ast_node* proto) {
+    std::string fin = "function (";
+
+    for (ast_node* parg : proto->children) {
+        fin += string_format("%s: %s", std::string(parg->symbol).c_str(), dtype_to_str(parg->data_type).c_str());
+    }
+
+    fin += string_format(") => %s", dtype_to_str(proto->data_type).c_str());
+
+    return fin;
+}
+
+// i64array[1, 2, 3]
+inline std::string packed_to_string(rt_value arr) {
+    std::string fin = dtype_to_str(arr.type()) + "[";
+    size_t length = packed_length(arr);
+
+    for (size_t i = 0; i < length; i++) {
+        if (i > 0) fin += ", ";
+        fin += number_to_string(packed_get(arr, i));
+    }
+
+    return fin + "]";
+}
+
+inline std::string rt_value::ts() {
+    switch (type()) {
+        case dtype::integer:
+        case dtype::floating:
+            return number_to_string(*this);
+
+        case dtype::string:
+            return "\"" + str() + "\"";
+
+        case dtype::array: {
+            std::string fin = "[ ";
+
+            for (rt_value item : arr()) {
+                fin += item.ts();
             }
 
-            case dtype::object: {
-                printf("%s", this->ts().c_str());
-                break;
+            return fin + " ]";
+        }
+
+        case dtype::object: {
+            std::string fin = "{\n";
+
+            for (auto& [key, value] : members_by_name(object())) {
+                fin += string_format("%s: %s,\n", key.c_str(), value.ts(1).c_str());
             }
 
-            case dtype::func: {
-                if (proto != nullptr) {
-                    std::string fin = "function (";
+            return fin + "}";
+        }
 
-                    for (ast_node* parg : proto->children) {
-                        fin += string_format("%s: %s", parg->symbol.c_str(), dtype_to_str(parg->data_type).c_str());
-                    }
+        case dtype::func:
+            return proto_to_str(fn()->proto);
 
-                    fin += string_format(") => %s", dtype_to_str(proto->data_type).c_str());
+        case dtype::cfunction:
+            return "<c function>";
 
-                    printf("%s\n", (fin).c_str());
-                } else printf("<null function>\n");
-                break;
-            }
+        case dtype::iter:
+            return "<iter>";
 
-            case dtype::cfunction:
-                printf("<c function>");
-                break;
+        case dtype::channel:
+            return "<channel>";
+
+        case dtype::task:
+            return "<task>";
+
+        case dtype::i64array:
+        case dtype::f64array:
+            return packed_to_string(*this);
+
+        case dtype::boolean: {
+            std::string ts[2] = {"false", "true"};
+            return ts[static_cast<int>(boolean())];
         }
+
+        default:
+            return "nil";
     }
+}
+
+inline void rt_value::out() {
+    switch (type()) {
+        case dtype::integer:
+        case dtype::floating:
+            printf("%s", number_to_string(*this).c_str());
+            break;
+
+        case dtype::boolean: {
+            std::string ts[2] = {"false", "true"};
+            printf("%s", ts[static_cast<int>(boolean())].c_str());
+            break;
+        }
 
-    std::string ts(int id) {
-        switch (type) {
-            case dtype::integer:
-                return std::to_string(this->num);
+        case dtype::string:
+            printf("%s", str().c_str());
+            break;
 
-            case dtype::string:
-                return "\"" + this->str + "\"";
+        case dtype::array: {
+            std::string fin = "[ ";
 
-            case dtype::nil:
-                return "nil";
+            for (rt_value item : arr()) {
+                fin += item.ts() + ", ";
+            }
 
-            case dtype::array: {
-                std::string fin = "[ ";
+            printf("%s", (fin + " ]").c_str());
+            break;
+        }
 
-                for (rt_value* item : arr) {
-                    fin += item->ts();
-                }
+        case dtype::object: {
+            printf("%s", ts().c_str());
+            break;
+        }
 
-                return fin + " ]";
-            }
+        case dtype::func: {
+            if (fn()->proto != nullptr) {
+                printf("%s\n", proto_to_str(fn()->proto).c_str());
+            } else printf("<null function>\n");
+            break;
+        }
 
-            case dtype::object: {
-                std::string ident = std::string(id, '\t');
-                std::string fin = "{\n";
-                auto it = children.begin();
+        case dtype::cfunction:
+            printf("<c function>");
+            break;
 
-                while (it != children.end()) {
-                    std::string key = it->first;
-                    rt_value* value = it->second;
+        case dtype::iter:
+            printf("<iter>");
+            break;
 
-                    fin += string_format("%s%s: %s,\n", (std::string(id + 1, '\t')).c_str(), key.c_str(), value->ts(id + 1).c_str());
-                    it++;
-                }
+        case dtype::channel:
+            printf("<channel>");
+            break;
 
-                return fin + ident + "}";
-            }
+        case dtype::task:
+            printf("<task>");
+            break;
 
-            case dtype::func: {
-                std::string fin = "function (";
+        case dtype::i64array:
+        case dtype::f64array:
+            printf("%s", packed_to_string(*this).c_str());
+            break;
 
-                for (ast_node* parg : proto->children) {
-                    fin += string_format("%s: %s", parg->symbol.c_str(), dtype_to_str(parg->data_type).c_str());
-                }
+        default:
+            printf("%s", "nil");
+            break;
+    }
+}
 
-                fin += string_format(") => %s", dtype_to_str(proto->data_type).c_str());
+inline std::string rt_value::ts(int id) {
+    switch (type()) {
+        case dtype::object: {
+            std::string ident = std::string(id, '\t');
+            std::string fin = "{\n";
 
-                return fin;
+            for (auto& [key, value] : members_by_name(object())) {
+                fin += string_format("%s%s: %s,\n", (std::string(id + 1, '\t')).c_str(), key.c_str(), value.ts(id + 1).c_str());
             }
 
-            case dtype::cfunction:
-                return "<c function>";
+            return fin + ident + "}";
         }
+
+        default:
+            return ts();
     }
-} rt_value_t;
+}
 
-#endif // __RUNTIME_H__
\ No newline at end of file
+#endif // __RUNTIME_H__
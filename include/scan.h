@@ -0,0 +1,73 @@
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// byte scanning primitives for the lexer. each one returns the index of the
+// first byte in [from, len) that ends the run it skips, or len. on x86 they
+// look at 16 (sse2) or 32 (avx2) bytes at a time, picked once at runtime,
+// everything else gets the scalar loops
+namespace scan {
+    typedef size_t (*scan_fn)(const char* src, size_t from, size_t len);
+
+    typedef struct scanner {
+        const char* name;
+        scan_fn skip_space;     // ' ', \t, \n, \v, \f, \r
+        scan_fn skip_ident;     // [A-Za-z0-9_]
+        scan_fn skip_digits;    // [0-9]
+        scan_fn find_newline;
+        scan_fn find_quote;
+    } scanner_t;
+
+    const scanner_t& scalar();
+    const scanner_t& best();
+    void use(const scanner_t& impl);
+
+    // offsets where each line starts, used to turn offsets into line:col
+    std::vector<uint32_t> index_lines(const char* src, size_t len);
+
+    enum : uint8_t {
+        SPACE = 1,
+        DIGIT = 2,
+        ALPHA = 4,
+    };
+
+    constexpr std::array<uint8_t, 256> make_classes() {
+        std::array<uint8_t, 256> table = {};
+        for (int c = '\t'; c <= '\r'; c++) table[c] = SPACE;
+        table[' '] = SPACE;
+        for (int c = '0'; c <= '9'; c++) table[c] = DIGIT;
+        for (int c = 'a'; c <= 'z'; c++) table[c] = table[c - 'a' + 'A'] = ALPHA;
+        table['_'] = ALPHA;
+        return table;
+    }
+
+    inline constexpr std::array<uint8_t, 256> classes = make_classes();
+
+    inline bool is(char c, uint8_t cls) {
+        return classes[static_cast<uint8_t>(c)] & cls;
+    }
+
+    inline bool is_space(char c) { return is(c, SPACE); }
+    inline bool is_digit(char c) { return is(c, DIGIT); }
+    inline bool is_alpha(char c) { return is(c, ALPHA); }
+    inline bool is_alnum(char c) { return is(c, ALPHA | DIGIT); }
+
+    // most runs are a few bytes long, too short for the vector loops to pay
+    // for the call, so the first SHORT_RUN bytes are checked inline
+    constexpr size_t SHORT_RUN = 8;
+
+    inline size_t skip(scan_fn fn, uint8_t cls, const char* src, size_t from, size_t len) {
+        size_t end = from + SHORT_RUN < len ? from + SHORT_RUN : len;
+        while (from < end) {
+            if (!is(src[from], cls)) return from;
+            from++;
+        }
+        return from < len ? fn(src, from, len) : len;
+    }
+}
+
+#endif // SCAN_H_
@@ -0,0 +1,142 @@
+#ifndef SHAPE_H_
+#define SHAPE_H_
+
+#include "symbol.h"
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// hidden classes for objects. a shape is the ordered list of keys an object
+// was built with, the object itself is just a shape and one slot per key.
+// objects built with the same keys in the same order end up sharing one
+// shape, because adding a key follows the transition out of the current
+// shape if there already is one. shapes live as long as their isolate
+typedef struct shape {
+    static constexpr size_t INDEXED = 8;
+
+    shape* parent;
+    std::vector<atom_t> keys;
+    std::vector<std::pair<atom_t, shape*>> transitions;
+    // only built for shapes with more than INDEXED keys
+    std::unordered_map<atom_t, uint32_t> index;
+
+    shape() : parent(nullptr) {};
+
+    // slot of key, -1 when objects of this shape don't have it
+    int find(atom_t key) const {
+        if (keys.size() > INDEXED) {
+            auto it = index.find(key);
+            return it != index.end() ? static_cast<int>(it->second) : -1;
+        }
+
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i] == key) return i;
+        }
+
+        return -1;
+    }
+
+    shape* add(atom_t key);
+} shape_t;
+
+typedef struct shape_table {
+    std::deque<shape_t> shapes;
+
+    shape_table() {
+        shapes.emplace_back();
+    }
+
+    shape_t* root() {
+        return &shapes.front();
+    }
+
+    shape_t* make(shape_t* parent, atom_t key) {
+        shapes.emplace_back();
+        shape_t* next = &shapes.back();
+        next->parent = parent;
+        next->keys = parent->keys;
+        next->keys.push_back(key);
+
+        if (next->keys.size() > shape::INDEXED) {
+            for (size_t i = 0; i < next->keys.size(); i++) next->index[next->keys[i]] = i;
+        }
+
+        return next;
+    }
+} shape_table_t;
+
+inline thread_local shape_table_t* current_shapes = nullptr;
+
+inline shape_table_t& shapes() {
+    return *current_shapes;
+}
+
+inline shape_t* shape::add(atom_t key) {
+    for (auto& [k, next] : transitions) {
+        if (k == key) return next;
+    }
+
+    shape_t* next = shapes().make(this, key);
+    transitions.emplace_back(key, next);
+    return next;
+}
+
+// inline cache of one member access site: the last few shapes seen there
+// and the slot the key lives in for each. a hit is a pointer compare and an
+// indexed load, a miss looks the key up in the shape and remembers it while
+// there is room, sites that see more than WAYS shapes just keep missing
+typedef struct member_cache {
+    static constexpr uint32_t WAYS = 4;
+
+    atom_t key;
+    uint32_t count;
+    shape_t* seen[WAYS];
+    uint32_t slots[WAYS];
+
+    member_cache(atom_t key = 0) : key(key), count(0) {};
+
+    // learn is off for threads reading the cache at the same time
+    int lookup(shape_t* s, bool learn = true) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (seen[i] == s) return slots[i];
+        }
+
+        int slot = s->find(key);
+        if (learn && slot >= 0 && count < WAYS) {
+            seen[count] = s;
+            slots[count] = slot;
+            count++;
+        }
+
+        return slot;
+    }
+} member_cache_t;
+
+// shape an object literal builds and the slot each of its entries goes to,
+// a key written twice keeps the last value like it always did
+typedef struct object_layout {
+    shape_t* shape;
+    std::vector<uint32_t> slots;
+} object_layout_t;
+
+// per-site state for member reads and object literals, ast_node::site
+// indexes these. the tables are shared by every module of an isolate, both
+// engines and any function that ends up running another module's code
+typedef struct site_tables {
+    std::deque<member_cache_t> caches;
+    std::deque<object_layout_t> layouts;
+} site_tables_t;
+
+inline thread_local site_tables_t* current_sites = nullptr;
+
+inline std::deque<member_cache_t>& member_caches() {
+    return current_sites->caches;
+}
+
+inline std::deque<object_layout_t>& object_layouts() {
+    return current_sites->layouts;
+}
+
+#endif // SHAPE_H_
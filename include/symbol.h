@@ -0,0 +1,52 @@
+#ifndef SYMBOL_H_
+#define SYMBOL_H_
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+typedef uint32_t atom_t;
+
+// interned identifier names. the lexer maps every identifier to an atom so
+// later passes compare integers instead of strings. names is a deque so
+// the views used as keys stay put as it grows, atom 0 is never handed out
+typedef struct symbol_table {
+    std::unordered_map<std::string_view, atom_t> ids;
+    std::deque<std::string> names;
+
+    symbol_table() {
+        names.emplace_back();
+    }
+
+    atom_t intern(std::string_view name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+
+        atom_t atom = names.size();
+        names.emplace_back(name);
+        ids.emplace(names.back(), atom);
+
+        return atom;
+    }
+
+    // 0 when name was never interned
+    atom_t find(std::string_view name) {
+        auto it = ids.find(name);
+        return it != ids.end() ? it->second : 0;
+    }
+
+    const std::string& name(atom_t atom) {
+        return names[atom];
+    }
+} symbol_table_t;
+
+// the table of the isolate running on this thread, see isolate.h
+inline thread_local symbol_table_t* current_symbols = nullptr;
+
+inline symbol_table_t& symbols() {
+    return *current_symbols;
+}
+
+#endif // SYMBOL_H_
@@ -2,28 +2,45 @@
 #define TOKEN_H_
 
 #include "position.h"
+#include "symbol.h"
+#include <cstdint>
 #include <string>
-typedef enum struct token_type {
+#include <string_view>
+typedef enum struct token_type : uint8_t {
     ret,
     identifier, str_literal, num_literal,
     binaryop, equals, 
     semi, eof, colon, lparen, rparen, lcbrace, rcbrace, lbrace, rbrace, comma, f_assign, dot,
     import, as,
     if_t, while_t, else_t,
-    true_t, false_t
+    true_t, false_t,
+    async_t, await_t
 } token_type_t;
 
+// where the token's text starts in the source it was lexed from and how
+// long it is, a string's text leaves its quotes out. identifiers also carry
+// their interned atom. big scripts lex into tens of millions of these, so
+// they are kept to 16 bytes
 typedef struct token {
+    uint32_t start;
+    uint32_t length;
+    atom_t atom;
     token_type_t type;
-    std::string value;
-    position_t pos;
 
-    token(token_type_t t, std::string v, position_t pos) 
-    : type(t), value(v), pos(pos) {};
+    token(token_type_t t, uint32_t start, uint32_t length, atom_t atom = 0)
+    : start(start), length(length), atom(atom), type(t) {};
 
-    token() {};
+    token() : start(0), length(0), atom(0) {};
+
+    // where the last character sits, a string's closing quote
+    uint32_t end() const {
+        if (type == token_type::str_literal || type == token_type::eof) return start + length;
+        return start + length - 1;
+    }
 } token_t;
 
+static_assert(sizeof(token_t) == 16, "tokens are meant to stay 16 bytes");
+
 inline std::string token_to_str(token_type_t type) {
     switch (type) {
         case token_type::str_literal:
@@ -100,11 +117,17 @@ inline std::string token_to_str(token_type_t type) {
 
         case token_type::false_t:
             return "false";
+
+        case token_type::async_t:
+            return "async";
+
+        case token_type::await_t:
+            return "await";
     }
 }
 
-inline void print_tok(token_t tok) {
-    printf("<type:%d, pos:%d:%d, value:%s>\n", static_cast<int>(tok.type), tok.pos.ln, tok.pos.col, tok.value.c_str());
+inline void print_tok(token_t tok, const std::string& source) {
+    printf("<type:%d, offset:%u, value:%.*s>\n", static_cast<int>(tok.type), tok.end(), (int)tok.length, source.data() + tok.start);
 }
 
 #endif // TOKEN_H_
\ No newline at end of file
@@ -1,9 +1,12 @@
 #ifndef TYPES_H_
 #define TYPES_H_
 
+#include <cstdint>
 #include <string>
-typedef enum struct dtype {
+#include <string_view>
+typedef enum struct dtype : uint8_t {
     integer,
+    floating,
     string,
     func,
     object,
@@ -11,13 +14,32 @@ typedef enum struct dtype {
     nil,
     boolean,
     cfunction,
+    any,
+    env,
+    // packed arrays, appended so cached trees keep their type ids
+    i64array,
+    f64array,
+    // a lazy map/filter/take pipeline, see iter.h
+    iter,
+    // an end of a queue between isolates, see channel.h
+    channel,
+    // a call an async function started, see async.h
+    task,
 } dtype_t;
 
-inline dtype_t str_to_dtype(std::string dt) {
+// the highest type id, a cached tree holding anything above it is stale.
+// keep it on the last type when appending
+constexpr dtype_t last_dtype = dtype::task;
+
+inline dtype_t str_to_dtype(std::string_view dt) {
     if (dt == "int") {
         return dtype::integer;
     }
 
+    if (dt == "float") {
+        return dtype::floating;
+    }
+
     if (dt == "str") {
         return dtype::string;
     }
@@ -42,6 +64,30 @@ inline dtype_t str_to_dtype(std::string dt) {
         return dtype::boolean;
     }
 
+    if (dt == "any") {
+        return dtype::any;
+    }
+
+    if (dt == "i64array") {
+        return dtype::i64array;
+    }
+
+    if (dt == "f64array") {
+        return dtype::f64array;
+    }
+
+    if (dt == "iter") {
+        return dtype::iter;
+    }
+
+    if (dt == "channel") {
+        return dtype::channel;
+    }
+
+    if (dt == "task") {
+        return dtype::task;
+    }
+
     return dtype::nil;
 }
 
@@ -50,6 +96,9 @@ inline std::string dtype_to_str(dtype_t dt) {
         case dtype::integer:
             return "int";
 
+        case dtype::floating:
+            return "float";
+
         case dtype::string:
             return "string";
 
@@ -70,6 +119,27 @@ inline std::string dtype_to_str(dtype_t dt) {
 
         case dtype::boolean:
             return "bool";
+
+        case dtype::any:
+            return "any";
+
+        case dtype::env:
+            return "environment";
+
+        case dtype::i64array:
+            return "i64array";
+
+        case dtype::f64array:
+            return "f64array";
+
+        case dtype::iter:
+            return "iter";
+
+        case dtype::channel:
+            return "channel";
+
+        case dtype::task:
+            return "task";
     }
 }
 
@@ -0,0 +1,129 @@
+#ifndef VALUE_H_
+#define VALUE_H_
+
+#include "ring.h"
+#include "types.h"
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+// header every heap allocated value starts with. the collector links
+// objects of one generation through next and keeps its flags here, along
+// with how many bytes it has the object down for
+typedef struct rt_heap {
+    dtype_t type;
+    bool marked;
+    bool old;
+    bool remembered;
+    size_t bytes;
+    rt_heap* next;
+
+    rt_heap(dtype_t type) : type(type), marked(false), old(false), remembered(false), bytes(0), next(nullptr) {};
+} rt_heap_t;
+
+// values are nan-boxed into 8 bytes. every double is stored as itself
+// (real nans are canonicalised to a positive quiet nan), the negative quiet
+// nan space above TAG_SPECIAL carries a 16-bit tag and a 48-bit payload:
+// nil, booleans and the undefined slot marker, an int that fits in 48 bits,
+// or a pointer to a heap value. wider ints are boxed on the heap
+constexpr uint64_t TAG_MASK = 0xffff000000000000ull;
+constexpr uint64_t TAG_SPECIAL = 0xfff9000000000000ull;
+constexpr uint64_t TAG_INT = 0xfffa000000000000ull;
+constexpr uint64_t TAG_OBJECT = 0xfffb000000000000ull;
+constexpr uint64_t PAYLOAD_MASK = 0x0000ffffffffffffull;
+constexpr uint64_t CANONICAL_NAN = 0x7ff8000000000000ull;
+
+constexpr uint64_t NIL_BITS = TAG_SPECIAL | 0;
+constexpr uint64_t UNDEF_BITS = TAG_SPECIAL | 1;
+constexpr uint64_t FALSE_BITS = TAG_SPECIAL | 2;
+constexpr uint64_t TRUE_BITS = TAG_SPECIAL | 3;
+
+constexpr int64_t SMALL_INT_MIN = -(int64_t(1) << 47);
+constexpr int64_t SMALL_INT_MAX = (int64_t(1) << 47) - 1;
+
+struct rt_object;
+struct rt_function;
+struct rt_cfunction;
+
+typedef struct rt_value {
+    uint64_t bits;
+
+    rt_value() : bits(NIL_BITS) {};
+    rt_value(double num) {
+        if (num != num) bits = CANONICAL_NAN;
+        else std::memcpy(&bits, &num, sizeof(bits));
+    };
+    rt_value(bool b) : bits(b ? TRUE_BITS : FALSE_BITS) {};
+    rt_value(rt_heap* obj) : bits(TAG_OBJECT | reinterpret_cast<uint64_t>(obj)) {};
+
+    static rt_value undefined() {
+        rt_value val;
+        val.bits = UNDEF_BITS;
+        return val;
+    }
+
+    // only for ints in [SMALL_INT_MIN, SMALL_INT_MAX], make_int boxes the rest
+    static rt_value small_int(int64_t i) {
+        rt_value val;
+        val.bits = TAG_INT | (static_cast<uint64_t>(i) & PAYLOAD_MASK);
+        return val;
+    }
+
+    static bool fits_small(int64_t i) { return i >= SMALL_INT_MIN && i <= SMALL_INT_MAX; }
+
+    bool is_double() const { return bits < TAG_SPECIAL; }
+    bool is_small() const { return (bits & TAG_MASK) == TAG_INT; }
+    bool is_nil() const { return bits == NIL_BITS; }
+    bool is_undef() const { return bits == UNDEF_BITS; }
+    bool is_bool() const { return (bits & ~1ull) == FALSE_BITS; }
+    bool is_obj() const { return (bits & TAG_MASK) == TAG_OBJECT; }
+
+    double num() const {
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    // sign extends the payload
+    int64_t small() const { return static_cast<int64_t>(bits << 16) >> 16; }
+
+    bool boolean() const { return bits & 1; }
+    rt_heap* obj() const { return reinterpret_cast<rt_heap*>(bits & PAYLOAD_MASK); }
+
+    dtype_t type() const {
+        if (is_double()) return dtype::floating;
+        if (is_small()) return dtype::integer;
+        if (is_obj()) return obj()->type;
+        if (is_bool()) return dtype::boolean;
+        return dtype::nil;
+    }
+
+    bool truthy() const {
+        return is_bool() ? boolean() : !is_nil();
+    }
+
+    bool is_number() const {
+        dtype_t t = type();
+        return t == dtype::integer || t == dtype::floating;
+    }
+
+    // heap accessors, only valid once type() has been checked. integer()
+    // reads small and boxed ints alike, to_double() any number
+    int64_t integer() const;
+    double to_double() const;
+    std::string& str() const;
+    ring<rt_value>& arr() const;
+    rt_object* object() const;
+    rt_function* fn() const;
+    rt_cfunction* cfn() const;
+
+    std::string ts();
+    std::string ts(int id);
+    void out();
+} rt_value_t;
+
+static_assert(sizeof(rt_value) == 8, "rt_value must stay one word");
+
+#endif // VALUE_H_
@@ -0,0 +1,51 @@
+#ifndef VM_H_
+#define VM_H_
+
+#include "bytecode.h"
+#include "env.h"
+#include "runtime.h"
+#include <vector>
+
+struct interpreter;
+
+// how deep script calls may nest in either engine before it is an error,
+// set with --max-depth. calls in tail position don't count
+inline size_t& max_call_depth() {
+    static size_t depth = 100000;
+    return depth;
+}
+
+// slots points at the frame's locals, either on the value stack or inside a
+// heap environment. env is the nearest materialised environment: the
+// frame's own when it can be captured, otherwise the callee's closure
+typedef struct call_frame {
+    rt_value func;
+    chunk_t* code;
+    size_t ip;
+    rt_value* slots;
+    rt_value* base;
+    environment_t* env;
+} call_frame_t;
+
+// stack machine running the chunks produced by the compiler. script to
+// script calls push a call_frame instead of recursing on the native stack,
+// locals and operands share the interpreter's value stack
+typedef struct vm {
+    interpreter* inter;
+    value_stack_t* stack;
+    std::vector<call_frame_t> frames;
+
+    vm(interpreter* inter);
+
+    rt_value run(chunk_t* code, environment_t* env);
+    rt_value call(rt_value func, args_t args, environment_t* env);
+
+    rt_value execute(size_t exit_depth);
+    void call_value(size_t argc, position_t pos, environment_t* env);
+    rt_value binary(binop_t op, rt_value left, rt_value right, position_t pos);
+    rt_value get_member(rt_value obj, member_cache_t& cache, position_t pos);
+    rt_value index(rt_value arr, rt_value idx, position_t pos);
+    void undefined(call_frame_t* frame, size_t at);
+} vm_t;
+
+#endif // VM_H_
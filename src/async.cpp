@@ -0,0 +1,742 @@
+#include "async.h"
+#include "isolate.h"
+#include "vm.h"
+#include <error.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace {
+    // closes the descriptor when the coroutine holding it ends or is freed
+    typedef struct descriptor {
+        int fd;
+
+        descriptor(int fd = -1) : fd(fd) {}
+
+        ~descriptor() {
+            reset();
+        }
+
+        void reset() {
+            if (fd >= 0) close(fd);
+            fd = -1;
+        }
+    } descriptor_t;
+
+    // a command that hasn't been waited for yet is killed if the coroutine
+    // running it is freed first
+    typedef struct child {
+        pid_t pid = -1;
+
+        ~child() {
+            if (pid <= 0) return;
+            kill(pid, SIGKILL);
+            while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+        }
+    } child_t;
+
+    // goes to the back of the ready queue
+    typedef struct next_turn {
+        event_loop_t* loop;
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> co) { loop->ready.push_back(co); }
+        void await_resume() {}
+    } next_turn_t;
+
+    typedef struct timer_wait {
+        event_loop_t* loop;
+        int64_t ms;
+
+        bool await_ready() { return false; }
+
+        void await_suspend(std::coroutine_handle<> co) {
+            auto due = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max<int64_t>(ms, 0));
+            loop->timers.push({due, loop->timer_seq++, co});
+        }
+
+        void await_resume() {}
+    } timer_wait_t;
+
+    // until fd can be read from, or written to, without blocking
+    typedef struct fd_ready {
+        event_loop_t* loop;
+        int fd;
+        bool write;
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> co) { loop->watch(fd, write, co); }
+        void await_resume() {}
+    } fd_ready_t;
+
+    // runs job on an offload thread, resumes on the loop once it's done
+    typedef struct offloaded {
+        event_loop_t* loop;
+        event_loop_t::job_t* job;
+
+        bool await_ready() { return false; }
+
+        void await_suspend(std::coroutine_handle<> co) {
+            job->co = co;
+            loop->submit(job);
+        }
+
+        void await_resume() {}
+    } offloaded_t;
+
+    typedef struct task_wait {
+        rt_task* task;
+
+        bool await_ready() { return task->state != task_state::pending; }
+        void await_suspend(std::coroutine_handle<> co) { task->waiters.push_back(co); }
+        void await_resume() {}
+    } task_wait_t;
+
+    std::string describe(const std::string& what, const std::string& path) {
+        return error(string_format("%s %s: %s", what.c_str(), path.c_str(), strerror(errno))).report();
+    }
+
+    void task_body(void* at)
+    {
+        task_run_t* run = static_cast<task_run_t*>(at);
+
+        try {
+            rt_value_t result = run->inter->call_func(run->task->work, args_t(), nullptr);
+            run->result = result.is_undef() ? rt_value() : result;
+        } catch (const script_error& err) {
+            run->failed = true;
+            run->report = err.what();
+        }
+    }
+
+    // a script task from start to end. the fiber gives the task up at every
+    // await that has to wait, this waits for that task in its place and
+    // carries the fiber on once it settles
+    io_op_t drive(event_loop_t* loop, rt_task* task, interpreter* origin)
+    {
+        co_await next_turn_t{loop};
+
+        task_run_t run = {task, origin, loop->lend(origin), nullptr, nullptr, rt_value(), false, "", false};
+        run.fiber = native_stack::start(task_body, &run);
+        loop->runs.insert(&run);
+
+        while (!loop->enter(&run)) co_await task_wait_t{run.waiting};
+
+        native_stack::finish(run.fiber);
+        loop->runs.erase(&run);
+        loop->give_back(origin, run.inter);
+
+        if (run.failed) loop->fail(task, std::move(run.report));
+        else loop->settle(task, run.result);
+    }
+
+    io_op_t sleep_op(event_loop_t* loop, rt_task* task, int64_t ms)
+    {
+        co_await timer_wait_t{loop, ms};
+        loop->settle(task, rt_value());
+    }
+
+    io_op_t read_op(event_loop_t* loop, rt_task* task, std::string path)
+    {
+        std::string text;
+        std::string problem;
+
+        event_loop_t::job_t job = {[&]() {
+            descriptor_t file(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+            if (file.fd < 0) {
+                problem = describe("io.read can't open", path);
+                return;
+            }
+
+            struct stat info;
+            if (fstat(file.fd, &info) == 0 && info.st_size > 0) text.reserve(info.st_size);
+
+            char buffer[1 << 16];
+            for (;;) {
+                ssize_t n = read(file.fd, buffer, sizeof(buffer));
+                if (n > 0) text.append(buffer, n);
+                else if (n == 0) break;
+                else if (errno != EINTR) {
+                    problem = describe("io.read failed on", path);
+                    return;
+                }
+            }
+        }, {}};
+        co_await offloaded_t{loop, &job};
+
+        if (!problem.empty()) loop->fail(task, std::move(problem));
+        else loop->settle(task, make_string(std::move(text)));
+    }
+
+    io_op_t write_op(event_loop_t* loop, rt_task* task, std::string path, std::string text)
+    {
+        std::string problem;
+
+        event_loop_t::job_t job = {[&]() {
+            descriptor_t file(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+            if (file.fd < 0) {
+                problem = describe("io.write can't open", path);
+                return;
+            }
+
+            size_t at = 0;
+            while (at < text.size()) {
+                ssize_t n = write(file.fd, text.data() + at, text.size() - at);
+                if (n >= 0) at += n;
+                else if (errno != EINTR) {
+                    problem = describe("io.write failed on", path);
+                    return;
+                }
+            }
+        }, {}};
+        co_await offloaded_t{loop, &job};
+
+        if (!problem.empty()) loop->fail(task, std::move(problem));
+        else loop->settle(task, rt_value());
+    }
+
+    // writes text into a command's stdin next to exec_op reading its
+    // stdout, so neither side can fill a pipe the other never empties
+    io_op_t feed_op(event_loop_t* loop, int fd, std::string text)
+    {
+        descriptor_t in(fd);
+        size_t at = 0;
+
+        while (at < text.size()) {
+            ssize_t n = write(fd, text.data() + at, text.size() - at);
+            if (n >= 0) at += n;
+            else if (errno == EAGAIN) co_await fd_ready_t{loop, fd, true};
+            // the command stopped reading
+            else if (errno != EINTR) break;
+        }
+    }
+
+    io_op_t exec_op(event_loop_t* loop, rt_task* task, std::string command, std::string input)
+    {
+        int in[2], out[2];
+        if (pipe2(in, O_CLOEXEC) != 0) {
+            loop->fail(task, describe("io.exec can't make a pipe for", command));
+            co_return;
+        }
+        descriptor_t child_in(in[0]), feed(in[1]);
+
+        if (pipe2(out, O_CLOEXEC) != 0) {
+            loop->fail(task, describe("io.exec can't make a pipe for", command));
+            co_return;
+        }
+        descriptor_t child_out(out[1]), from(out[0]);
+
+        // only our ends, the command gets blocking pipes like anywhere else
+        fcntl(feed.fd, F_SETFL, fcntl(feed.fd, F_GETFL) | O_NONBLOCK);
+        fcntl(from.fd, F_SETFL, fcntl(from.fd, F_GETFL) | O_NONBLOCK);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, child_in.fd, STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, child_out.fd, STDOUT_FILENO);
+
+        child_t process;
+        const char* argv[] = {"sh", "-c", command.c_str(), nullptr};
+        int spawned = posix_spawn(&process.pid, "/bin/sh", &actions, nullptr, const_cast<char**>(argv), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        child_in.reset();
+        child_out.reset();
+
+        if (spawned != 0) {
+            process.pid = -1;
+            errno = spawned;
+            loop->fail(task, describe("io.exec can't run", command));
+            co_return;
+        }
+
+        if (!input.empty()) {
+            feed_op(loop, feed.fd, std::move(input));
+            feed.fd = -1;
+        }
+        feed.reset();
+
+        std::string text;
+        char buffer[1 << 16];
+        for (;;) {
+            ssize_t n = read(from.fd, buffer, sizeof(buffer));
+            if (n > 0) text.append(buffer, n);
+            else if (n == 0) break;
+            else if (errno == EAGAIN) co_await fd_ready_t{loop, from.fd, false};
+            else if (errno != EINTR) break;
+        }
+        from.reset();
+
+        // closing stdout usually means it's about to exit, otherwise the
+        // wait goes to an offload thread
+        int status = 0;
+        if (waitpid(process.pid, &status, WNOHANG) == 0) {
+            event_loop_t::job_t job = {[&]() {
+                while (waitpid(process.pid, &status, 0) < 0 && errno == EINTR) {}
+            }, {}};
+            co_await offloaded_t{loop, &job};
+        }
+        process.pid = -1;
+
+        int64_t code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        loop->settle(task, make_object({
+            {"status", make_int(code)},
+            {"out", make_string(std::move(text))}
+        }));
+    }
+
+    // waits for them in order, so it settles with the first failure in the
+    // list rather than the first to happen
+    io_op_t all_op(event_loop_t* loop, rt_task* task)
+    {
+        // a copy of the list the task holds on to, so it stays alive and
+        // nothing the script does changes it
+        rt_array* list = static_cast<rt_array*>(task->work.obj());
+
+        for (size_t i = 0; i < list->arr.size(); i++) {
+            rt_value item = list->arr[i];
+            if (item.type() == dtype::task) co_await task_wait_t{static_cast<rt_task*>(item.obj())};
+        }
+
+        std::vector<rt_value> results(list->arr.size());
+        for (size_t i = 0; i < results.size(); i++) {
+            rt_value item = list->arr[i];
+            if (item.type() != dtype::task) {
+                results[i] = item;
+                continue;
+            }
+
+            rt_task* done = static_cast<rt_task*>(item.obj());
+            if (done->state == task_state::failed) {
+                std::string report = done->failure;
+                loop->outcome_seen(done);
+                loop->fail(task, std::move(report));
+                co_return;
+            }
+
+            loop->outcome_seen(done);
+            results[i] = done->result;
+        }
+
+        loop->settle(task, make_array(std::move(results)));
+    }
+}
+
+event_loop::event_loop() : timer_seq(0), in_flight(0), stopping(false), running(nullptr)
+{
+    // a command that exits before reading all of its input would otherwise
+    // take the whole process down with it
+    static std::once_flag ignored;
+    std::call_once(ignored, []() { signal(SIGPIPE, SIG_IGN); });
+
+    poller = epoll_create1(EPOLL_CLOEXEC);
+    wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (poller < 0 || wakeup < 0) error_util::spit(string_format("can't start the event loop: %s", strerror(errno)));
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeup;
+    epoll_ctl(poller, EPOLL_CTL_ADD, wakeup, &ev);
+}
+
+event_loop::~event_loop()
+{
+    // every await a task is suspended in throws, unwinding the task
+    std::vector<task_run_t*> left(runs.begin(), runs.end());
+    for (task_run_t* run : left) {
+        run->cancelled = true;
+        enter(run);
+        native_stack::finish(run->fiber);
+        delete run->inter;
+    }
+    runs.clear();
+
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        stopping = true;
+    }
+    queued.notify_all();
+    for (std::thread& thread : offload) thread.join();
+
+    // what's left can never be resumed, freeing the frames closes the
+    // descriptors they hold
+    for (std::coroutine_handle<> co : ready) co.destroy();
+    for (; !timers.empty(); timers.pop()) timers.top().co.destroy();
+    for (auto& [fd, w] : watched) {
+        if (w.reader) w.reader.destroy();
+        if (w.writer) w.writer.destroy();
+    }
+    for (job_t* job : jobs) job->co.destroy();
+    for (job_t* job : finished) job->co.destroy();
+    for (rt_heap* obj : gc_heap().held) {
+        if (obj->type != dtype::task) continue;
+        for (std::coroutine_handle<> co : static_cast<rt_task*>(obj)->waiters) co.destroy();
+        static_cast<rt_task*>(obj)->waiters.clear();
+    }
+
+    for (auto& [origin, idle] : spare) {
+        for (interpreter* inter : idle) delete inter;
+    }
+
+    close(poller);
+    close(wakeup);
+}
+
+rt_task* event_loop::track(rt_value work)
+{
+    rt_task* task = make_task(work);
+    gc_heap().hold(task);
+    return task;
+}
+
+rt_task* event_loop::spawn(rt_value func)
+{
+    rt_task* task = track(func);
+    drive(this, task, running != nullptr ? running->origin : running_interpreter);
+    return task;
+}
+
+// waiters go to the back of the ready queue rather than running here, a
+// long chain of tasks awaiting each other never nests
+static void wake(event_loop_t* loop, rt_task* task)
+{
+    for (std::coroutine_handle<> co : task->waiters) loop->ready.push_back(co);
+    task->waiters.clear();
+    task->waiters.shrink_to_fit();
+}
+
+void event_loop::settle(rt_task* task, rt_value result)
+{
+    task->state = task_state::done;
+    task->result = result;
+    task->work = rt_value();
+    gc_heap().barrier(task);
+    gc_heap().release(task);
+    wake(this, task);
+}
+
+// stays held until an await sees it, so it can still be reported at the end
+void event_loop::fail(rt_task* task, std::string report)
+{
+    task->state = task_state::failed;
+    task->failure = std::move(report);
+    task->work = rt_value();
+    unseen.push_back(task);
+    wake(this, task);
+}
+
+void event_loop::outcome_seen(rt_task* task)
+{
+    if (task->observed) return;
+    task->observed = true;
+
+    if (task->state == task_state::failed) {
+        unseen.erase(std::find(unseen.begin(), unseen.end(), task));
+        gc_heap().release(task);
+    }
+}
+
+rt_value event_loop::outcome(rt_task* task)
+{
+    outcome_seen(task);
+    if (task->state == task_state::failed) throw script_error(task->failure);
+    return task->result;
+}
+
+bool event_loop::enter(task_run_t* run)
+{
+    task_run_t* outer = running;
+    running = run;
+    running_t self(run->inter);
+
+    bool done = native_stack::resume(run->fiber);
+    running = outer;
+    return done;
+}
+
+interpreter* event_loop::lend(interpreter* origin)
+{
+    std::vector<interpreter*>& idle = spare[origin];
+    if (!idle.empty()) {
+        interpreter* inter = idle.back();
+        idle.pop_back();
+        return inter;
+    }
+
+    interpreter* inter = new interpreter(origin, task_stack_size());
+    if (origin->machine != nullptr) inter->machine = new vm(inter);
+    return inter;
+}
+
+// a task that failed may have left anything on the stack
+void event_loop::give_back(interpreter* origin, interpreter* inter)
+{
+    inter->stack.top = inter->stack.base;
+    inter->scopes.clear();
+    inter->depth = 0;
+    inter->tail = nullptr;
+    if (inter->machine != nullptr) inter->machine->frames.clear();
+
+    std::vector<interpreter*>& idle = spare[origin];
+    if (idle.size() < SPARE_TASK_INTERPRETERS) idle.push_back(inter);
+    else delete inter;
+}
+
+// the epoll events a watched fd still has someone waiting on
+static uint32_t interest(const event_loop_t::watch_t& w)
+{
+    uint32_t events = 0;
+    if (w.reader) events |= EPOLLIN;
+    if (w.writer) events |= EPOLLOUT;
+    return events;
+}
+
+bool event_loop::step()
+{
+    if (ready.empty() && timers.empty() && watched.empty() && in_flight == 0) return false;
+
+    int timeout = -1;
+    if (!ready.empty()) {
+        timeout = 0;
+    } else if (!timers.empty()) {
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(timers.top().due - std::chrono::steady_clock::now());
+        timeout = std::max<int64_t>(left.count(), 0);
+    }
+
+    epoll_event got[64];
+    int n = epoll_wait(poller, got, 64, timeout);
+
+    for (int i = 0; i < n; i++) {
+        int fd = got[i].data.fd;
+
+        if (fd == wakeup) {
+            uint64_t count;
+            while (read(wakeup, &count, sizeof(count)) > 0) {}
+
+            std::lock_guard<std::mutex> hold(lock);
+            for (job_t* job : finished) ready.push_back(job->co);
+            in_flight -= finished.size();
+            finished.clear();
+            continue;
+        }
+
+        auto at = watched.find(fd);
+        if (at == watched.end()) continue;
+        watch_t& w = at->second;
+
+        // a hang up or an error wakes both sides, the next read or write
+        // says which it was
+        uint32_t events = got[i].events;
+        if (w.reader && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+            ready.push_back(w.reader);
+            w.reader = nullptr;
+        }
+        if (w.writer && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+            ready.push_back(w.writer);
+            w.writer = nullptr;
+        }
+
+        epoll_event ev = {};
+        ev.events = interest(w);
+        ev.data.fd = fd;
+        if (ev.events == 0) {
+            epoll_ctl(poller, EPOLL_CTL_DEL, fd, nullptr);
+            watched.erase(at);
+        } else {
+            epoll_ctl(poller, EPOLL_CTL_MOD, fd, &ev);
+        }
+    }
+
+    auto clock = std::chrono::steady_clock::now();
+    while (!timers.empty() && timers.top().due <= clock) {
+        ready.push_back(timers.top().co);
+        timers.pop();
+    }
+
+    // last, so whoever is turning the loop gets to look before it blocks
+    // again. what gets ready while these run waits for the next turn, so
+    // tasks that keep waking each other can't starve fds and timers
+    std::deque<std::coroutine_handle<>> now;
+    now.swap(ready);
+    for (std::coroutine_handle<> co : now) co.resume();
+
+    return true;
+}
+
+void event_loop::run_until(rt_task* task)
+{
+    while (task->state == task_state::pending) {
+        if (!step()) error_util::spit("await on a task that can never finish");
+    }
+}
+
+void event_loop::run_all()
+{
+    while (step()) {}
+
+    if (!unseen.empty()) {
+        rt_task* first = unseen.front();
+        outcome_seen(first);
+        throw script_error(first->failure);
+    }
+
+    if (!runs.empty()) error_util::spit(string_format("%zu tasks never finished, they were waiting on each other", runs.size()));
+}
+
+void event_loop::watch(int fd, bool write, std::coroutine_handle<> co)
+{
+    auto [at, added] = watched.try_emplace(fd);
+    watch_t& w = at->second;
+    (write ? w.writer : w.reader) = co;
+
+    epoll_event ev = {};
+    ev.events = interest(w);
+    ev.data.fd = fd;
+    epoll_ctl(poller, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+}
+
+void event_loop::submit(job_t* job)
+{
+    if (offload.empty()) {
+        for (size_t i = 0; i < OFFLOAD_THREADS; i++) offload.emplace_back([this]() { work(); });
+    }
+
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        jobs.push_back(job);
+    }
+    in_flight++;
+    queued.notify_one();
+}
+
+// jobs only touch memory of their own, never the isolate's heap
+void event_loop::work()
+{
+    for (;;) {
+        job_t* job;
+        {
+            std::unique_lock<std::mutex> hold(lock);
+            queued.wait(hold, [&]() { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        job->work();
+
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            finished.push_back(job);
+        }
+
+        uint64_t one = 1;
+        ssize_t wrote = write(wakeup, &one, sizeof(one));
+        (void)wrote;
+    }
+}
+
+event_loop_t& current_loop()
+{
+    if (local_young != nullptr) error_util::spit("tasks can't be started or awaited inside a parallel callback");
+
+    isolate_t* iso = current_isolate;
+    if (iso->loop == nullptr) iso->loop = new event_loop_t();
+    return *iso->loop;
+}
+
+rt_value async_start(rt_value func)
+{
+    if (func.type() != dtype::func) error_util::spit(string_format("async expected a function, got %s", dtype_to_str(func.type()).c_str()));
+    return rt_value(current_loop().spawn(func));
+}
+
+rt_value async_await(rt_value val)
+{
+    if (val.type() != dtype::task) return val;
+
+    rt_task* task = static_cast<rt_task*>(val.obj());
+    event_loop_t& loop = current_loop();
+
+    if (task->state == task_state::pending) {
+        task_run_t* run = loop.running;
+
+        if (run == nullptr) {
+            loop.run_until(task);
+        } else {
+            if (task == run->task) error_util::spit("a task can't await itself");
+
+            // the task stays rooted on the caller's stack while this one is
+            // away, the loop puts back what it changed
+            run->waiting = task;
+            interpreter* inter = running_interpreter;
+            native_stack::yield();
+            running_interpreter = inter;
+
+            if (run->cancelled) error_util::spit("task cancelled, the program ended before it finished");
+        }
+    }
+
+    return loop.outcome(task);
+}
+
+rt_value io_sleep(int64_t ms)
+{
+    event_loop_t& loop = current_loop();
+    rt_task* task = loop.track(rt_value());
+    sleep_op(&loop, task, ms);
+    return rt_value(task);
+}
+
+rt_value io_read(std::string path)
+{
+    event_loop_t& loop = current_loop();
+    rt_task* task = loop.track(rt_value());
+    read_op(&loop, task, std::move(path));
+    return rt_value(task);
+}
+
+rt_value io_write(std::string path, std::string text)
+{
+    event_loop_t& loop = current_loop();
+    rt_task* task = loop.track(rt_value());
+    write_op(&loop, task, std::move(path), std::move(text));
+    return rt_value(task);
+}
+
+rt_value io_exec(args_t args, void*, void*)
+{
+    if (args.size() != 1 && args.size() != 2) error_util::spit(string_format("io.exec expected 1 or 2 args, got %zu", args.size()));
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i].type() != dtype::string) error_util::spit(string_format("io.exec expected type string for argument %zu, got %s", i + 1, dtype_to_str(args[i].type()).c_str()));
+    }
+
+    std::string command(args[0].str());
+    std::string input = args.size() == 2 ? std::string(args[1].str()) : "";
+
+    event_loop_t& loop = current_loop();
+    rt_task* task = loop.track(rt_value());
+    exec_op(&loop, task, std::move(command), std::move(input));
+    return rt_value(task);
+}
+
+rt_value io_all(rt_array* tasks)
+{
+    std::vector<rt_value> copy(tasks->arr.size());
+    for (size_t i = 0; i < copy.size(); i++) copy[i] = tasks->arr[i];
+
+    event_loop_t& loop = current_loop();
+    rt_task* task = loop.track(make_array(std::move(copy)));
+    all_op(&loop, task);
+    return rt_value(task);
+}
@@ -0,0 +1,268 @@
+#include "cache.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace cache {
+    static const char MAGIC[4] = {'D', 'U', 'C', '\0'};
+    static const char* ROOT = "root";
+
+    bool& enabled()
+    {
+        static bool on = true;
+        return on;
+    }
+
+    uint64_t hash(const char* data, size_t len)
+    {
+        uint64_t h = len * 0x9e3779b97f4a7c15ull;
+        size_t i = 0;
+
+        for (; i + 8 <= len; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            h = (h ^ word) * 0xff51afd7ed558ccdull;
+            h ^= h >> 32;
+        }
+
+        uint64_t tail = 0;
+        std::memcpy(&tail, data + i, len - i);
+        h = (h ^ tail) * 0xff51afd7ed558ccdull;
+        return h ^ (h >> 29);
+    }
+
+    std::string path_for(const std::string& script)
+    {
+        return script + "c";
+    }
+
+    // maps the whole file read only, unmapped again when it goes out of scope
+    typedef struct mapping {
+        const char* data;
+        size_t size;
+
+        mapping(const std::string& path) : data(nullptr), size(0) {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) return;
+
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* at = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+                if (at != MAP_FAILED) {
+                    data = static_cast<const char*>(at);
+                    size = st.st_size;
+                }
+            }
+
+            close(fd);
+        }
+
+        ~mapping() {
+            if (data != nullptr) munmap(const_cast<char*>(data), size);
+        }
+    } mapping_t;
+
+    ast_node* load(parser_t& p, const std::string& script)
+    {
+        if (!enabled()) return nullptr;
+
+        mapping_t file(path_for(script));
+        if (file.data == nullptr || file.size < sizeof(header_t)) return nullptr;
+
+        header_t head;
+        std::memcpy(&head, file.data, sizeof(header_t));
+
+        if (std::memcmp(head.magic, MAGIC, 4) != 0 || head.version != VERSION) return nullptr;
+        if (head.source_size != p.source.size() || head.source_hash != hash(p.source.data(), p.source.size())) return nullptr;
+
+        size_t payload = static_cast<size_t>(head.node_count) * sizeof(node_t) + static_cast<size_t>(head.child_count) * sizeof(uint32_t) +
+            static_cast<size_t>(head.name_count) * sizeof(span_t);
+        if (file.size != sizeof(header_t) + payload || head.root >= head.node_count) return nullptr;
+        if (head.payload_hash != hash(file.data + sizeof(header_t), payload)) return nullptr;
+
+        const node_t* records = reinterpret_cast<const node_t*>(file.data + sizeof(header_t));
+        const uint32_t* child_table = reinterpret_cast<const uint32_t*>(records + head.node_count);
+        const span_t* name_table = reinterpret_cast<const span_t*>(child_table + head.child_count);
+
+        auto in_source = [&](span_t sp) {
+            return sp.offset <= p.source.size() && sp.length <= p.source.size() - sp.offset;
+        };
+
+        std::vector<atom_t> atoms(head.name_count);
+        for (uint32_t i = 0; i < head.name_count; i++) {
+            if (!in_source(name_table[i])) return nullptr;
+            atoms[i] = symbols().intern(std::string_view(p.source.data() + name_table[i].offset, name_table[i].length));
+        }
+
+        ast_node* nodes = p.nodes.make_array<ast_node>(head.node_count);
+        ast_node** children = p.nodes.make_array<ast_node*>(head.child_count);
+
+        for (uint32_t i = 0; i < head.child_count; i++) {
+            if (child_table[i] >= head.node_count) return nullptr;
+            children[i] = nodes + child_table[i];
+        }
+
+        for (uint32_t i = 0; i < head.node_count; i++) {
+            const node_t& rec = records[i];
+
+            if (rec.type > static_cast<uint8_t>(ast_type::ast_bool) || rec.data_type > static_cast<uint8_t>(last_dtype)) return nullptr;
+            if (rec.children > head.child_count || rec.count > head.child_count - rec.children) return nullptr;
+            if ((rec.value != NONE && rec.value >= head.node_count) || (rec.svalue != NONE && rec.svalue >= head.node_count)) return nullptr;
+            if (rec.name != NONE && rec.name >= head.name_count) return nullptr;
+            if (rec.op > static_cast<uint8_t>(binop::gt)) return nullptr;
+
+            ast_node* node = new (nodes + i) ast_node(static_cast<ast_type_t>(rec.type), position(rec.ln, rec.col));
+            node->data_type = static_cast<dtype_t>(rec.data_type);
+            node->op = static_cast<binop_t>(rec.op);
+            node->value = rec.value != NONE ? nodes + rec.value : nullptr;
+            node->svalue = rec.svalue != NONE ? nodes + rec.svalue : nullptr;
+            node->children.items = rec.count > 0 ? children + rec.children : nullptr;
+            node->children.count = rec.count;
+
+            if (node->type == ast_type::ast_num_expr) {
+                if (node->data_type == dtype::integer) node->integer = rec.integer;
+                else node->number = rec.number;
+                continue;
+            }
+
+            if (rec.symbol.offset == NONE) {
+                node->symbol = ROOT;
+            } else {
+                if (!in_source(rec.symbol)) return nullptr;
+                node->symbol = std::string_view(p.source.data() + rec.symbol.offset, rec.symbol.length);
+            }
+
+            if (rec.name != NONE) node->atom = atoms[rec.name];
+        }
+
+        return nodes + head.root;
+    }
+
+    // flattens the tree in depth first order
+    typedef struct writer {
+        parser_t& p;
+        std::vector<node_t> records;
+        std::vector<uint32_t> child_table;
+        std::vector<span_t> name_table;
+        std::unordered_map<ast_node*, uint32_t> seen;
+        std::unordered_map<atom_t, uint32_t> names;
+
+        writer(parser_t& p) : p(p) {};
+
+        uint32_t add(ast_node* node) {
+            if (node == nullptr) return NONE;
+
+            auto it = seen.find(node);
+            if (it != seen.end()) return it->second;
+
+            uint32_t at = records.size();
+            seen[node] = at;
+            records.emplace_back();
+
+            node_t rec;
+            std::memset(&rec, 0, sizeof(node_t));
+            rec.type = static_cast<uint8_t>(node->type);
+            rec.data_type = static_cast<uint8_t>(node->data_type);
+            rec.op = static_cast<uint8_t>(node->op);
+            rec.ln = node->pos.ln;
+            rec.col = node->pos.col;
+
+            rec.name = NONE;
+            if (node->atom != 0 && symbols().name(node->atom) == node->symbol) rec.name = name(node);
+
+            if (node->type == ast_type::ast_num_expr) {
+                if (node->data_type == dtype::integer) rec.integer = node->integer;
+                else rec.number = node->number;
+            } else if (node->symbol.empty()) {
+                rec.symbol.offset = 0;
+                rec.symbol.length = 0;
+            } else if (node->symbol.data() >= p.source.data() && node->symbol.data() + node->symbol.size() <= p.source.data() + p.source.size()) {
+                rec.symbol.offset = node->symbol.data() - p.source.data();
+                rec.symbol.length = node->symbol.size();
+            } else {
+                rec.symbol.offset = NONE;
+            }
+
+            // children first, so their indices are known when the list is
+            // laid out contiguously in the table
+            std::vector<uint32_t> kids;
+            for (ast_node* child : node->children) kids.push_back(add(child));
+
+            rec.children = child_table.size();
+            rec.count = kids.size();
+            child_table.insert(child_table.end(), kids.begin(), kids.end());
+
+            rec.value = add(node->value);
+            rec.svalue = add(node->svalue);
+
+            records[at] = rec;
+            return at;
+        }
+        // atoms only mean something inside one process, so the file keeps
+        // the names and they are interned again on load
+        uint32_t name(ast_node* node) {
+            auto it = names.find(node->atom);
+            if (it != names.end()) return it->second;
+
+            uint32_t at = name_table.size();
+            name_table.push_back({static_cast<uint32_t>(node->symbol.data() - p.source.data()), static_cast<uint32_t>(node->symbol.size())});
+            names[node->atom] = at;
+            return at;
+        }
+    } writer_t;
+
+    bool store(parser_t& p, ast_node* root, const std::string& script)
+    {
+        if (!enabled()) return false;
+
+        writer_t w(p);
+        uint32_t at = w.add(root);
+
+        header_t head;
+        std::memset(&head, 0, sizeof(header_t));
+        std::memcpy(head.magic, MAGIC, 4);
+        head.version = VERSION;
+        head.source_hash = hash(p.source.data(), p.source.size());
+        head.source_size = p.source.size();
+        head.node_count = w.records.size();
+        head.child_count = w.child_table.size();
+        head.name_count = w.name_table.size();
+        head.root = at;
+
+        size_t nodes_size = w.records.size() * sizeof(node_t);
+        size_t children_size = w.child_table.size() * sizeof(uint32_t);
+        size_t names_size = w.name_table.size() * sizeof(span_t);
+
+        std::string payload(nodes_size + children_size + names_size, '\0');
+        std::memcpy(payload.data(), w.records.data(), nodes_size);
+        std::memcpy(payload.data() + nodes_size, w.child_table.data(), children_size);
+        std::memcpy(payload.data() + nodes_size + children_size, w.name_table.data(), names_size);
+        head.payload_hash = hash(payload.data(), payload.size());
+
+        // written next to the real file and renamed over it, so a reader
+        // never sees half a cache. isolates storing the same script at once
+        // each write a file of their own
+        std::string path = path_for(script);
+        std::string tmp = path + "." + std::to_string(getpid()) + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+
+        FILE* file = fopen(tmp.c_str(), "wb");
+        if (file == nullptr) return false;
+
+        bool ok = fwrite(&head, sizeof(header_t), 1, file) == 1 && fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+        ok = fclose(file) == 0 && ok;
+
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+            remove(tmp.c_str());
+            return false;
+        }
+
+        return true;
+    }
+}
@@ -0,0 +1,230 @@
+#include "channel.h"
+#include "isolate.h"
+#include "shape.h"
+#include "symbol.h"
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+bool channel::send(message_t& msg)
+{
+    // waited before, and woken because nothing could ever go on
+    bool recheck = false, stuck = false;
+
+    for (;;) {
+        if (closed.load()) return false;
+
+        uint32_t seen = taken.load();
+        if (queue.push(msg)) break;
+
+        if (stuck) error_util::spit("channel.send on a full channel that no running script receives from");
+
+        // a receiver that took one after seen was read either shows up in
+        // taken here or sees senders_parked and wakes us
+        senders_parked.fetch_add(1);
+        if (taken.load() == seen && !closed.load()) {
+            parked_t park(recheck);
+            taken.wait(seen);
+            recheck = true;
+            stuck = park.deadlocked();
+        }
+        senders_parked.fetch_sub(1);
+    }
+
+    sent.fetch_add(1);
+    if (receivers_parked.load() > 0) sent.notify_one();
+    return true;
+}
+
+bool channel::try_recv(message_t& out)
+{
+    if (!queue.pop(out)) return false;
+
+    taken.fetch_add(1);
+    if (senders_parked.load() > 0) taken.notify_one();
+    return true;
+}
+
+bool channel::recv(message_t& out)
+{
+    bool recheck = false, stuck = false;
+
+    for (;;) {
+        uint32_t seen = sent.load();
+        if (try_recv(out)) return true;
+
+        // everything sent before the close is in the queue by now
+        if (closed.load()) return try_recv(out);
+
+        if (stuck) error_util::spit("channel.recv on an empty channel that no running script sends to");
+
+        receivers_parked.fetch_add(1);
+        if (sent.load() == seen && !closed.load()) {
+            parked_t park(recheck);
+            sent.wait(seen);
+            recheck = true;
+            stuck = park.deadlocked();
+        }
+        receivers_parked.fetch_sub(1);
+    }
+}
+
+void channel::close()
+{
+    closed.store(true);
+    wake();
+}
+
+void channel::wake()
+{
+    sent.fetch_add(1);
+    sent.notify_all();
+    taken.fetch_add(1);
+    taken.notify_all();
+}
+
+// a name stands for one channel for the life of the process, so named
+// holds on to every channel ever opened. messages sent before anyone else
+// opened the name are still there when they do
+static std::mutex lock;
+static std::unordered_map<std::string, std::shared_ptr<channel_t>> named;
+
+std::shared_ptr<channel_t> open_channel(const std::string& name, size_t capacity)
+{
+    std::shared_ptr<channel_t> chan;
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        std::shared_ptr<channel_t>& slot = named[name];
+        if (slot == nullptr) slot = std::make_shared<channel_t>(capacity);
+        chan = slot;
+    }
+
+    if (current_isolate != nullptr) current_isolate->opened(chan);
+    return chan;
+}
+
+void wake_channels()
+{
+    std::lock_guard<std::mutex> hold(lock);
+    for (auto& [name, chan] : named) chan->wake();
+}
+
+// arrays and objects on the way down from the value being sent, one of
+// them showing up again means the value contains itself
+static void pack_into(rt_value val, message_t& out, std::vector<rt_heap*>& path)
+{
+    out.type = val.type();
+
+    switch (out.type) {
+        case dtype::nil:
+            return;
+
+        case dtype::boolean:
+            out.boolean = val.boolean();
+            return;
+
+        case dtype::integer:
+            out.integer = val.integer();
+            return;
+
+        case dtype::floating:
+            out.number = val.num();
+            return;
+
+        case dtype::string:
+            out.text = std::string(val.str());
+            return;
+
+        case dtype::i64array:
+            out.ints = static_cast<rt_i64array*>(val.obj())->data;
+            return;
+
+        case dtype::f64array:
+            out.floats = static_cast<rt_f64array*>(val.obj())->data;
+            return;
+
+        case dtype::channel:
+            out.chan = static_cast<rt_channel*>(val.obj())->chan;
+            return;
+
+        case dtype::array:
+        case dtype::object: {
+            if (std::find(path.begin(), path.end(), val.obj()) != path.end()) error_util::spit("channel.send of a value that contains itself");
+            path.push_back(val.obj());
+
+            if (out.type == dtype::array) {
+                rt_array* arr = static_cast<rt_array*>(val.obj());
+                out.items.resize(arr->arr.size());
+                for (size_t i = 0; i < arr->arr.size(); i++) pack_into(arr->arr[i], out.items[i], path);
+            } else {
+                rt_object* obj = val.object();
+                out.items.resize(obj->slots.size());
+                for (size_t i = 0; i < obj->slots.size(); i++) {
+                    out.keys.push_back(symbols().name(obj->shape->keys[i]));
+                    pack_into(obj->slots[i], out.items[i], path);
+                }
+            }
+
+            path.pop_back();
+            return;
+        }
+
+        default:
+            error_util::spit(string_format("channel.send can't send a %s", dtype_to_str(out.type).c_str()));
+    }
+}
+
+message_t pack(rt_value val)
+{
+    message_t msg;
+    std::vector<rt_heap*> path;
+    pack_into(val, msg, path);
+    return msg;
+}
+
+// nothing collects while a native runs, what's built so far needs no
+// rooting
+rt_value unpack(message_t& msg)
+{
+    switch (msg.type) {
+        case dtype::boolean:
+            return rt_value(msg.boolean);
+
+        case dtype::integer:
+            return make_int(msg.integer);
+
+        case dtype::floating:
+            return rt_value(msg.number);
+
+        case dtype::string:
+            return make_string(std::move(msg.text));
+
+        case dtype::i64array:
+            return make_i64array(std::move(msg.ints));
+
+        case dtype::f64array:
+            return make_f64array(std::move(msg.floats));
+
+        case dtype::channel:
+            return make_channel(std::move(msg.chan));
+
+        case dtype::array: {
+            std::vector<rt_value> items(msg.items.size());
+            for (size_t i = 0; i < items.size(); i++) items[i] = unpack(msg.items[i]);
+            return make_array(std::move(items));
+        }
+
+        case dtype::object: {
+            shape_t* shape = shapes().root();
+            std::vector<rt_value> slots(msg.items.size());
+            for (size_t i = 0; i < slots.size(); i++) {
+                shape = shape->add(symbols().intern(msg.keys[i]));
+                slots[i] = unpack(msg.items[i]);
+            }
+            return make_object(shape, std::move(slots));
+        }
+
+        default:
+            return rt_value();
+    }
+}
@@ -0,0 +1,329 @@
+#include "compiler.h"
+#include "ast.h"
+#include "bytecode.h"
+#include "runtime.h"
+#include "types.h"
+#include <error.h>
+#include <string>
+
+chunk_t* compiler::compile(ast_node* root)
+{
+    return compile_chunk(root, std::string(root->symbol), nullptr);
+}
+
+chunk_t* compiler::compile_chunk(ast_node* body, std::string name, ast_node* fn)
+{
+    chunk_t* code = new chunk(name);
+    chunks.push_back(code);
+    chunk_t* enclosing = current;
+    ast_node* enclosing_fn = function;
+    std::map<std::string, uint32_t, std::less<>> enclosing_strings;
+    enclosing_strings.swap(strings);
+    current = code;
+    function = fn;
+
+    compile_body(body);
+    emit(opcode::op_nil, 0, body->pos);
+    emit(opcode::op_return, 0, body->pos);
+
+    current = enclosing;
+    function = enclosing_fn;
+    strings.swap(enclosing_strings);
+
+    return code;
+}
+
+uint32_t compiler::add_constant(rt_value value, position_t pos)
+{
+    if (current->constants.size() > INSTR_ARG_MAX) error("too many constants in one chunk", pos, source).spit();
+    current->constants.push_back(value);
+    return current->constants.size() - 1;
+}
+
+uint32_t compiler::add_string(std::string_view str, position_t pos)
+{
+    auto it = strings.find(str);
+    if (it != strings.end()) return it->second;
+
+    uint32_t idx = add_constant(gc_heap().pin(make_string(std::string(str))), pos);
+    strings.emplace(str, idx);
+    return idx;
+}
+
+size_t compiler::emit(opcode_t op, uint32_t arg, position_t pos)
+{
+    return current->emit(op, arg, pos);
+}
+
+// the operand is the link's inline cache, which also knows the name
+void compiler::emit_member(ast_node* link)
+{
+    if (link->site > INSTR_ARG_MAX) error("too many member reads", link->pos, source).spit();
+    emit(opcode::op_get_member, link->site, link->pos);
+}
+
+void compiler::compile_stmt(ast_node* node)
+{
+    switch (node->type) {
+        case ast_type::ast_assign:
+            compile_assign(node);
+            break;
+
+        case ast_type::ast_if:
+            compile_if(node);
+            break;
+
+        case ast_type::ast_while:
+            compile_while(node);
+            break;
+
+        case ast_type::ast_import:
+            compile_import(node);
+            break;
+
+        case ast_type::ast_return:
+            compile_return(node);
+            break;
+
+        case ast_type::ast_noop:
+            break;
+
+        default:
+            compile_expr(node);
+            emit(opcode::op_pop, 0, node->pos);
+    }
+}
+
+void compiler::compile_body(ast_node* body)
+{
+    for (ast_node* elem : body->children) {
+        compile_stmt(elem);
+    }
+}
+
+void compiler::compile_expr(ast_node* node)
+{
+    if (node == nullptr) {
+        emit(opcode::op_nil, 0, position());
+        return;
+    }
+
+    switch (node->type) {
+        case ast_type::ast_identifier:
+            compile_load(node);
+            break;
+
+        case ast_type::ast_num_expr:
+            emit(opcode::op_const, add_constant(node->data_type == dtype::integer ? gc_heap().pin(make_int(node->integer)) : rt_value(node->number), node->pos), node->pos);
+            break;
+
+        case ast_type::ast_string_expr:
+            emit(opcode::op_const, add_string(node->symbol, node->pos), node->pos);
+            break;
+
+        case ast_type::ast_function:
+            emit(opcode::op_closure, add_constant(compile_function(node), node->pos), node->pos);
+            break;
+
+        case ast_type::ast_call:
+            compile_call(node);
+            break;
+
+        case ast_type::ast_member:
+            compile_member(node);
+            break;
+
+        case ast_type::ast_arrindex:
+            compile_load(node);
+            compile_expr(node->value);
+            emit(opcode::op_index, 0, node->pos);
+            break;
+
+        case ast_type::ast_array:
+            for (ast_node* elem : node->children) compile_expr(elem);
+            emit(opcode::op_array, node->children.size(), node->pos);
+            break;
+
+        case ast_type::ast_object:
+            for (ast_node* elem : node->children) compile_expr(elem->value);
+            emit(opcode::op_object, node->children.size(), node->pos);
+            current->emit_word(node->site, node->pos);
+            break;
+
+        case ast_type::ast_binop:
+            compile_binary(node);
+            break;
+
+        case ast_type::ast_compound:
+            compile_body(node);
+            emit(opcode::op_nil, 0, node->pos);
+            break;
+
+        case ast_type::ast_return:
+            compile_return(node);
+            break;
+
+        // statements used as expressions evaluate to nil, same as the tree walker
+        case ast_type::ast_assign:
+        case ast_type::ast_if:
+        case ast_type::ast_while:
+        case ast_type::ast_import:
+            compile_stmt(node);
+            emit(opcode::op_nil, 0, node->pos);
+            break;
+
+        default:
+            emit(opcode::op_nil, 0, node->pos);
+    }
+}
+
+void compiler::compile_load(ast_node* node)
+{
+    size_t at;
+
+    if (node->depth == 0) {
+        at = emit(opcode::op_get_local, node->slot, node->pos);
+    } else {
+        // frames of functions nothing can capture are never materialised,
+        // the vm starts walking from the callee's closure instead
+        int depth = function->captured ? node->depth : node->depth - 1;
+        at = emit(opcode::op_get_env, depth, node->pos);
+        current->emit_word(node->slot, node->pos);
+    }
+
+    current->symbols[at] = node->symbol;
+}
+
+void compiler::compile_assign(ast_node* node)
+{
+    compile_expr(node->value);
+    if (node->data_type != dtype::any) {
+        size_t at = emit(opcode::op_check_type, static_cast<uint32_t>(node->data_type), node->pos);
+        current->symbols[at] = node->symbol;
+    }
+    emit(opcode::op_set_local, node->slot, node->pos);
+}
+
+void compiler::compile_call(ast_node* node, opcode_t op)
+{
+    compile_load(node);
+
+    for (ast_node* arg : node->value->children) {
+        compile_expr(arg);
+    }
+
+    emit(op, node->value->children.size(), node->pos);
+}
+
+// inside a function, return f(...) reuses the caller's frame
+void compiler::compile_return(ast_node* node)
+{
+    if (function != nullptr && node->value != nullptr && node->value->type == ast_type::ast_call) {
+        compile_call(node->value, opcode::op_tail_call);
+    } else {
+        compile_expr(node->value);
+    }
+
+    emit(opcode::op_return, 0, node->pos);
+}
+
+void compiler::compile_member(ast_node* node)
+{
+    compile_load(node);
+
+    ast_node* current_node = node->value;
+    while (current_node->type == ast_type::ast_member) {
+        emit_member(current_node);
+        current_node = current_node->value;
+    }
+
+    emit_member(current_node);
+
+    if (current_node->type == ast_type::ast_call) {
+        for (ast_node* arg : current_node->value->children) {
+            compile_expr(arg);
+        }
+
+        emit(opcode::op_call, current_node->value->children.size(), current_node->pos);
+    }
+
+    if (current_node->type == ast_type::ast_arrindex) {
+        compile_expr(current_node->value);
+        emit(opcode::op_index, 0, current_node->pos);
+    }
+}
+
+inline opcode_t binop_to_opcode(binop_t op) {
+    switch (op) {
+        case binop::add: return opcode::op_add;
+        case binop::sub: return opcode::op_sub;
+        case binop::mul: return opcode::op_mul;
+        case binop::div: return opcode::op_div;
+        case binop::eq: return opcode::op_eq;
+        case binop::ge: return opcode::op_ge;
+        case binop::le: return opcode::op_le;
+        case binop::lt: return opcode::op_lt;
+        case binop::gt: return opcode::op_gt;
+    }
+    return opcode::op_gt;
+}
+
+static bool is_local(ast_node* node)
+{
+    return node->type == ast_type::ast_identifier && node->depth == 0;
+}
+
+// a local against a local or a number is one instruction that reads both
+// where they are, the operand word after it carries the right side's
+// position and name for errors
+void compiler::compile_binary(ast_node* node)
+{
+    ast_node* left = node->value;
+    ast_node* right = node->svalue;
+    bool constant = right != nullptr && right->type == ast_type::ast_num_expr;
+
+    if (left != nullptr && right != nullptr && is_local(left) && (is_local(right) || constant) && static_cast<uint32_t>(left->slot) <= (INSTR_ARG_MAX >> BINARY_SLOT_SHIFT)) {
+        uint32_t operand = constant ? add_constant(right->data_type == dtype::integer ? gc_heap().pin(make_int(right->integer)) : rt_value(right->number), right->pos) : right->slot;
+        size_t at = emit(opcode::op_binary_local, binary_local(node->op, constant, left->slot), node->pos);
+        current->emit_word(operand, right->pos);
+        current->symbols[at] = left->symbol;
+        if (!constant) current->symbols[at + 1] = right->symbol;
+        return;
+    }
+
+    compile_expr(left);
+    compile_expr(right);
+    emit(binop_to_opcode(node->op), 0, node->pos);
+}
+
+void compiler::compile_if(ast_node* node)
+{
+    compile_expr(node->svalue);
+    size_t skip = emit(opcode::op_jump_if_false, 0, node->pos);
+    compile_body(node->value);
+    current->patch(skip, current->code.size());
+}
+
+void compiler::compile_while(ast_node* node)
+{
+    size_t start = current->code.size();
+    compile_expr(node->svalue);
+    size_t exit = emit(opcode::op_jump_if_false, 0, node->pos);
+    compile_body(node->value);
+    emit(opcode::op_jump, start, node->pos);
+    current->patch(exit, current->code.size());
+}
+
+void compiler::compile_import(ast_node* node)
+{
+    emit(opcode::op_import, add_string(node->value->symbol, node->value->pos), node->pos);
+    emit(opcode::op_set_local, node->svalue->slot, node->pos);
+}
+
+rt_value compiler::compile_function(ast_node* node)
+{
+    rt_value fn = gc_heap().pin(make_function(node->value, node));
+    fn.fn()->chunk = compile_chunk(node->value, "function", node);
+
+    return fn;
+}
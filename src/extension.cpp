@@ -0,0 +1,188 @@
+#include "du_native.h"
+#include "module.h"
+#include "runtime.h"
+#include <dlfcn.h>
+#include <filesystem>
+#include <string>
+
+// the host side of du_native.h. du_value carries an rt_value's bits as they
+// are, so the args span is handed to natives without converting anything
+static_assert(sizeof(du_value) == sizeof(rt_value));
+
+struct du_module {
+    module_t* mod;
+    rt_value object;
+};
+
+static du_value wrap(rt_value v)
+{
+    return du_value{v.bits};
+}
+
+static rt_value unwrap(du_value v)
+{
+    rt_value val;
+    val.bits = v.bits;
+    return val;
+}
+
+static dtype_t to_dtype(du_type t)
+{
+    switch (t) {
+        case DU_NIL: return dtype::nil;
+        case DU_BOOL: return dtype::boolean;
+        case DU_INT: return dtype::integer;
+        case DU_FLOAT: return dtype::floating;
+        case DU_STRING: return dtype::string;
+        case DU_ARRAY: return dtype::array;
+        case DU_OBJECT: return dtype::object;
+        case DU_FUNCTION: return dtype::func;
+        default: return dtype::any;
+    }
+}
+
+static du_type to_du_type(dtype_t t)
+{
+    switch (t) {
+        case dtype::nil: return DU_NIL;
+        case dtype::boolean: return DU_BOOL;
+        case dtype::integer: return DU_INT;
+        case dtype::floating: return DU_FLOAT;
+        case dtype::string: return DU_STRING;
+        case dtype::array: return DU_ARRAY;
+        case dtype::object: return DU_OBJECT;
+        case dtype::func:
+        case dtype::cfunction: return DU_FUNCTION;
+        default: return DU_ANY;
+    }
+}
+
+// set by api->fail, raised once the native returns
+static thread_local std::string failure;
+static thread_local bool failed = false;
+
+extern const du_api host_api;
+
+static rt_value call_foreign(args_t args, void*, void* data)
+{
+    foreign_t* fn = static_cast<foreign_t*>(data);
+    du_value result = fn->fn(&host_api, reinterpret_cast<const du_value*>(args.data()), args.size());
+
+    if (failed) {
+        failed = false;
+        error_util::spit(fn->name + ": " + failure);
+    }
+
+    return unwrap(result);
+}
+
+static void api_define(du_module* m, const char* name, du_native_fn fn, int arity, const du_type* types)
+{
+    // named after the library, "libfnv.so" defines fnv.hash
+    module_t* mod = m->mod;
+    std::string prefix = std::filesystem::path(mod->path).stem().string();
+    if (prefix.rfind("lib", 0) == 0) prefix = prefix.substr(3);
+    mod->foreigns.push_back(foreign_t{fn, prefix + "." + name});
+    foreign_t* at = &mod->foreigns.back();
+
+    std::vector<dtype_t> params;
+    for (int i = 0; i < arity; i++) params.push_back(types != nullptr ? to_dtype(types[i]) : dtype::any);
+
+    rt_value native = rt_value(gc_heap().track(new rt_cfunction(call_foreign, at->name.c_str(), arity, std::move(params), at), sizeof(rt_cfunction)));
+    m->object.object()->set(symbols().intern(name), native);
+}
+
+static du_type api_type_of(du_value v) { return to_du_type(unwrap(v).type()); }
+
+static du_value api_nil() { return wrap(rt_value()); }
+static du_value api_from_bool(int b) { return wrap(rt_value(b != 0)); }
+static du_value api_from_int(int64_t i) { return wrap(make_int(i)); }
+static du_value api_from_float(double d) { return wrap(rt_value(d)); }
+static du_value api_from_string(const char* data, size_t len) { return wrap(make_string(std::string(data, len))); }
+static du_value api_new_array() { return wrap(make_array({})); }
+
+static int api_to_bool(du_value v) { return unwrap(v).truthy(); }
+static int64_t api_to_int(du_value v) { return unwrap(v).integer(); }
+static double api_to_float(du_value v) { return unwrap(v).to_double(); }
+
+static const char* api_string_data(du_value v, size_t* len)
+{
+    std::string& str = unwrap(v).str();
+    if (len != nullptr) *len = str.size();
+    return str.data();
+}
+
+static size_t api_array_length(du_value v) { return unwrap(v).arr().size(); }
+
+static du_value api_array_get(du_value v, size_t i)
+{
+    ring<rt_value>& arr = unwrap(v).arr();
+    return i < arr.size() ? wrap(arr[i]) : wrap(rt_value());
+}
+
+static void api_array_push(du_value arr, du_value elem)
+{
+    rt_value val = unwrap(arr);
+    val.arr().push_back(unwrap(elem));
+    gc_heap().grew(val.obj());
+    gc_heap().barrier(val.obj());
+}
+
+static du_value api_fail(const char* message)
+{
+    failure = message;
+    failed = true;
+    return wrap(rt_value());
+}
+
+const du_api host_api = {
+    DU_NATIVE_ABI_VERSION,
+    sizeof(du_api),
+    api_define,
+    api_type_of,
+    api_nil,
+    api_from_bool,
+    api_from_int,
+    api_from_float,
+    api_from_string,
+    api_new_array,
+    api_to_bool,
+    api_to_int,
+    api_to_float,
+    api_string_data,
+    api_array_length,
+    api_array_get,
+    api_array_push,
+    api_fail,
+};
+
+bool is_extension(const std::string& path)
+{
+    return path.size() > 3 && path.compare(path.size() - 3, 3, ".so") == 0;
+}
+
+std::string load_extension(module_t* mod, const std::string& path)
+{
+    // a bare name that isn't in the working directory goes through the
+    // usual library search path
+    bool local = path.find('/') != std::string::npos || std::filesystem::exists(path);
+    void* handle = dlopen(local ? mod->path.c_str() : path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) return std::string("cannot load extension: ") + dlerror();
+
+    auto init = reinterpret_cast<du_module_init_fn>(dlsym(handle, DU_MODULE_INIT));
+    if (init == nullptr) {
+        dlclose(handle);
+        return "extension " + path + " has no " DU_MODULE_INIT;
+    }
+
+    mod->handle = handle;
+    du_module m{mod, make_object(shapes().root(), {})};
+
+    uint32_t version = init(&host_api, &m);
+    if (version >> 16 != DU_NATIVE_ABI_MAJOR) {
+        return string_format("extension %s was built for native abi %u.%u, this is %u.%u", path.c_str(), version >> 16, version & 0xffff, DU_NATIVE_ABI_MAJOR, DU_NATIVE_ABI_MINOR);
+    }
+
+    mod->value = m.object;
+    return "";
+}
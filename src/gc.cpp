@@ -0,0 +1,329 @@
+#include "gc.h"
+#include "env.h"
+#include "interpreter.h"
+#include "runtime.h"
+#include "vm.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+size_t object_size(rt_heap* obj)
+{
+    switch (obj->type) {
+        case dtype::integer:
+            return sizeof(rt_int);
+
+        case dtype::string:
+            return sizeof(rt_string) + static_cast<rt_string*>(obj)->str.capacity();
+
+        case dtype::array:
+            return sizeof(rt_array) + static_cast<rt_array*>(obj)->arr.capacity() * sizeof(rt_value);
+
+        case dtype::object:
+            // members sit in the slot vector, the shape is shared and not counted
+            return sizeof(rt_object) + static_cast<rt_object*>(obj)->slots.capacity() * sizeof(rt_value);
+
+        case dtype::i64array:
+            return sizeof(rt_i64array) + static_cast<rt_i64array*>(obj)->data.capacity() * sizeof(int64_t);
+
+        case dtype::f64array:
+            return sizeof(rt_f64array) + static_cast<rt_f64array*>(obj)->data.capacity() * sizeof(double);
+
+        case dtype::func:
+            return sizeof(rt_function);
+
+        case dtype::cfunction:
+            return sizeof(rt_cfunction);
+
+        case dtype::iter:
+            return sizeof(rt_iter);
+
+        case dtype::channel:
+            return sizeof(rt_channel);
+
+        case dtype::task:
+            return sizeof(rt_task) + static_cast<rt_task*>(obj)->failure.capacity();
+
+        case dtype::env:
+            return sizeof(environment) + static_cast<environment*>(obj)->storage.capacity() * sizeof(rt_value);
+
+        default:
+            return sizeof(rt_heap);
+    }
+}
+
+void free_object(rt_heap* obj)
+{
+    switch (obj->type) {
+        case dtype::integer: delete static_cast<rt_int*>(obj); break;
+        case dtype::string: delete static_cast<rt_string*>(obj); break;
+        case dtype::array: delete static_cast<rt_array*>(obj); break;
+        case dtype::object: delete static_cast<rt_object*>(obj); break;
+        case dtype::i64array: delete static_cast<rt_i64array*>(obj); break;
+        case dtype::f64array: delete static_cast<rt_f64array*>(obj); break;
+        case dtype::func: delete static_cast<rt_function*>(obj); break;
+        case dtype::cfunction: delete static_cast<rt_cfunction*>(obj); break;
+        case dtype::iter: delete static_cast<rt_iter*>(obj); break;
+        case dtype::channel: delete static_cast<rt_channel*>(obj); break;
+        case dtype::task: delete static_cast<rt_task*>(obj); break;
+        case dtype::env: delete static_cast<environment*>(obj); break;
+        default: delete obj; break;
+    }
+}
+
+gc::~gc()
+{
+    for (rt_heap* list : {young, old}) {
+        while (list != nullptr) {
+            rt_heap* next = list->next;
+            free_object(list);
+            list = next;
+        }
+    }
+}
+
+void gc::add_root(interpreter* inter)
+{
+    roots.push_back(inter);
+}
+
+void gc::remove_root(interpreter* inter)
+{
+    roots.erase(std::remove(roots.begin(), roots.end(), inter), roots.end());
+}
+
+void gc::configure(size_t nursery, size_t old_size, double grow)
+{
+    if (nursery > 0) nursery_size = nursery;
+    if (old_size > 0) old_min = old_threshold = old_size;
+    if (grow > 1.0) growth = grow;
+}
+
+void gc::adopt(local_heap_t& local)
+{
+    while (local.young != nullptr) {
+        rt_heap* next = local.young->next;
+        local.young->next = young;
+        young = local.young;
+        local.young = next;
+    }
+
+    young_bytes += local.bytes;
+    old_bytes += local.old_bytes;
+    stats.allocated_objects += local.objects;
+    stats.allocated_bytes += local.bytes;
+    remembered.insert(remembered.end(), local.remembered.begin(), local.remembered.end());
+    local = local_heap_t();
+}
+
+void gc::grew(rt_heap* obj)
+{
+    size_t now = object_size(obj);
+    if (now <= obj->bytes) return;
+
+    size_t delta = now - obj->bytes;
+    obj->bytes = now;
+
+    if (local_young != nullptr) {
+        local_young->bytes += delta;
+        if (obj->old) local_young->old_bytes += delta;
+        return;
+    }
+
+    young_bytes += delta;
+    stats.allocated_bytes += delta;
+    if (obj->old) old_bytes += delta;
+}
+
+// brings a survivor's recorded size up to date with what it takes now, for
+// the changes no grew call reported. what sweep frees is always what was
+// recorded, so freed bytes never run ahead of allocated ones
+void gc::settle(rt_heap* obj)
+{
+    size_t now = object_size(obj);
+    if (now > obj->bytes) stats.allocated_bytes += now - obj->bytes;
+    else stats.freed_bytes += obj->bytes - now;
+    obj->bytes = now;
+}
+
+void gc::collect()
+{
+    if (local_young != nullptr) return;
+    minor();
+    if (old_bytes >= old_threshold) major();
+}
+
+void gc::minor()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    mark_roots(false);
+    for (rt_heap* obj : remembered) gray.push_back(obj);
+    trace(false);
+
+    for (rt_heap* obj : remembered) obj->remembered = false;
+    remembered.clear();
+
+    // every young survivor is promoted, so no old to young edges are left
+    // behind and the remembered set can start empty
+    size_t survivors = 0;
+    rt_heap* promoted = sweep(young, true, survivors);
+    young = nullptr;
+    young_bytes = 0;
+
+    while (promoted != nullptr) {
+        rt_heap* next = promoted->next;
+        promoted->next = old;
+        old = promoted;
+        promoted = next;
+    }
+
+    stats.promoted_objects += survivors;
+    stats.minor_collections++;
+    stats.minor_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    stats.peak_bytes = std::max(stats.peak_bytes, old_bytes);
+}
+
+void gc::major()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (rt_heap* obj : remembered) obj->remembered = false;
+    remembered.clear();
+
+    mark_roots(true);
+    trace(true);
+
+    size_t survivors = 0;
+    young = sweep(young, false, survivors);
+    old_bytes = 0;
+    old = sweep(old, false, survivors);
+
+    old_threshold = std::max(old_min, static_cast<size_t>(old_bytes * growth));
+
+    stats.major_collections++;
+    stats.major_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void gc::mark_roots(bool full)
+{
+    for (rt_heap* obj : pinned) mark_object(obj, full);
+    for (rt_heap* obj : held) mark_object(obj, full);
+
+    for (interpreter* inter : roots) {
+        for (rt_value* at = inter->stack.base; at < inter->stack.top; at++) mark_value(*at, full);
+        if (inter->globals != nullptr) mark_object(inter->globals, full);
+        for (environment_t* env : inter->scopes) mark_object(env, full);
+
+        if (inter->machine != nullptr) {
+            for (call_frame_t& frame : inter->machine->frames) {
+                mark_value(frame.func, full);
+                if (frame.env != nullptr) mark_object(frame.env, full);
+            }
+        }
+    }
+}
+
+void gc::mark_value(rt_value val, bool full)
+{
+    if (val.is_obj()) mark_object(val.obj(), full);
+}
+
+void gc::mark_object(rt_heap* obj, bool full)
+{
+    // a minor collection treats the whole old generation as live
+    if (obj->marked || (obj->old && !full)) return;
+    obj->marked = true;
+    gray.push_back(obj);
+}
+
+void gc::trace(bool full)
+{
+    while (!gray.empty()) {
+        rt_heap* obj = gray.back();
+        gray.pop_back();
+
+        switch (obj->type) {
+            case dtype::string: {
+                rt_string* str = static_cast<rt_string*>(obj);
+                if (!str->flat()) {
+                    mark_object(str->left, full);
+                    mark_object(str->right, full);
+                }
+                break;
+            }
+
+            case dtype::array:
+                for (rt_value val : static_cast<rt_array*>(obj)->arr) mark_value(val, full);
+                break;
+
+            case dtype::object:
+                for (rt_value val : static_cast<rt_object*>(obj)->slots) mark_value(val, full);
+                break;
+
+            case dtype::func: {
+                rt_function* fn = static_cast<rt_function*>(obj);
+                if (fn->closure != nullptr) mark_object(fn->closure, full);
+                break;
+            }
+
+            case dtype::iter: {
+                rt_iter* it = static_cast<rt_iter*>(obj);
+                mark_value(it->source, full);
+                mark_value(it->func, full);
+                break;
+            }
+
+            case dtype::task: {
+                rt_task* task = static_cast<rt_task*>(obj);
+                mark_value(task->work, full);
+                mark_value(task->result, full);
+                break;
+            }
+
+            case dtype::env: {
+                environment* env = static_cast<environment*>(obj);
+                if (env->parent != nullptr) mark_object(env->parent, full);
+                for (rt_value val : env->storage) mark_value(val, full);
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+}
+
+rt_heap* gc::sweep(rt_heap* list, bool promote, size_t& survivors)
+{
+    rt_heap* kept = nullptr;
+
+    while (list != nullptr) {
+        rt_heap* next = list->next;
+
+        if (list->marked) {
+            list->marked = false;
+            if (promote) list->old = true;
+            settle(list);
+            if (list->old) old_bytes += list->bytes;
+            list->next = kept;
+            kept = list;
+            survivors++;
+        } else {
+            stats.freed_objects++;
+            stats.freed_bytes += list->bytes;
+            free_object(list);
+        }
+
+        list = next;
+    }
+
+    return kept;
+}
+
+void gc::dump()
+{
+    fprintf(stderr, "gc: %zu minor (%.2fms), %zu major (%.2fms)\n", stats.minor_collections, stats.minor_ms, stats.major_collections, stats.major_ms);
+    fprintf(stderr, "gc: allocated %zu objects (%zu bytes), freed %zu objects (%zu bytes), promoted %zu\n", stats.allocated_objects, stats.allocated_bytes, stats.freed_objects, stats.freed_bytes, stats.promoted_objects);
+    fprintf(stderr, "gc: old generation %zu bytes (peak %zu), young %zu bytes, next major at %zu bytes\n", old_bytes, stats.peak_bytes, young_bytes, old_threshold);
+}
@@ -1,31 +1,35 @@
 #include "interpreter.h"
 #include "ast.h"
 #include "builtin.h"
+#include "cache.h"
+#include "compiler.h"
 #include "env.h"
 #include "futil.h"
 #include "parser.h"
 #include "position.h"
+#include "resolver.h"
 #include "runtime.h"
 #include "types.h"
+#include <chrono>
 #include <cstdio>
 #include <error.h>
 #include <string>
 #include <vector>
 #include <iostream>
 
-rt_value* print(std::vector<rt_value*> args, void* env) {
+rt_value print(args_t args, void*, void*) {
     //std::string fin;
     for (int i = 0; i < args.size(); i++) {
         auto elem = args[i];
         if (i != args.size() - 1) {
-            elem->out(); printf(", ");
+            elem.out(); printf(", ");
         } else {
-            elem->out(); printf("\n");
+            elem.out(); printf("\n");
         }
     }
 
     //printf("%s\n", fin.c_str());
-    return new rt_value();
+    return rt_value();
 }
 
 std::string repeat(std::string str, const std::size_t n)
@@ -52,31 +56,101 @@ std::string repeat(std::string str, const std::size_t n)
 #include <functional>
 #include <type_traits>
 
-rt_value_t* interpreter::run()
+environment_t* interpreter::global_scope()
 {
-    rt_value_t* rt_val;
-    environment_t* scope = new environment();
+    environment_t* scope = make_environment();
     def_on_env(scope);
-    scope->interpret = this;
 
-    // rlly hacky but
-    rt_value* arg0;
+    scope->assign("print", make_variadic("print", print));
 
-    scope->assign("print", new rt_value((std::function<rt_value*(std::vector<rt_value*>, void*)>)print));
+    return scope;
+}
+
+// scripts loaded from a file get their parsed tree cached next to them
+ast_node* interpreter::program()
+{
+    if (path.empty() || source.empty()) return p.parse();
+
+    ast_node* root = cache::load(p, path);
+    if (root != nullptr) return root;
+
+    root = p.parse();
+    cache::store(p, root, path);
+    return root;
+}
+
+rt_value_t interpreter::run()
+{
+    rt_value_t rt_val;
+    running_t self(this);
+    globals = global_scope();
 
-    ast_node* root = p.parse();
+    ast_node* root = program();
+    resolver(source, globals).resolve(root);
     //print_node(root);
-    rt_val = eval_scope_samenv(root, scope);
+    rt_val = eval_scope_samenv(root, globals);
 
-    return rt_val;
+    return rt_val.is_undef() ? rt_value() : rt_val;
 }
 
-rt_value_t* interpreter::eval(ast_node* node, environment_t* env)
+rt_value_t interpreter::run_vm()
 {
-    if (node == nullptr) return new rt_value();
+    running_t self(this);
+    globals = global_scope();
+
+    ast_node* root = program();
+    resolver(source, globals).resolve(root);
+    compiler comp(source);
+    chunk_t* code = comp.compile(root);
+    chunks = std::move(comp.chunks);
+
+    machine = new vm(this);
+    return machine->run(code, globals);
+}
+
+rt_value_t interpreter::load_module(const std::string& path, position_t pos)
+{
+    std::string key = canonical_path(path);
+    module_t* mod = modules->find(key);
+
+    if (mod != nullptr) {
+        if (!mod->loaded) error("import cycle: " + modules->cycle(mod), pos, source).spit();
+        return mod->value;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    mod = modules->add(key);
+    modules->loading.push_back(mod);
+
+    rt_value value;
+    if (is_extension(path)) {
+        std::string err = load_extension(mod, path);
+        if (!err.empty()) error(err, pos, source).spit();
+        value = mod->value;
+    } else {
+        std::string contents = futil::read_file(path.c_str());
+        mod->inter = new interpreter(contents, path, modules);
+        value = machine != nullptr ? mod->inter->run_vm() : mod->inter->run();
+    }
+
+    // the value outlives any one interpreter's roots, every later import
+    // hands it out again
+    mod->value = gc_heap().pin(value);
+    mod->loaded = true;
+
+    modules->loading.pop_back();
+    mod->load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    return mod->value;
+}
+
+rt_value_t interpreter::eval(ast_node* node, environment_t* env)
+{
+    if (node == nullptr) return rt_value();
     switch (node->type) {
         case ast_type::ast_identifier:
-            return env->get_var(node->symbol);
+            return eval_identifier(node, env);
 
         case ast_type::ast_return:
             return eval(node->value, env);
@@ -88,10 +162,10 @@ rt_value_t* interpreter::eval(ast_node* node, environment_t* env)
             return eval_scope(node, env);
 
         case ast_type::ast_num_expr:
-            return new rt_value(node->number);
+            return node->data_type == dtype::integer ? make_int(node->integer) : rt_value(node->number);
 
         case ast_type::ast_string_expr:
-            return new rt_value(node->symbol);
+            return make_string(std::string(node->symbol));
 
         case ast_type::ast_function:
             return eval_function(node, env);
@@ -109,7 +183,7 @@ rt_value_t* interpreter::eval(ast_node* node, environment_t* env)
             return eval_member(node, env);
 
         case ast_type::ast_noop:
-            return new rt_value();
+            return rt_value();
 
         case ast_type::ast_arrindex:
             return eval_arrindex(node, env);
@@ -118,262 +192,297 @@ rt_value_t* interpreter::eval(ast_node* node, environment_t* env)
             return eval_import(node, env);
 
         case ast_type::ast_binop:
+        case ast_type::ast_binop_generic:
             return eval_binary(node, env);
 
+        case ast_type::ast_add_int:
+        case ast_type::ast_sub_int:
+        case ast_type::ast_mul_int:
+        case ast_type::ast_div_int:
+        case ast_type::ast_eq_int:
+        case ast_type::ast_ge_int:
+        case ast_type::ast_le_int:
+        case ast_type::ast_lt_int:
+        case ast_type::ast_gt_int:
+        case ast_type::ast_add_float:
+        case ast_type::ast_sub_float:
+        case ast_type::ast_mul_float:
+        case ast_type::ast_div_float:
+        case ast_type::ast_eq_float:
+        case ast_type::ast_ge_float:
+        case ast_type::ast_le_float:
+        case ast_type::ast_lt_float:
+        case ast_type::ast_gt_float:
+        case ast_type::ast_add_str:
+        case ast_type::ast_eq_str:
+            return eval_quick(node, env);
+
+        // statements used as expressions are nil
         case ast_type::ast_if:
-            return eval_if(node, env);
+            eval_if(node, env);
+            return rt_value();
 
         case ast_type::ast_while:
-            return eval_while(node, env);
+            eval_while(node, env);
+            return rt_value();
     }
-    return new rt_value();
+    return rt_value();
 }
 
-rt_value_t* interpreter::eval_assign(ast_node* node, environment_t* env)
+rt_value_t interpreter::eval_identifier(ast_node* node, environment_t* env)
 {
-    rt_value* value = eval(node->value, env);
-    if (value->type != node->data_type) error(string_format("expected type %s for %s, got %s", dtype_to_str(node->data_type).c_str(), node->symbol.c_str(), dtype_to_str(value->type).c_str()), node->pos, source).spit();
-    env->assign(node->symbol, value);
-    return new rt_value();
+    rt_value value = env->at(node->depth, node->slot);
+    if (value.is_undef()) error(string_format("undefined variable %s", std::string(node->symbol).c_str()), node->pos, source).spit();
+    return value;
 }
 
-rt_value_t* interpreter::eval_object(ast_node* node, environment_t* env) {
-    std::map<std::string, rt_value*> object;
+rt_value_t interpreter::eval_assign(ast_node* node, environment_t* env)
+{
+    rt_value value = eval(node->value, env);
+    if (node->data_type != dtype::any && value.type() != node->data_type) error(string_format("expected type %s for %s, got %s", dtype_to_str(node->data_type).c_str(), std::string(node->symbol).c_str(), dtype_to_str(value.type()).c_str()), node->pos, source).spit();
+    env->set(0, node->slot, value);
+    return rt_value();
+}
 
+rt_value_t interpreter::eval_object(ast_node* node, environment_t* env) {
+    // members are kept on the stack until the object owns them
+    rt_value* members = stack.top;
     for (auto elem : node->children) {
-        object[elem->symbol] = eval(elem->value, env);
+        stack.push(eval(elem->value, env));
     }
 
-    return new rt_value(object);
+    object_layout_t& layout = object_layouts()[node->site];
+    std::vector<rt_value> slots(layout.shape->keys.size());
+    for (size_t i = 0; i < node->children.size(); i++) {
+        slots[layout.slots[i]] = members[i];
+    }
+
+    rt_value_t obj = make_object(layout.shape, std::move(slots));
+    stack.top = members;
+    return obj;
 }
 
-rt_value_t* interpreter::eval_array(ast_node* node, environment_t* env)
+rt_value_t interpreter::eval_array(ast_node* node, environment_t* env)
 {
-    std::vector<rt_value*> arr;
-
+    rt_value* elems = stack.top;
     for (auto elem : node->children) {
-        arr.push_back(eval(elem, env));
+        stack.push(eval(elem, env));
     }
 
-    return new rt_value(arr);
+    rt_value_t arr = make_array(std::vector<rt_value>(elems, stack.top));
+    stack.top = elems;
+    return arr;
 }
 
-rt_value_t* interpreter::eval_function(ast_node* node, environment_t* env)
+rt_value_t interpreter::eval_function(ast_node* node, environment_t* env)
 {
-    rt_value_t* fc = new rt_value(node->value, node);
+    rt_value_t fc = make_function(node->value, node);
+    fc.fn()->closure = env;
     return fc;
 }
 
-rt_value_t* interpreter::eval_scope(ast_node* node, environment_t* env)
+rt_value_t interpreter::eval_scope(ast_node* node, environment_t* env)
 {
-    rt_value_t* rt_val;
-    environment_t* s = new environment(env);
-
-    for (ast_node* elem : node->children) {
-        if (elem->type == ast_type::ast_return) rt_val = eval(elem, s);
-        else eval(elem, s);
-    }
-
-    return rt_val;
+    // blocks share their function's frame, the resolver gives them no slots of their own
+    return eval_scope_samenv(node, env);
 }
 
-rt_value_t* interpreter::eval_scope_samenv(ast_node* node, environment_t* env)
+// undefined unless a return ran, in this block or one nested in it
+rt_value_t interpreter::eval_scope_samenv(ast_node* node, environment_t* env)
 {
-    rt_value_t* rt_val;
-
     for (ast_node* elem : node->children) {
-        if (elem->type == ast_type::ast_return) rt_val = eval(elem, env);
-        else eval(elem, env);
-    }
-
-    return rt_val;
-}
+        gc_heap().safepoint();
 
-// rt_value_t* interpreter::eval_call(ast_node* node, environment_t* env)
-// {
-//     rt_value_t* scope = env->get_var(node->symbol);
-//     environment_t* cenv = new environment(env);
-//     std::vector<rt_value*> args;
-
-//     for (int i = 0; i < scope->proto->children.size(); i++) {
-//         ast_node* arg = node->value->children[i];
-//         if (arg == nullptr) break;
-//         ast_node* id = scope->proto->children[i];
-//         if (id == nullptr) break;
-//         rt_value* evaluated = eval(arg, env);
-//         if (evaluated->type != id->data_type && scope->proto->data_type != dtype::cfunction) error(string_format("expected type %s for argument %s, got %s", dtype_to_str(id->data_type).c_str(), id->symbol.c_str(), dtype_to_str(evaluated->type).c_str()), node->pos, source).spit();
-//         args.push_back(evaluated);
-//         cenv->assign(id->symbol, evaluated);
-//     }
-
-//     rt_value_t* rt_val;
-//     dtype_t ftype = scope->proto->data_type;
-
-//     if (ftype != dtype::cfunction) {
-//         std::vector<ast_node*> body = scope->body->children;
-//         if (body.size() > 0) {
-//             for (ast_node* elem : body) {
-//                 if (elem->type == ast_type::ast_return) rt_val = eval(elem, cenv);
-//                 else eval(elem, cenv);
-//             }
-//         }
-//     } else {
-//         rt_val = scope->cfunc(args, env);
-//     }
+        switch (elem->type) {
+            case ast_type::ast_return:
+                if (depth > 0 && elem->value->type == ast_type::ast_call) return tail_call(elem->value, env);
+                return eval(elem->value, env);
 
-//     return rt_val;
-// }
+            case ast_type::ast_if: {
+                rt_value_t result = eval_if(elem, env);
+                if (!result.is_undef()) return result;
+                break;
+            }
 
-rt_value_t* interpreter::eval_call(ast_node* node, environment_t* env)
-{
-    rt_value_t* scope = env->get_var(node->symbol);
-
-    if (scope && scope->type == dtype::func || scope->type == dtype::cfunction) {
-        environment_t* cenv = new environment(env);
-        std::vector<rt_value*> args;
-
-        for (int i = 0; i < scope->proto->children.size(); i++) {
-            ast_node* arg = node->value->children[i];
-            if (arg == nullptr) break;
-            ast_node* id = scope->proto->children[i];
-            if (id == nullptr) break;
-            rt_value* evaluated = eval(arg, env);
-            if (evaluated->type != id->data_type && scope->type != dtype::cfunction) {
-                error(string_format("expected type %s for argument %s, got %s", dtype_to_str(id->data_type).c_str(), id->symbol.c_str(), dtype_to_str(evaluated->type).c_str()), node->pos, source).spit();
-                return nullptr;
+            case ast_type::ast_while: {
+                rt_value_t result = eval_while(elem, env);
+                if (!result.is_undef()) return result;
+                break;
             }
-            args.push_back(evaluated);
-            cenv->assign(id->symbol, evaluated);
+
+            default:
+                eval(elem, env);
+                break;
         }
+    }
 
-        rt_value_t* rt_val;
-        dtype_t ftype = scope->proto->data_type;
+    return rt_value::undefined();
+}
 
-        if (ftype != dtype::cfunction) {
-            std::vector<ast_node*> body = scope->body->children;
-            if (body.size() > 0) {
-                for (ast_node* elem : body) {
-                    if (elem->type == ast_type::ast_return) rt_val = eval(elem, cenv);
-                    else eval(elem, cenv);
-                }
-            }
-        } else {
-            rt_val = scope->cfunc(args, env);
-        }
+rt_value_t interpreter::eval_call(ast_node* node, environment_t* env)
+{
+    rt_value_t scope = env->at(node->depth, node->slot);
 
-        return rt_val;
+    if (scope.type() == dtype::func || scope.type() == dtype::cfunction) {
+        return eval_call(node, env, scope);
     } else {
         // Handle the case where the function is not found
-        error("function not found: " + node->symbol, node->pos, source).spit();
-        return nullptr;
+        error("function not found: " + std::string(node->symbol), node->pos, source).spit();
+        return rt_value();
     }
 }
 
-// rt_value_t* interpreter::call_func(rt_value* func, std::vector<rt_value*> args, environment_t* env)
-// {
-//     environment_t* cenv = new environment(env);
-//     for (int i = 0; i < func->proto->children.size(); i++) {
-//         ast_node* id = func->proto->children[i];
-//         //print_node(func->proto);
-//         cenv->assign(id->symbol, args[i]);
-//     }
+rt_value_t interpreter::eval_call(ast_node* node, environment_t* env, rt_value func)
+{
+    node_list_t& arg_nodes = node->value->children;
+
+    // the callee and its arguments stay on the stack for the whole call
+    if (func.type() == dtype::cfunction) {
+        rt_value* base = stack.top;
+        stack.push(func);
+        for (ast_node* arg : arg_nodes) {
+            stack.push(eval(arg, env));
+        }
 
-//     rt_value_t* rt_val;
-//     std::vector<ast_node*> body = func->body->children;
-//     if (body.size() > 0) {
-//         for (ast_node* elem : body) {
-//             if (elem->type == ast_type::ast_return) rt_val = eval(elem, cenv);
-//             else eval(elem, cenv);
-//         }
-//     }
+        args_t args(base + 1, stack.top);
+        std::string mismatch = func.cfn()->mismatch(args);
+        if (!mismatch.empty()) error(mismatch, node->pos, source).spit();
 
-//     return rt_val;
-// }
+        rt_value_t result = at_call(node->pos, source, [&]() { return func.cfn()->call(args, env); });
+        stack.top = base;
+        return result;
+    }
 
-rt_value_t* interpreter::call_func(rt_value* func, std::vector<rt_value*> args, environment_t* env)
-{
-    environment_t* cenv = new environment(env);
+    if (func.type() != dtype::func) error(string_format("cannot call a value of type %s", dtype_to_str(func.type()).c_str()), node->pos, source).spit();
+
+    rt_value* slots = push_args(node, env, func);
+    return eval_frame(func, slots, node->pos);
+}
 
-    // Check if func and func->proto have valid elements
-    if (!func || !func->proto) {
-        error("invalid function or function prototype", func ? func->body->pos : position(), source).spit();
-        return nullptr;
+// the callee and the arguments for it, evaluated straight into what will
+// be its parameter slots. returns where the slots start
+rt_value* interpreter::push_args(ast_node* node, environment_t* env, rt_value func)
+{
+    node_list_t& arg_nodes = node->value->children;
+    node_list_t& params = func.fn()->proto->children;
+
+    if (arg_nodes.size() != params.size()) error(string_format("expected %d args, got %d", params.size(), arg_nodes.size()), node->pos, source).spit();
+    if (!stack.fits(func.fn()->proto->locals + 1)) error("stack overflow", node->pos, source).spit();
+
+    stack.push(func);
+    rt_value* slots = stack.top;
+    for (size_t i = 0; i < params.size(); i++) {
+        ast_node* id = params[i];
+        rt_value evaluated = eval(arg_nodes[i], env);
+        if (id->data_type != dtype::any && evaluated.type() != id->data_type) error(string_format("expected type %s for argument %s, got %s", dtype_to_str(id->data_type).c_str(), std::string(id->symbol).c_str(), dtype_to_str(evaluated.type()).c_str()), node->pos, source).spit();
+        stack.push(evaluated);
     }
 
-    // Check if args size matches the number of parameters in func->proto
-    if (args.size() != func->proto->children.size()) {
-        error("mismatched number of arguments and function parameters", func->proto->pos, source).spit();
-        delete cenv;  // Clean up allocated environment
-        return nullptr;
+    return slots;
+}
+
+// return f(...) inside a function: the call is left on top of the stack
+// for eval_frame to run in place of the frame the return is in, after
+// unwinding out of it. builtins are just called
+rt_value_t interpreter::tail_call(ast_node* node, environment_t* env)
+{
+    rt_value func = env->at(node->depth, node->slot);
+    if (func.type() != dtype::func) return eval_call(node, env);
+
+    tail = push_args(node, env, func) - 1;
+    return rt_value();
+}
+
+rt_value_t interpreter::call_func(rt_value func, args_t args, environment_t* env)
+{
+    if (func.type() == dtype::cfunction) {
+        std::string mismatch = func.cfn()->mismatch(args);
+        if (!mismatch.empty()) error_util::spit(mismatch);
+        return func.cfn()->call(args, env);
     }
 
-    // Assign arguments to parameters in the new environment
-    for (int i = 0; i < args.size(); i++) {
-        ast_node* id = func->proto->children[i];
-        if (!id) {
-            error("invalid function parameter", func->proto->pos, source).spit();
-            delete cenv;  // Clean up allocated environment
-            return nullptr;
-        }
-        cenv->assign(id->symbol, args[i]);
+    // Check if func is a script function with a valid prototype
+    if (func.type() != dtype::func || !func.fn()->proto) {
+        error_util::spit("invalid function or function prototype");
+        return rt_value();
     }
 
-    rt_value_t* rt_val = nullptr;  // Initialize to nullptr
+    if (machine != nullptr && func.fn()->chunk != nullptr) return machine->call(func, args, env);
 
-    // Evaluate the function body
-    std::vector<ast_node*> body = func->body->children;
-    if (body.size() > 0) {
-        for (ast_node* elem : body) {
-            if (elem->type == ast_type::ast_return) rt_val = eval(elem, cenv);
-            else eval(elem, cenv);
-        }
+    ast_node* proto = func.fn()->proto;
+
+    // Check if args size matches the number of parameters in the prototype
+    if (args.size() != proto->children.size()) {
+        error("mismatched number of arguments and function parameters", proto->pos, source).spit();
+        return rt_value();
     }
 
-    delete cenv;  // Clean up allocated environment
+    if (!stack.fits(proto->locals + 1)) error("stack overflow", proto->pos, source).spit();
 
-    return rt_val;
-}
+    stack.push(func);
+    rt_value* slots = stack.top;
+    for (rt_value arg : args) {
+        stack.push(arg);
+    }
 
+    return eval_frame(func, slots, proto->pos);
+}
 
-rt_value_t* interpreter::eval_call(ast_node* node, environment_t* env, rt_value* func)
+// deep recursion carries on on a heap segment once the native stack runs low
+rt_value_t interpreter::eval_frame(rt_value func, rt_value* slots, position_t pos)
 {
-    rt_value_t* scope = func;
-    environment_t* cenv = new environment(env);
-    std::vector<rt_value*> args;
-
-    for (int i = 0; i < scope->proto->children.size(); i++) {
-        if (node->value->children.size() <= i && scope->proto->data_type != dtype::cfunction) error(string_format("expected %d args, got %d", scope->proto->children.size(), node->value->children.size()), node->pos, source).spit();
-        ast_node* arg = node->value->children[i];
-        if (arg == nullptr) break;
-        ast_node* id = scope->proto->children[i];
-        if (id == nullptr) break;
-        rt_value* evaluated = eval(arg, env);
-        if (evaluated->type != id->data_type && scope->proto->data_type != dtype::cfunction) error(string_format("expected type %s for argument %s, got %s", dtype_to_str(id->data_type).c_str(), id->symbol.c_str(), dtype_to_str(evaluated->type).c_str()), node->pos, source).spit();
-        args.push_back(evaluated);
-        cenv->assign(id->symbol, evaluated);
-    }
+    if (depth >= max_call_depth()) error(string_format("maximum call depth of %zu exceeded", max_call_depth()), pos, source).spit();
+    if (!native_stack::low()) return run_frame(func, slots);
 
-    rt_value_t* rt_val;
-    dtype_t ftype = scope->proto->data_type;
+    rt_value_t result;
+    auto body = [&]() { result = run_frame(func, slots); };
+    native_stack::call(body);
+    return result;
+}
 
-    if (ftype != dtype::cfunction) {
-        std::vector<ast_node*> body = scope->body->children;
-        if (body.size() > 0) {
-            for (ast_node* elem : body) {
-                if (elem->type == ast_type::ast_return) rt_val = eval(elem, cenv);
-                else eval(elem, cenv);
-            }
+rt_value_t interpreter::run_frame(rt_value func, rt_value* slots)
+{
+    rt_value_t rt_val;
+    depth++;
+
+    for (;;) {
+        rt_function* fn = func.fn();
+        ast_node* proto = fn->proto;
+        stack.alloc(proto->locals - proto->children.size());
+
+        if (proto->captured) {
+            environment_t* cenv = make_environment(fn->closure, proto->locals);
+            std::copy(slots, slots + proto->locals, cenv->slots);
+            scopes.push_back(cenv);
+            rt_val = eval_scope_samenv(fn->body, cenv);
+            scopes.pop_back();
+        } else {
+            environment_t cenv(fn->closure, slots);
+            rt_val = eval_scope_samenv(fn->body, &cenv);
         }
-    } else {
-        rt_val = scope->cfunc(args, env);
+
+        if (tail == nullptr) break;
+
+        // a tail call replaces this frame, its callee goes where ours was
+        size_t count = stack.top - tail;
+        std::move(tail, stack.top, slots - 1);
+        stack.top = slots - 1 + count;
+        tail = nullptr;
+
+        func = slots[-1];
+        if (!stack.fits(func.fn()->proto->locals)) error("stack overflow", func.fn()->proto->pos, source).spit();
     }
 
-    return rt_val;
+    depth--;
+    // drop the frame along with the callee pushed below it
+    stack.top = slots - 1;
+
+    return rt_val.is_undef() ? rt_value() : rt_val;
 }
 
 // rt_value_t* interpreter::eval_member(ast_node* node, environment_t* env) {
 //     // Get the left-hand side symbol directly
-//     std::string member_name = node->symbol;
+//     std::string member_name(node->symbol);
 
 //     // Retrieve the object from the environment
 //     rt_value_t* obj = env->get_var(member_name);
@@ -386,11 +495,11 @@ rt_value_t* interpreter::eval_call(ast_node* node, environment_t* env, rt_value*
 //                 rt_value* last_value = obj->children[member_name];
 
 //                 while (last_node->type == ast_type::ast_member) {
-//                     printf("%s\n", last_node->symbol.c_str());
+//                     printf("%s\n", std::string(last_node->symbol).c_str());
 //                     print_node(last_node);
 //                     last_node = last_node->value;
 //                     print_node(last_node);
-//                     printf("%s, %s\n", last_value->ts().c_str(), last_node->symbol.c_str());
+//                     printf("%s, %s\n", last_value->ts().c_str(), std::string(last_node->symbol).c_str());
 //                     last_value = obj->children[last_node->symbol];
 //                 }
 
@@ -409,7 +518,7 @@ rt_value_t* interpreter::eval_call(ast_node* node, environment_t* env, rt_value*
 
 // rt_value_t* interpreter::eval_member(ast_node* node, environment_t* env) {
 //     // Get the left-hand side symbol directly
-//     std::string member_name = node->symbol;
+//     std::string member_name(node->symbol);
 
 //     // Retrieve the object from the environment
 //     rt_value_t* obj = env->get_var(member_name);
@@ -417,7 +526,7 @@ rt_value_t* interpreter::eval_call(ast_node* node, environment_t* env, rt_value*
 //     if (obj->type == dtype::object) {
 //         if (node->value->type == ast_type::ast_identifier) {
 //             // Single member access, return the corresponding value
-//             std::string member_symbol = node->value->symbol;
+//             std::string member_symbol(node->value->symbol);
 //             if (obj->children.find(member_symbol) != obj->children.end()) {
 //                 return obj->children[member_symbol];
 //             } else {
@@ -430,7 +539,7 @@ rt_value_t* interpreter::eval_call(ast_node* node, environment_t* env, rt_value*
 //             ast_node* current_node = node->value;
 
 //             while (current_node->type == ast_type::ast_member) {
-//                 std::string current_member_symbol = current_node->symbol;
+//                 std::string current_member_symbol(current_node->symbol);
 //                 if (obj->children.find(current_member_symbol) != obj->children.end()) {
 //                     obj = obj->children[current_member_symbol];
 //                     current_node = current_node->value;
@@ -443,7 +552,7 @@ rt_value_t* interpreter::eval_call(ast_node* node, environment_t* env, rt_value*
 
 //             // Evaluate the final member access
 //             if (current_node->type == ast_type::ast_identifier) {
-//                 std::string final_member_symbol = current_node->symbol;
+//                 std::string final_member_symbol(current_node->symbol);
 //                 if (obj->children.find(final_member_symbol) != obj->children.end()) {
 //                     return obj->children[final_member_symbol];
 //                 } else {
@@ -462,185 +571,178 @@ rt_value_t* interpreter::eval_call(ast_node* node, environment_t* env, rt_value*
 //     return new rt_value();
 // }
 
-rt_value_t* interpreter::eval_member(ast_node* node, environment_t* env) {
-    // Get the left-hand side symbol directly
-    std::string member_name = node->symbol;
-
-    // Retrieve the object from the environment
-    rt_value_t* obj = env->get_var(member_name);
-
-    if (obj->type == dtype::object) {
-        if (node->value->type == ast_type::ast_identifier) {
-            // Single member access, return the corresponding value
-            std::string member_symbol = node->value->symbol;
-            if (obj->children.find(member_symbol) != obj->children.end()) {
-                return obj->children[member_symbol];
-            } else {
-                // Handle member not found error
-                error(string_format("member %s not found", member_symbol.c_str()), node->value->pos, source).spit();
-            }
-        } else {
-            // Traverse member expressions
-            ast_node* current_node = node->value;
-
-            while (current_node->type == ast_type::ast_member) {
-                std::string current_member_symbol = current_node->symbol;
-                if (obj->children.find(current_member_symbol) != obj->children.end()) {
-                    obj = obj->children[current_member_symbol];
-                    current_node = current_node->value;
-                    
-                    if (current_node->type == ast_type::ast_call) {
-                        obj = obj->children[current_node->symbol];
-                        return eval_call(current_node, env, obj);
-                    }
-                } else {
-                    // Handle member not found error
-                    error(string_format("member %s not found", current_member_symbol.c_str()), current_node->pos, source).spit();
-                }
-            }
+// member of obj named by one link of a chain, read through the link's
+// inline cache. missing members are nil unless the read requires them
+rt_value_t interpreter::get_member(rt_value obj, ast_node* link, bool required)
+{
+    if (obj.type() != dtype::object) error(string_format("not an object"), link->pos, source).spit();
 
-            // Evaluate the final member access
-            if (current_node->type == ast_type::ast_identifier) {
-                std::string final_member_symbol = current_node->symbol;
-                if (obj->children.find(final_member_symbol) != obj->children.end()) {
-                    return obj->children[final_member_symbol];
-                } else {
-                    // Handle member not found error
-                    error(string_format("member %s not found", final_member_symbol.c_str()), current_node->pos, source).spit();
-                }
-            }
+    rt_object* object = obj.object();
+    int slot = member_caches()[link->site].lookup(object->shape, !shared);
+    if (slot >= 0) return object->slots[slot];
 
-            if (current_node->type == ast_type::ast_call) {
-                obj = obj->children[current_node->symbol];
-                return eval_call(current_node, env, obj);
-            }
-        }
-    } else {
-        // Handle error when trying to access a member on a non-object
-        error(string_format("not an object"), node->pos, source).spit();
+    if (required) error(string_format("member %s not found", std::string(link->symbol).c_str()), link->pos, source).spit();
+    return rt_value();
+}
+
+rt_value_t interpreter::eval_member(ast_node* node, environment_t* env) {
+    // Retrieve the object from its resolved slot
+    rt_value_t obj = eval_identifier(node, env);
+    if (obj.type() != dtype::object) error(string_format("not an object"), node->pos, source).spit();
+
+    // Traverse member expressions
+    ast_node* current_node = node->value;
+    while (current_node->type == ast_type::ast_member) {
+        obj = get_member(obj, current_node, true);
+        current_node = current_node->value;
     }
-    
-    return new rt_value();
+
+    // Evaluate the final member access
+    if (current_node->type == ast_type::ast_identifier) return get_member(obj, current_node, true);
+    if (current_node->type == ast_type::ast_call) return eval_call(current_node, env, get_member(obj, current_node, false));
+
+    return rt_value();
 }
 
-rt_value_t* interpreter::eval_arrindex(ast_node* node, environment_t* env)
+rt_value_t interpreter::eval_arrindex(ast_node* node, environment_t* env)
 {
-    rt_value_t* arr = env->get_var(node->symbol);
-    if (arr->type != dtype::array) {
-        if (arr->type != dtype::object) error(string_format("not an array or object"), node->pos, source).spit();
-        rt_value_t* idx = eval(node->value, env);
-        if (idx->type != dtype::string) error(string_format("not an indexable type for object"), node->pos, source).spit();
-        return arr->children[idx->str];
+    rt_value_t arr = eval_identifier(node, env);
+    bool packed = is_packed(arr.type());
+    if (arr.type() != dtype::array && !packed) {
+        if (arr.type() != dtype::object) error(string_format("not an array or object"), node->pos, source).spit();
+        stack.push(arr);
+        rt_value_t idx = eval(node->value, env);
+        stack.pop();
+        if (idx.type() != dtype::string) error(string_format("not an indexable type for object"), node->pos, source).spit();
+        rt_value* member = arr.object()->get(idx.str());
+        return member != nullptr ? *member : rt_value();
     }
 
-    if (node->value->type == ast_type::ast_num_expr) {
-        return arr->arr[node->value->number];
-    } else {
-        rt_value_t* idx = eval(node->value, env);
-        if (idx->type != dtype::integer) error(string_format("not an indexable type for array"), node->pos, source).spit();
-        return arr->arr[idx->num];
-    }
+    stack.push(arr);
+    rt_value_t idx = eval(node->value, env);
+    stack.pop();
+    if (idx.type() != dtype::integer) error(string_format("not an indexable type for array"), node->pos, source).spit();
+
+    int64_t at = idx.integer();
+    size_t length = packed ? packed_length(arr) : arr.arr().size();
+    if (at < 0 || static_cast<uint64_t>(at) >= length) error(string_format("index %lld out of range", (long long)at), node->pos, source).spit();
+    return packed ? packed_get(arr, at) : arr.arr()[at];
 }
 
-rt_value_t* interpreter::eval_import(ast_node* node, environment_t* env)
+rt_value_t interpreter::eval_import(ast_node* node, environment_t* env)
 {
     ast_node* path = node->value;
     ast_node* id = node->svalue;
 
-    rt_value* strpath = eval(path, env);
+    rt_value strpath = eval(path, env);
 
-    if (strpath->type == dtype::string) {
-        std::string contents = futil::read_file(strpath->str.c_str());
-        interpreter_t i(contents);
-        rt_value* res = i.run();
-        env->assign(id->symbol, res);
+    if (strpath.type() == dtype::string) {
+        rt_value res = load_module(strpath.str(), node->pos);
+        env->set(id->depth, id->slot, res);
     } else {
         error("invalid arguments to import", path->pos, source).spit();
     }
 
-    return new rt_value();
+    return rt_value();
 }
 
-rt_value_t* interpreter::eval_binary(ast_node* node, environment_t* env)
+// the node type a binop specializes to for these operands, generic when
+// there is no fast path for them
+static ast_type_t quicken(binop_t op, rt_value left, rt_value right)
 {
-    rt_value* left = eval(node->value, env);
-    rt_value* right = eval(node->svalue, env);
-    ///print_node(node->svalue);
-
-    if (left->type == dtype::integer && right->type == dtype::integer) {
-        std::string op = node->symbol;
-
-        if (op == "+") return new rt_value(left->num + right->num);
-        if (op == "-") return new rt_value(left->num - right->num);
-        if (op == "/") return new rt_value(left->num / right->num);
-        if (op == "*") return new rt_value(left->num * right->num);
-        if (op == "==") return new rt_value(left->num == right->num);
-        if (op == ">=") return new rt_value(left->num >= right->num);
-        if (op == "<=") return new rt_value(left->num <= right->num);
-        if (op == "<") return new rt_value(left->num < right->num);
-        if (op == ">") return new rt_value(left->num > right->num);
-    }
+    if (left.is_small() && right.is_small()) return static_cast<ast_type_t>(static_cast<uint8_t>(ast_type::ast_add_int) + static_cast<uint8_t>(op));
+    if (left.is_double() && right.is_double()) return static_cast<ast_type_t>(static_cast<uint8_t>(ast_type::ast_add_float) + static_cast<uint8_t>(op));
 
-    if (left->type == dtype::string && right->type == dtype::string) {
-        std::string op = node->symbol;
-
-        if (op == "+") return new rt_value(left->str + right->str);
-        if (op == "-") error("cannot sub string by string", node->pos, source).spit();
-        if (op == "/") error("cannot divide string by string", node->pos, source).spit();
-        if (op == "*") error("cannot multiply string by string", node->pos, source).spit();
-        if (op == "==") return new rt_value(left->str == right->str);
-        if (op == ">=") error("cannot check if string is greater than or equal to string", node->pos, source).spit();
-        if (op == "<=") error("cannot check if string is less than or equal to string", node->pos, source).spit();
-        if (op == "<") error("cannot check if string is less than string", node->pos, source).spit();
-        if (op == ">") error("cannot check if string is greater than string", node->pos, source).spit();
+    if (left.type() == dtype::string && right.type() == dtype::string) {
+        if (op == binop::add) return ast_type::ast_add_str;
+        if (op == binop::eq) return ast_type::ast_eq_str;
     }
 
-    if (left->type == dtype::string && right->type == dtype::integer) {
-        std::string op = node->symbol;
-
-        if (op == "+") return new rt_value(left->str + std::to_string(right->num));
-        if (op == "-") error("cannot sub string by number", node->pos, source).spit();
-        if (op == "/") error("cannot divide string by number", node->pos, source).spit();
-        if (op == "*") return new rt_value(repeat(left->str, (int)right->num));
-        if (op == ">=") error("cannot check if string is greater than or equal to number", node->pos, source).spit();
-        if (op == "<=") error("cannot check if string is less than or equal to number", node->pos, source).spit();
-        if (op == "<") error("cannot check if string is less than number", node->pos, source).spit();
-        if (op == ">") error("cannot check if string is greater than number", node->pos, source).spit();
-    }
+    return ast_type::ast_binop_generic;
+}
+
+rt_value_t interpreter::eval_binary(ast_node* node, environment_t* env)
+{
+    // the left operand stays rooted while the right one is evaluated
+    stack.push(eval(node->value, env));
+    rt_value right = eval(node->svalue, env);
+    rt_value left = stack.pop();
 
-    return new rt_value();
+    if (node->type == ast_type::ast_binop && !shared) node->type = quicken(node->op, left, right);
+    return binary(node, left, right);
 }
 
-rt_value_t* interpreter::eval_if(ast_node* node, environment_t* env)
+rt_value_t interpreter::eval_quick(ast_node* node, environment_t* env)
 {
-    rt_value* evaluated = eval(node->svalue, env);
-    if (evaluated->type == dtype::boolean) {
-        if (evaluated->boolean == true) {
-            eval_scope_samenv(node->value, env);
+    stack.push(eval(node->value, env));
+    rt_value right = eval(node->svalue, env);
+    rt_value left = stack.pop();
+
+    if (left.is_small() && right.is_small()) {
+        // two 48-bit ints can't overflow an add or sub, make_int boxes
+        // whatever doesn't fit back in the payload
+        int64_t a = left.small(), b = right.small(), r;
+
+        switch (node->type) {
+            case ast_type::ast_add_int: return make_int(a + b);
+            case ast_type::ast_sub_int: return make_int(a - b);
+            case ast_type::ast_mul_int:
+                if (__builtin_mul_overflow(a, b, &r)) return binary(node, left, right);
+                return make_int(r);
+            case ast_type::ast_div_int:
+                if (b == 0) return binary(node, left, right);
+                return make_int(a / b);
+            case ast_type::ast_eq_int: return rt_value(a == b);
+            case ast_type::ast_ge_int: return rt_value(a >= b);
+            case ast_type::ast_le_int: return rt_value(a <= b);
+            case ast_type::ast_lt_int: return rt_value(a < b);
+            case ast_type::ast_gt_int: return rt_value(a > b);
+            default: break;
         }
-    } else {
-        if (evaluated->type != dtype::nil) {
-            eval_scope_samenv(node->value, env);
+    } else if (left.is_double() && right.is_double()) {
+        switch (node->type) {
+            case ast_type::ast_add_float: return rt_value(left.num() + right.num());
+            case ast_type::ast_sub_float: return rt_value(left.num() - right.num());
+            case ast_type::ast_mul_float: return rt_value(left.num() * right.num());
+            case ast_type::ast_div_float: return rt_value(left.num() / right.num());
+            case ast_type::ast_eq_float: return rt_value(left.num() == right.num());
+            case ast_type::ast_ge_float: return rt_value(left.num() >= right.num());
+            case ast_type::ast_le_float: return rt_value(left.num() <= right.num());
+            case ast_type::ast_lt_float: return rt_value(left.num() < right.num());
+            case ast_type::ast_gt_float: return rt_value(left.num() > right.num());
+            default: break;
         }
+    } else if (left.type() == dtype::string && right.type() == dtype::string) {
+        if (node->type == ast_type::ast_add_str) return concat_strings(left, right);
+        if (node->type == ast_type::ast_eq_str) return rt_value(left.str() == right.str());
     }
 
-    return new rt_value();
+    // the operands changed type since the node specialized
+    if (!shared) node->type = ast_type::ast_binop_generic;
+    return binary(node, left, right);
 }
 
-rt_value_t* interpreter::eval_while(ast_node* node, environment_t* env)
+rt_value_t interpreter::binary(ast_node* node, rt_value left, rt_value right)
 {
-    rt_value* evaluated = eval(node->svalue, env);
-    if (evaluated->type == dtype::boolean) {
-        while (evaluated->boolean == true) {
-            eval_scope_samenv(node->value, env);
-            evaluated = eval(node->svalue, env);
-        }
-    } else {
-        while (evaluated->type != dtype::nil) {
-            eval_scope_samenv(node->value, env);
-            evaluated = eval(node->svalue, env);
-        }
+    rt_value result;
+    const char* err = binary_op(node->op, left, right, result);
+    if (err != nullptr) error(err, node->pos, source).spit();
+    return result;
+}
+
+// both are undefined unless a return in their block ran
+rt_value_t interpreter::eval_if(ast_node* node, environment_t* env)
+{
+    if (eval(node->svalue, env).truthy()) return eval_scope_samenv(node->value, env);
+    return rt_value::undefined();
+}
+
+rt_value_t interpreter::eval_while(ast_node* node, environment_t* env)
+{
+    while (eval(node->svalue, env).truthy()) {
+        rt_value_t result = eval_scope_samenv(node->value, env);
+        if (!result.is_undef()) return result;
     }
 
-    return new rt_value();
+    return rt_value::undefined();
 }
\ No newline at end of file
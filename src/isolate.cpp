@@ -0,0 +1,191 @@
+#include "isolate.h"
+#include "async.h"
+#include "channel.h"
+#include "futil.h"
+#include <error.h>
+
+void isolate::scope::enter(isolate* iso)
+{
+    current_isolate = iso;
+    current_heap = iso != nullptr ? &iso->heap : nullptr;
+    current_symbols = iso != nullptr ? &iso->symbols : nullptr;
+    current_shapes = iso != nullptr ? &iso->shapes : nullptr;
+    current_sites = iso != nullptr ? &iso->sites : nullptr;
+}
+
+isolate::~isolate()
+{
+    // the interpreter unregisters its roots from the heap on the way out,
+    // and tasks still running unwind on the interpreters they borrowed
+    scope_t entered(this);
+    delete loop;
+    delete main;
+}
+
+bool isolate::run(const std::string& source, const std::string& path, bool use_vm)
+{
+    scope_t entered(this);
+    this->path = path;
+
+    try {
+        delete main;
+        main = new interpreter(source, path);
+        if (use_vm) main->run_vm();
+        else main->run();
+
+        // the program ends once the tasks it started have
+        if (loop != nullptr) loop->run_all();
+        return true;
+    } catch (const script_error& err) {
+        errors.push_back(err.what());
+        // a failed program's tasks and the commands they started stop with
+        // it, the main isolate is never torn down
+        delete loop;
+        loop = nullptr;
+        return false;
+    }
+}
+
+void isolate::opened(std::shared_ptr<channel> chan)
+{
+    if (std::find(channels.begin(), channels.end(), chan) == channels.end()) channels.push_back(std::move(chan));
+}
+
+void isolate::report()
+{
+    static std::mutex lock;
+    std::lock_guard<std::mutex> hold(lock);
+
+    for (const std::string& err : errors) printf("%s:\n%s", path.c_str(), err.c_str());
+    fflush(stdout);
+}
+
+isolate_pool::isolate_pool(size_t count) : limit(std::max<size_t>(count, 1)), active(0), idle(0), parked(0), pending(0), rechecked(0), progressed(false), rounds(0), deadlocks(0), sealed(false), closing(false) {}
+
+isolate_pool::~isolate_pool()
+{
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        closing = true;
+    }
+    ready.notify_all();
+
+    // nothing is queued or running by now, so no more threads get started
+    for (std::thread& thread : threads) thread.join();
+}
+
+std::future<std::unique_ptr<isolate_t>> isolate_pool::submit(std::string path, bool use_vm)
+{
+    task_t task([path, use_vm]() {
+        std::unique_ptr<isolate_t> iso = std::make_unique<isolate_t>();
+        if (!iso->run(futil::read_file(path.c_str()), path, use_vm)) {
+            // reported before its channels close, so the first error to
+            // show up is the one that started it
+            iso->report();
+            for (std::shared_ptr<channel>& chan : iso->channels) chan->close();
+        }
+        return iso;
+    });
+
+    std::future<std::unique_ptr<isolate_t>> done = task.get_future();
+    std::lock_guard<std::mutex> hold(lock);
+    queue.push_back(std::move(task));
+    schedule();
+
+    return done;
+}
+
+void isolate_pool::seal()
+{
+    std::lock_guard<std::mutex> hold(lock);
+    sealed = true;
+    settle(false);
+}
+
+void isolate_pool::adopt()
+{
+    std::lock_guard<std::mutex> hold(lock);
+    active++;
+    sealed = true;
+    current_pool = this;
+}
+
+void isolate_pool::schedule()
+{
+    while (!queue.empty() && active < limit) {
+        task_t task = std::move(queue.front());
+        queue.pop_front();
+        active++;
+
+        if (idle > 0) {
+            idle--;
+            handed.push_back(std::move(task));
+            ready.notify_one();
+        } else {
+            threads.emplace_back([this](task_t first) { loop(std::move(first)); }, std::move(task));
+        }
+    }
+}
+
+void isolate_pool::loop(task_t task)
+{
+    current_pool = this;
+
+    for (;;) {
+        task();
+
+        std::unique_lock<std::mutex> hold(lock);
+        active--;
+        // counted as idle first, so the next script can go to this thread
+        idle++;
+        schedule();
+        progressed = true;
+        settle(false);
+
+        ready.wait(hold, [&]() { return closing || !handed.empty(); });
+        if (handed.empty()) return;
+
+        task = std::move(handed.front());
+        handed.pop_front();
+    }
+}
+
+void isolate_pool::settle(bool stalled)
+{
+    // the ones the last round woke will get somewhere or park again, and
+    // a script still to come might be what the parked ones wait for
+    if (active > 0 || parked == 0 || pending > 0 || !sealed) return;
+
+    // nothing runs while a round is under way, so whoever parks again tried
+    // after it started. nothing else having happened since, none of them
+    // can ever be woken for real
+    if (stalled && !progressed && rechecked == parked) deadlocks.fetch_add(1);
+
+    rounds++;
+    pending = parked;
+    rechecked = 0;
+    progressed = false;
+    wake_channels();
+}
+
+void isolate_pool::park(bool recheck, uint64_t& round, uint64_t& deadlock)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    round = rounds;
+    deadlock = deadlocks.load();
+    active--;
+    parked++;
+    if (recheck) rechecked++;
+    else progressed = true;
+    schedule();
+    settle(recheck);
+}
+
+void isolate_pool::unpark(bool recheck, uint64_t round)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    active++;
+    parked--;
+    if (round != rounds) pending--;
+    else if (recheck) rechecked--;
+}
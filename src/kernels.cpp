@@ -0,0 +1,556 @@
+#include "kernels.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define KERNELS_X86 1
+#include <atomic>
+#include <immintrin.h>
+#endif
+
+namespace kernels {
+    // ints wrap, going through unsigned so overflow isn't undefined
+    static inline int64_t add(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b)); }
+    static inline int64_t mul(int64_t a, int64_t b) { return static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b)); }
+    static inline double add(double a, double b) { return a + b; }
+    static inline double mul(double a, double b) { return a * b; }
+
+    template <typename T>
+    static T scalar_sum(const T* a, size_t n)
+    {
+        T s = 0;
+        for (size_t i = 0; i < n; i++) s = add(s, a[i]);
+        return s;
+    }
+
+    template <typename T>
+    static T scalar_min(const T* a, size_t n)
+    {
+        T m = a[0];
+        for (size_t i = 1; i < n; i++) {
+            if (a[i] < m) m = a[i];
+        }
+        return m;
+    }
+
+    template <typename T>
+    static T scalar_max(const T* a, size_t n)
+    {
+        T m = a[0];
+        for (size_t i = 1; i < n; i++) {
+            if (a[i] > m) m = a[i];
+        }
+        return m;
+    }
+
+    template <typename T>
+    static T scalar_dot(const T* a, const T* b, size_t n)
+    {
+        T s = 0;
+        for (size_t i = 0; i < n; i++) s = add(s, mul(a[i], b[i]));
+        return s;
+    }
+
+    template <typename T>
+    static void scalar_add(const T* a, const T* b, T* out, size_t n)
+    {
+        for (size_t i = 0; i < n; i++) out[i] = add(a[i], b[i]);
+    }
+
+    template <typename T>
+    static void scalar_mul(const T* a, const T* b, T* out, size_t n)
+    {
+        for (size_t i = 0; i < n; i++) out[i] = mul(a[i], b[i]);
+    }
+
+    template <typename T>
+    static void scalar_scale(const T* a, T k, T* out, size_t n)
+    {
+        for (size_t i = 0; i < n; i++) out[i] = mul(a[i], k);
+    }
+
+    template <typename T>
+    static void scalar_prefix_sum(const T* a, T* out, size_t n)
+    {
+        T s = 0;
+        for (size_t i = 0; i < n; i++) {
+            s = add(s, a[i]);
+            out[i] = s;
+        }
+    }
+
+    template <typename T>
+    static constexpr ops<T> scalar_ops()
+    {
+        return {
+            scalar_sum<T>,
+            scalar_min<T>,
+            scalar_max<T>,
+            scalar_dot<T>,
+            scalar_add<T>,
+            scalar_mul<T>,
+            scalar_scale<T>,
+            scalar_prefix_sum<T>,
+        };
+    }
+
+#ifdef KERNELS_X86
+    enum struct lanewise {
+        add,
+        mul,
+    };
+
+    // sse2, two lanes of either type. it has no 64 bit int multiply or
+    // compare, so int min/max/mul/dot/scale stay scalar
+
+    static double sse2_sum_f64(const double* a, size_t n)
+    {
+        __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+            s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+        }
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+        double s = lanes[0] + lanes[1];
+        for (; i < n; i++) s += a[i];
+        return s;
+    }
+
+    static double sse2_min_f64(const double* a, size_t n)
+    {
+        if (n < 2) return a[0];
+
+        __m128d m = _mm_loadu_pd(a);
+        size_t i = 2;
+        for (; i + 2 <= n; i += 2) m = _mm_min_pd(m, _mm_loadu_pd(a + i));
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, m);
+        double s = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+        for (; i < n; i++) s = a[i] < s ? a[i] : s;
+        return s;
+    }
+
+    static double sse2_max_f64(const double* a, size_t n)
+    {
+        if (n < 2) return a[0];
+
+        __m128d m = _mm_loadu_pd(a);
+        size_t i = 2;
+        for (; i + 2 <= n; i += 2) m = _mm_max_pd(m, _mm_loadu_pd(a + i));
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, m);
+        double s = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+        for (; i < n; i++) s = a[i] > s ? a[i] : s;
+        return s;
+    }
+
+    static double sse2_dot_f64(const double* a, const double* b, size_t n)
+    {
+        __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+            s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+        }
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+        double s = lanes[0] + lanes[1];
+        for (; i < n; i++) s += a[i] * b[i];
+        return s;
+    }
+
+    template <lanewise Op>
+    static void sse2_zip_f64(const double* a, const double* b, double* out, size_t n)
+    {
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128d x = _mm_loadu_pd(a + i), y = _mm_loadu_pd(b + i);
+            _mm_storeu_pd(out + i, Op == lanewise::add ? _mm_add_pd(x, y) : _mm_mul_pd(x, y));
+        }
+        for (; i < n; i++) out[i] = Op == lanewise::add ? a[i] + b[i] : a[i] * b[i];
+    }
+
+    static void sse2_scale_f64(const double* a, double k, double* out, size_t n)
+    {
+        __m128d kv = _mm_set1_pd(k);
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), kv));
+        for (; i < n; i++) out[i] = a[i] * k;
+    }
+
+    // [x0, x1] + [0, x0] is the running sum of the pair, the carry brings in
+    // everything before it
+    static void sse2_prefix_sum_f64(const double* a, double* out, size_t n)
+    {
+        __m128d carry = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128d x = _mm_loadu_pd(a + i);
+            x = _mm_add_pd(x, _mm_unpacklo_pd(_mm_setzero_pd(), x));
+            x = _mm_add_pd(x, carry);
+            _mm_storeu_pd(out + i, x);
+            carry = _mm_unpackhi_pd(x, x);
+        }
+
+        double s = _mm_cvtsd_f64(carry);
+        for (; i < n; i++) {
+            s += a[i];
+            out[i] = s;
+        }
+    }
+
+    static int64_t sse2_sum_i64(const int64_t* a, size_t n)
+    {
+        __m128i s0 = _mm_setzero_si128(), s1 = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            s0 = _mm_add_epi64(s0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+            s1 = _mm_add_epi64(s1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i + 2)));
+        }
+
+        int64_t lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), _mm_add_epi64(s0, s1));
+        int64_t s = add(lanes[0], lanes[1]);
+        for (; i < n; i++) s = add(s, a[i]);
+        return s;
+    }
+
+    static void sse2_add_i64(const int64_t* a, const int64_t* b, int64_t* out, size_t n)
+    {
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_add_epi64(x, y));
+        }
+        for (; i < n; i++) out[i] = add(a[i], b[i]);
+    }
+
+    static void sse2_prefix_sum_i64(const int64_t* a, int64_t* out, size_t n)
+    {
+        __m128i carry = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            x = _mm_add_epi64(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi64(x, carry);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), x);
+            carry = _mm_unpackhi_epi64(x, x);
+        }
+
+        int64_t s = _mm_cvtsi128_si64(carry);
+        for (; i < n; i++) {
+            s = add(s, a[i]);
+            out[i] = s;
+        }
+    }
+
+    // avx2, four lanes. 64 bit int multiplies are put together from the
+    // 32x32->64 one, and min/max from compare and blend
+
+    __attribute__((target("avx2")))
+    static inline __m256i avx2_mul_epi64(__m256i a, __m256i b)
+    {
+        __m256i lo = _mm256_mul_epu32(a, b);
+        __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+        return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+    }
+
+    __attribute__((target("avx2")))
+    static double avx2_sum_f64(const double* a, size_t n)
+    {
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+            s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+        }
+
+        double lanes[4];
+        _mm256_storeu_pd(lanes, _mm256_add_pd(s0, s1));
+        double s = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        for (; i < n; i++) s += a[i];
+        return s;
+    }
+
+    template <bool Min>
+    __attribute__((target("avx2")))
+    static double avx2_extreme_f64(const double* a, size_t n)
+    {
+        if (n < 4) return Min ? scalar_min(a, n) : scalar_max(a, n);
+
+        __m256d m = _mm256_loadu_pd(a);
+        size_t i = 4;
+        for (; i + 4 <= n; i += 4) {
+            __m256d x = _mm256_loadu_pd(a + i);
+            m = Min ? _mm256_min_pd(m, x) : _mm256_max_pd(m, x);
+        }
+
+        double lanes[4];
+        _mm256_storeu_pd(lanes, m);
+        double s = Min ? scalar_min(lanes, 4) : scalar_max(lanes, 4);
+        for (; i < n; i++) {
+            if (Min ? a[i] < s : a[i] > s) s = a[i];
+        }
+        return s;
+    }
+
+    __attribute__((target("avx2")))
+    static double avx2_dot_f64(const double* a, const double* b, size_t n)
+    {
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+            s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+        }
+
+        double lanes[4];
+        _mm256_storeu_pd(lanes, _mm256_add_pd(s0, s1));
+        double s = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        for (; i < n; i++) s += a[i] * b[i];
+        return s;
+    }
+
+    template <lanewise Op>
+    __attribute__((target("avx2")))
+    static void avx2_zip_f64(const double* a, const double* b, double* out, size_t n)
+    {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d x = _mm256_loadu_pd(a + i), y = _mm256_loadu_pd(b + i);
+            _mm256_storeu_pd(out + i, Op == lanewise::add ? _mm256_add_pd(x, y) : _mm256_mul_pd(x, y));
+        }
+        for (; i < n; i++) out[i] = Op == lanewise::add ? a[i] + b[i] : a[i] * b[i];
+    }
+
+    __attribute__((target("avx2")))
+    static void avx2_scale_f64(const double* a, double k, double* out, size_t n)
+    {
+        __m256d kv = _mm256_set1_pd(k);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), kv));
+        for (; i < n; i++) out[i] = a[i] * k;
+    }
+
+    // two shift-and-add steps turn [x0, x1, x2, x3] into its running sums,
+    // the carry is the last lane of the previous block broadcast
+    __attribute__((target("avx2")))
+    static void avx2_prefix_sum_f64(const double* a, double* out, size_t n)
+    {
+        __m256d zero = _mm256_setzero_pd(), carry = zero;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256d x = _mm256_loadu_pd(a + i);
+            x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_permute4x64_pd(x, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x1));
+            x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_permute4x64_pd(x, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x3));
+            x = _mm256_add_pd(x, carry);
+            _mm256_storeu_pd(out + i, x);
+            carry = _mm256_permute4x64_pd(x, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+
+        double s = _mm256_cvtsd_f64(carry);
+        for (; i < n; i++) {
+            s += a[i];
+            out[i] = s;
+        }
+    }
+
+    __attribute__((target("avx2")))
+    static int64_t avx2_sum_i64(const int64_t* a, size_t n)
+    {
+        __m256i s0 = _mm256_setzero_si256(), s1 = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            s0 = _mm256_add_epi64(s0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)));
+            s1 = _mm256_add_epi64(s1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i + 4)));
+        }
+
+        int64_t lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi64(s0, s1));
+        int64_t s = scalar_sum(lanes, 4);
+        for (; i < n; i++) s = add(s, a[i]);
+        return s;
+    }
+
+    template <bool Min>
+    __attribute__((target("avx2")))
+    static int64_t avx2_extreme_i64(const int64_t* a, size_t n)
+    {
+        if (n < 4) return Min ? scalar_min(a, n) : scalar_max(a, n);
+
+        __m256i m = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+        size_t i = 4;
+        for (; i + 4 <= n; i += 4) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            // lanes where x should replace m
+            __m256i take = Min ? _mm256_cmpgt_epi64(m, x) : _mm256_cmpgt_epi64(x, m);
+            m = _mm256_blendv_epi8(m, x, take);
+        }
+
+        int64_t lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), m);
+        int64_t s = Min ? scalar_min(lanes, 4) : scalar_max(lanes, 4);
+        for (; i < n; i++) {
+            if (Min ? a[i] < s : a[i] > s) s = a[i];
+        }
+        return s;
+    }
+
+    __attribute__((target("avx2")))
+    static int64_t avx2_dot_i64(const int64_t* a, const int64_t* b, size_t n)
+    {
+        __m256i s = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+            s = _mm256_add_epi64(s, avx2_mul_epi64(x, y));
+        }
+
+        int64_t lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), s);
+        int64_t sum = scalar_sum(lanes, 4);
+        for (; i < n; i++) sum = add(sum, mul(a[i], b[i]));
+        return sum;
+    }
+
+    template <lanewise Op>
+    __attribute__((target("avx2")))
+    static void avx2_zip_i64(const int64_t* a, const int64_t* b, int64_t* out, size_t n)
+    {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), Op == lanewise::add ? _mm256_add_epi64(x, y) : avx2_mul_epi64(x, y));
+        }
+        for (; i < n; i++) out[i] = Op == lanewise::add ? add(a[i], b[i]) : mul(a[i], b[i]);
+    }
+
+    __attribute__((target("avx2")))
+    static void avx2_scale_i64(const int64_t* a, int64_t k, int64_t* out, size_t n)
+    {
+        __m256i kv = _mm256_set1_epi64x(k);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), avx2_mul_epi64(x, kv));
+        }
+        for (; i < n; i++) out[i] = mul(a[i], k);
+    }
+
+    __attribute__((target("avx2")))
+    static void avx2_prefix_sum_i64(const int64_t* a, int64_t* out, size_t n)
+    {
+        __m256i zero = _mm256_setzero_si256(), carry = zero;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            x = _mm256_add_epi64(x, _mm256_blend_epi32(_mm256_permute4x64_epi64(x, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x03));
+            x = _mm256_add_epi64(x, _mm256_blend_epi32(_mm256_permute4x64_epi64(x, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x0f));
+            x = _mm256_add_epi64(x, carry);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), x);
+            carry = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+
+        int64_t s = _mm256_extract_epi64(carry, 0);
+        for (; i < n; i++) {
+            s = add(s, a[i]);
+            out[i] = s;
+        }
+    }
+#endif
+
+    const kernel_set_t& scalar()
+    {
+        static const kernel_set_t impl = {
+            "scalar",
+            scalar_ops<int64_t>(),
+            scalar_ops<double>(),
+        };
+        return impl;
+    }
+
+    static const kernel_set_t& pick()
+    {
+#ifdef KERNELS_X86
+        static const kernel_set_t sse2 = {
+            "sse2",
+            {
+                sse2_sum_i64,
+                scalar_min<int64_t>,
+                scalar_max<int64_t>,
+                scalar_dot<int64_t>,
+                sse2_add_i64,
+                scalar_mul<int64_t>,
+                scalar_scale<int64_t>,
+                sse2_prefix_sum_i64,
+            },
+            {
+                sse2_sum_f64,
+                sse2_min_f64,
+                sse2_max_f64,
+                sse2_dot_f64,
+                sse2_zip_f64<lanewise::add>,
+                sse2_zip_f64<lanewise::mul>,
+                sse2_scale_f64,
+                sse2_prefix_sum_f64,
+            },
+        };
+
+        static const kernel_set_t avx2 = {
+            "avx2",
+            {
+                avx2_sum_i64,
+                avx2_extreme_i64<true>,
+                avx2_extreme_i64<false>,
+                avx2_dot_i64,
+                avx2_zip_i64<lanewise::add>,
+                avx2_zip_i64<lanewise::mul>,
+                avx2_scale_i64,
+                avx2_prefix_sum_i64,
+            },
+            {
+                avx2_sum_f64,
+                avx2_extreme_f64<true>,
+                avx2_extreme_f64<false>,
+                avx2_dot_f64,
+                avx2_zip_f64<lanewise::add>,
+                avx2_zip_f64<lanewise::mul>,
+                avx2_scale_f64,
+                avx2_prefix_sum_f64,
+            },
+        };
+
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return avx2;
+        if (__builtin_cpu_supports("sse2")) return sse2;
+#endif
+        return scalar();
+    }
+
+    // isolates lexing on several threads can all get here first, whichever
+    // stores last picked the same thing
+    static std::atomic<const kernel_set_t*> active = nullptr;
+
+    const kernel_set_t& best()
+    {
+        const kernel_set_t* picked = active.load(std::memory_order_relaxed);
+        if (picked == nullptr) {
+            picked = &pick();
+            active.store(picked, std::memory_order_relaxed);
+        }
+
+        return *picked;
+    }
+
+    void use(const kernel_set_t& impl)
+    {
+        active.store(&impl, std::memory_order_relaxed);
+    }
+}
@@ -1,10 +1,17 @@
 #include "ast.h"
+#include "cache.h"
+#include "gc.h"
 // #include "cpp_front.h"
 #include "interpreter.h"
+#include "isolate.h"
+#include "kernels.h"
 #include "lexer.h"
 #include "parser.h"
+#include "pool.h"
 #include "runtime.h"
+#include "scan.h"
 #include "token.h"
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <error.h>
@@ -12,23 +19,108 @@
 #include <iostream>
 #include <vector>
 
+// runs every script in an isolate of its own, as many at once as
+// --isolates allows. a script's errors are printed as soon as it fails,
+// stats once everything is done, in the order the scripts were given
+static int run_isolates(const std::vector<std::string>& paths, bool use_vm, bool gc_stats, bool module_stats) {
+    isolate_pool_t pool(std::min(isolate_threads(), paths.size()));
+    std::vector<std::future<std::unique_ptr<isolate_t>>> running;
+    for (const std::string& path : paths) running.push_back(pool.submit(path, use_vm));
+    pool.seal();
+
+    int status = EXIT_SUCCESS;
+    for (auto& done : running) {
+        std::unique_ptr<isolate_t> iso = done.get();
+        if (!iso->errors.empty()) status = EXIT_FAILURE;
+
+        if (gc_stats) {
+            fprintf(stderr, "%s:\n", iso->path.c_str());
+            iso->heap.dump();
+        }
+        if (module_stats && iso->main != nullptr) iso->main->modules->dump();
+    }
+
+    return status;
+}
+
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        argv[1] = "examples/basic.du";
+    std::vector<std::string> paths;
+    bool use_vm = false;
+    bool gc_stats = false;
+    bool parse_only = false;
+    bool module_stats = false;
+    size_t nursery = 0, old_size = 0;
+    double growth = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--vm") use_vm = true;
+        else if (arg == "--gc-stats") gc_stats = true;
+        else if (arg == "--parse-only") parse_only = true;
+        else if (arg == "--module-stats") module_stats = true;
+        else if (arg == "--no-simd") {
+            scan::use(scan::scalar());
+            kernels::use(kernels::scalar());
+        }
+        else if (arg == "--no-cache") cache::enabled() = false;
+        else if (arg.rfind("--gc-nursery=", 0) == 0) nursery = std::stoul(arg.substr(13)) * 1024;
+        else if (arg.rfind("--gc-heap=", 0) == 0) old_size = std::stoul(arg.substr(10)) * 1024;
+        else if (arg.rfind("--gc-growth=", 0) == 0) growth = std::stod(arg.substr(12));
+        else if (arg.rfind("--max-depth=", 0) == 0) max_call_depth() = std::stoul(arg.substr(12));
+        else if (arg.rfind("--threads=", 0) == 0) pool_threads() = std::max(1ul, std::stoul(arg.substr(10)));
+        else if (arg.rfind("--isolates=", 0) == 0) isolate_threads() = std::max(1ul, std::stoul(arg.substr(11)));
+        else paths.push_back(arg);
     }
 
-    std::string fcontents = futil::read_file(argv[1]);
+    gc_defaults() = gc_config{nursery, old_size, growth};
+    if (paths.size() > 1 && !parse_only) return run_isolates(paths, use_vm, gc_stats, module_stats);
+
+    const char* path = paths.empty() ? "examples/basic.du" : paths[0].c_str();
+    // lives until the process exits, tearing its heap down would only cost
+    // time
+    isolate_t* main_isolate = new isolate();
+    isolate_t::scope_t entered(main_isolate);
+
+    std::string fcontents = futil::read_file(path);
     // parser_t pars = parser(fcontents);
     // ast_node* idk = pars.parse();
     //printf("%s\n", asm_res.c_str());
     //print_node(idk);
 
-    interpreter_t inter = interpreter(fcontents);
-    rt_value_t* eval = inter.run();
-    //eval->out();
+    if (parse_only) {
+        auto start = std::chrono::steady_clock::now();
+        parser_t pars = parser(fcontents);
+        ast_node* root = nullptr;
+        auto lexed = start;
+
+        try {
+            pars.lex();
+            lexed = std::chrono::steady_clock::now();
+            root = pars.parse();
+        } catch (const script_error& err) {
+            printf("%s", err.what());
+            return EXIT_FAILURE;
+        }
+        auto parsed = std::chrono::steady_clock::now();
+
+        double lex_ms = std::chrono::duration<double, std::milli>(lexed - start).count();
+        fprintf(stderr, "%zu bytes, %zu tokens, %zu statements: lex %.1fms (%.0f MB/s, %s), parse %.1fms, ast %zuKB\n", fcontents.size(), pars.tokens.size(), root->children.size(),
+            lex_ms, fcontents.size() / (lex_ms * 1e3), scan::best().name, std::chrono::duration<double, std::milli>(parsed - lexed).count(), pars.nodes.used / 1024);
+        return EXIT_SUCCESS;
+    }
+
+    // a pool of one, so a channel nothing else can serve is an error
+    // rather than a hang
+    isolate_pool_t lone(1);
+    lone.adopt();
+    bool ok = main_isolate->run(fcontents, path, use_vm);
+    for (const std::string& report : main_isolate->errors) printf("%s", report.c_str());
+
+    if (gc_stats) gc_heap().dump();
+    if (module_stats) main_isolate->main->modules->dump();
 
     // std::string ccode = cpp_frontend::from_root(idk);
     // futil::write_file(argv[2], ccode);
 
-    return EXIT_SUCCESS;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
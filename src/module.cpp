@@ -0,0 +1,43 @@
+#include "module.h"
+#include "interpreter.h"
+#include <algorithm>
+#include <cstdio>
+#include <dlfcn.h>
+#include <filesystem>
+#include <system_error>
+
+module_registry::~module_registry()
+{
+    for (module_t* mod : order) {
+        delete mod->inter;
+        if (mod->handle != nullptr) dlclose(mod->handle);
+        delete mod;
+    }
+}
+
+std::string module_registry::cycle(module_t* mod)
+{
+    std::string chain;
+    auto it = std::find(loading.begin(), loading.end(), mod);
+
+    for (; it != loading.end(); it++) chain += (*it)->path + " -> ";
+    return chain + mod->path;
+}
+
+void module_registry::dump()
+{
+    for (module_t* mod : order) {
+        // the program that owns the registry
+        if (mod->inter == nullptr && mod->handle == nullptr) continue;
+        fprintf(stderr, "module %s: %.2fms\n", mod->path.c_str(), mod->load_ms);
+    }
+}
+
+// the same file reached through different relative paths or links maps to
+// one module. paths that don't exist are kept as they are
+std::string canonical_path(const std::string& path)
+{
+    std::error_code err;
+    std::filesystem::path canon = std::filesystem::weakly_canonical(path, err);
+    return err ? path : canon.string();
+}
@@ -0,0 +1,227 @@
+#include "native_stack.h"
+#include <exception>
+#include <memory>
+#include <new>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define NATIVE_STACK_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define NATIVE_STACK_ASAN 1
+#endif
+#endif
+
+#ifdef NATIVE_STACK_ASAN
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+namespace native_stack {
+    typedef struct segment {
+        char* memory;
+        ucontext_t context;
+        ucontext_t caller;
+        void (*fn)(void*);
+        void* arg;
+        std::exception_ptr failure;
+        // a fiber's own limit while it's away, and the one of whatever
+        // resumed it
+        char* inside;
+        char* outside;
+        segment* outer;
+        bool done;
+        // what address sanitizer is told about the stacks on either side
+        // of a switch, it loses track of them otherwise
+        const void* caller_bottom;
+        size_t caller_size;
+        void* fake;
+
+        // the lowest page is left unmapped so running off the end faults
+        // instead of writing into whatever sits below
+        segment() {
+            void* at = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (at == MAP_FAILED) throw std::bad_alloc();
+            memory = static_cast<char*>(at);
+            mprotect(memory, sysconf(_SC_PAGESIZE), PROT_NONE);
+        }
+
+        ~segment() {
+            munmap(memory, SEGMENT_SIZE);
+        }
+    } segment_t;
+
+    // lowest usable address of the stack this thread is running on
+    static thread_local char* limit = nullptr;
+    static thread_local segment_t* starting = nullptr;
+    static thread_local segment_t* active = nullptr;
+    // segments that finished, kept for the next deep call or fiber. a burst
+    // of tasks can leave many behind, only so many are kept
+    static thread_local std::vector<std::unique_ptr<segment_t>> spare;
+    constexpr size_t SPARE_SEGMENTS = 64;
+
+    static char* thread_stack()
+    {
+        pthread_attr_t attr;
+        void* addr = nullptr;
+        size_t size = 0;
+
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            pthread_attr_getstack(&attr, &addr, &size);
+            pthread_attr_destroy(&attr);
+        }
+
+        return static_cast<char*>(addr);
+    }
+
+    // switches from the current stack to the one whose usable part starts
+    // at to, fake is null when the current stack is never coming back
+    static void switch_to(ucontext_t* from, ucontext_t* to, [[maybe_unused]] void** fake, [[maybe_unused]] const void* bottom, [[maybe_unused]] size_t size)
+    {
+#ifdef NATIVE_STACK_ASAN
+        __sanitizer_start_switch_fiber(fake, bottom, size);
+#endif
+        swapcontext(from, to);
+    }
+
+    // first thing after a switch lands, records the stack it came from. both
+    // only have anything to do under address sanitizer
+    static void switched([[maybe_unused]] void* fake, [[maybe_unused]] const void** bottom, [[maybe_unused]] size_t* size)
+    {
+#ifdef NATIVE_STACK_ASAN
+        __sanitizer_finish_switch_fiber(fake, bottom, size);
+#endif
+    }
+
+    bool low()
+    {
+        if (limit == nullptr) limit = thread_stack();
+
+        char* here = static_cast<char*>(__builtin_frame_address(0));
+        return static_cast<size_t>(here - limit) < RESERVE;
+    }
+
+    static std::unique_ptr<segment_t> take()
+    {
+        if (spare.empty()) return std::make_unique<segment_t>();
+
+        std::unique_ptr<segment_t> seg = std::move(spare.back());
+        spare.pop_back();
+        return seg;
+    }
+
+    static void give_back(std::unique_ptr<segment_t> seg)
+    {
+        if (spare.size() < SPARE_SEGMENTS) spare.push_back(std::move(seg));
+    }
+
+    static void entry()
+    {
+        segment_t* seg = starting;
+        switched(nullptr, &seg->caller_bottom, &seg->caller_size);
+
+        try {
+            seg->fn(seg->arg);
+        } catch (...) {
+            seg->failure = std::current_exception();
+        }
+
+        seg->done = true;
+#ifdef NATIVE_STACK_ASAN
+        __sanitizer_start_switch_fiber(nullptr, seg->caller_bottom, seg->caller_size);
+#endif
+        // uc_link resumes the caller
+    }
+
+    static void prepare(segment_t* seg, void (*fn)(void*), void* arg)
+    {
+        seg->fn = fn;
+        seg->arg = arg;
+        seg->failure = nullptr;
+        seg->inside = seg->memory + sysconf(_SC_PAGESIZE);
+        seg->done = false;
+
+        getcontext(&seg->context);
+        seg->context.uc_stack.ss_sp = seg->memory;
+        seg->context.uc_stack.ss_size = SEGMENT_SIZE;
+        seg->context.uc_link = &seg->caller;
+        makecontext(&seg->context, entry, 0);
+    }
+
+    void run(void (*fn)(void*), void* arg)
+    {
+        std::unique_ptr<segment_t> seg = take();
+        prepare(seg.get(), fn, arg);
+
+        if (limit == nullptr) limit = thread_stack();
+        char* saved = limit;
+        limit = seg->inside;
+        starting = seg.get();
+
+        void* fake = nullptr;
+        switch_to(&seg->caller, &seg->context, &fake, seg->memory, SEGMENT_SIZE);
+        switched(fake, nullptr, nullptr);
+        limit = saved;
+
+        std::exception_ptr failure = seg->failure;
+        seg->failure = nullptr;
+        give_back(std::move(seg));
+
+        if (failure) std::rethrow_exception(failure);
+    }
+
+    fiber_t* start(void (*fn)(void*), void* arg)
+    {
+        segment_t* seg = take().release();
+        prepare(seg, fn, arg);
+        return seg;
+    }
+
+    bool resume(fiber_t* f)
+    {
+        if (limit == nullptr) limit = thread_stack();
+        f->outside = limit;
+        f->outer = active;
+        limit = f->inside;
+        active = f;
+        starting = f;
+
+        // the fiber carries on on whichever segment it yielded from
+        void* fake = nullptr;
+        size_t page = sysconf(_SC_PAGESIZE);
+        switch_to(&f->caller, &f->context, &fake, f->inside - page, SEGMENT_SIZE);
+        switched(fake, nullptr, nullptr);
+        limit = f->outside;
+        active = f->outer;
+
+        if (f->failure) {
+            std::exception_ptr failure = f->failure;
+            f->failure = nullptr;
+            std::rethrow_exception(failure);
+        }
+
+        return f->done;
+    }
+
+    void yield()
+    {
+        segment_t* f = active;
+        // a deep call inside the fiber may have moved it onto another segment
+        f->inside = limit;
+        switch_to(&f->context, &f->caller, &f->fake, f->caller_bottom, f->caller_size);
+        switched(f->fake, &f->caller_bottom, &f->caller_size);
+    }
+
+    fiber_t* current()
+    {
+        return active;
+    }
+
+    void finish(fiber_t* f)
+    {
+        give_back(std::unique_ptr<segment_t>(f));
+    }
+}
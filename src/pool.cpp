@@ -0,0 +1,119 @@
+#include "pool.h"
+
+work_pool::work_pool(size_t count) : job(nullptr), generation(0), busy(0)
+{
+    for (size_t i = 0; i < std::max<size_t>(count, 1); i++) lanes.push_back(std::make_unique<lane_t>());
+
+    // thread 0 is whoever calls run
+    for (size_t i = 1; i < lanes.size(); i++) {
+        threads.emplace_back([this, i]() { loop(i); });
+        threads.back().detach();
+    }
+}
+
+void work_pool::run(size_t n, size_t grain, const job_t& fn)
+{
+    if (n == 0) return;
+    grain = std::max<size_t>(grain, 1);
+    std::lock_guard<std::mutex> one(taken);
+
+    size_t chunks = (n + grain - 1) / grain;
+    size_t per_lane = (chunks + size() - 1) / size();
+    for (size_t c = 0; c < chunks; c++) {
+        size_t begin = c * grain;
+        lanes[c / per_lane]->chunks.emplace_back(begin, std::min(begin + grain, n));
+    }
+
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        job = &fn;
+        busy = threads.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> hold(lock);
+    finished.wait(hold, [&]() { return busy == 0; });
+    job = nullptr;
+
+    if (failure) {
+        std::exception_ptr error = failure;
+        failure = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void work_pool::loop(size_t self)
+{
+    uint64_t seen = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> hold(lock);
+            wake.wait(hold, [&]() { return generation != seen; });
+            seen = generation;
+        }
+
+        work(self);
+
+        std::lock_guard<std::mutex> hold(lock);
+        if (--busy == 0) finished.notify_one();
+    }
+}
+
+void work_pool::work(size_t self)
+{
+    std::pair<size_t, size_t> chunk;
+
+    try {
+        while (next(self, chunk)) (*job)(self, chunk.first, chunk.second);
+    } catch (...) {
+        fail(std::current_exception());
+    }
+}
+
+void work_pool::fail(std::exception_ptr error)
+{
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        if (!failure) failure = error;
+    }
+
+    for (std::unique_ptr<lane_t>& lane : lanes) {
+        std::lock_guard<std::mutex> hold(lane->lock);
+        lane->chunks.clear();
+    }
+}
+
+bool work_pool::next(size_t self, std::pair<size_t, size_t>& chunk)
+{
+    {
+        lane_t& own = *lanes[self];
+        std::lock_guard<std::mutex> hold(own.lock);
+        if (!own.chunks.empty()) {
+            chunk = own.chunks.front();
+            own.chunks.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < size(); i++) {
+        lane_t& victim = *lanes[(self + i) % size()];
+        std::lock_guard<std::mutex> hold(victim.lock);
+        if (!victim.chunks.empty()) {
+            chunk = victim.chunks.back();
+            victim.chunks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+work_pool_t& worker_pool()
+{
+    static work_pool_t* pool = new work_pool(pool_threads());
+    return *pool;
+}
@@ -0,0 +1,196 @@
+#include "resolver.h"
+#include "ast.h"
+#include "env.h"
+#include "shape.h"
+#include <string>
+
+void resolver::resolve(ast_node* root)
+{
+    scopes.push_back(scope(nullptr));
+    resolve_body(root);
+    scopes.pop_back();
+}
+
+void resolver::resolve_body(ast_node* body)
+{
+    for (ast_node* elem : body->children) {
+        resolve_node(elem);
+    }
+}
+
+void resolver::resolve_node(ast_node* node)
+{
+    if (node == nullptr) return;
+
+    switch (node->type) {
+        case ast_type::ast_identifier:
+            resolve_read(node);
+            break;
+
+        case ast_type::ast_assign:
+            // a function sees its own name, so local functions can recurse
+            if (node->value != nullptr && node->value->type == ast_type::ast_function) {
+                declare(node);
+                resolve_node(node->value);
+                break;
+            }
+
+            resolve_node(node->value);
+            declare(node);
+            break;
+
+        case ast_type::ast_call:
+            resolve_read(node);
+            resolve_body(node->value);
+            break;
+
+        case ast_type::ast_member:
+            resolve_member(node);
+            break;
+
+        case ast_type::ast_arrindex:
+            resolve_read(node);
+            resolve_node(node->value);
+            break;
+
+        case ast_type::ast_function:
+            resolve_function(node);
+            break;
+
+        case ast_type::ast_import:
+            resolve_node(node->value);
+            declare(node->svalue);
+            break;
+
+        case ast_type::ast_binop:
+            resolve_node(node->value);
+            resolve_node(node->svalue);
+            break;
+
+        case ast_type::ast_return:
+            resolve_node(node->value);
+            break;
+
+        case ast_type::ast_if:
+        case ast_type::ast_while:
+            resolve_node(node->svalue);
+            resolve_body(node->value);
+            break;
+
+        case ast_type::ast_array:
+        case ast_type::ast_compound:
+            resolve_body(node);
+            break;
+
+        case ast_type::ast_object:
+            for (ast_node* elem : node->children) resolve_node(elem->value);
+            layout(node);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void resolver::resolve_read(ast_node* node)
+{
+    int innermost = scopes.size() - 1;
+
+    for (int i = innermost; i > 0; i--) {
+        auto it = scopes[i].names.find(node->atom);
+        if (it != scopes[i].names.end()) {
+            node->depth = innermost - i;
+            node->slot = it->second;
+            return;
+        }
+    }
+
+    node->depth = innermost;
+    node->slot = globals->define(std::string(node->symbol));
+}
+
+void resolver::resolve_member(ast_node* node)
+{
+    resolve_read(node);
+
+    // the rest of the chain are member names, only call arguments and
+    // index expressions at the end of it refer to variables
+    ast_node* current_node = node->value;
+    while (current_node->type == ast_type::ast_member) {
+        cache(current_node);
+        current_node = current_node->value;
+    }
+
+    cache(current_node);
+
+    if (current_node->type == ast_type::ast_call) resolve_body(current_node->value);
+    if (current_node->type == ast_type::ast_arrindex) resolve_node(current_node->value);
+}
+
+void resolver::resolve_function(ast_node* node)
+{
+    // a nested function's static link runs through the enclosing frame, so
+    // that frame has to outlive the call that created it
+    if (scopes.size() > 1) scopes.back().function->captured = true;
+
+    scopes.push_back(scope(node));
+    scope_t& fscope = scopes.back();
+
+    for (size_t i = 0; i < node->children.size(); i++) {
+        ast_node* param = node->children[i];
+        param->depth = 0;
+        param->slot = i;
+        fscope.names[param->atom] = i;
+    }
+
+    node->locals = node->children.size();
+    resolve_body(node->value);
+    scopes.pop_back();
+}
+
+void resolver::declare(ast_node* node)
+{
+    node->depth = 0;
+
+    if (scopes.size() == 1) {
+        node->slot = globals->define(std::string(node->symbol));
+        return;
+    }
+
+    scope_t& current = scopes.back();
+    auto it = current.names.find(node->atom);
+    if (it != current.names.end()) {
+        node->slot = it->second;
+        return;
+    }
+
+    // params always get the first slots, even when two share a name
+    node->slot = current.function->locals++;
+    current.names[node->atom] = node->slot;
+}
+
+// each link of a member chain gets its own inline cache
+void resolver::cache(ast_node* link)
+{
+    link->site = member_caches().size();
+    member_caches().emplace_back(link->atom);
+}
+
+// an object literal's shape only depends on its keys, so it is worked out
+// once here instead of every time the literal runs
+void resolver::layout(ast_node* node)
+{
+    object_layout_t layout;
+    layout.shape = shapes().root();
+
+    for (ast_node* elem : node->children) {
+        if (layout.shape->find(elem->atom) < 0) layout.shape = layout.shape->add(elem->atom);
+    }
+
+    for (ast_node* elem : node->children) {
+        layout.slots.push_back(layout.shape->find(elem->atom));
+    }
+
+    node->site = object_layouts().size();
+    object_layouts().push_back(std::move(layout));
+}
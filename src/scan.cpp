@@ -0,0 +1,208 @@
+#include "scan.h"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <atomic>
+#include <immintrin.h>
+#endif
+
+namespace scan {
+    enum struct run {
+        space,
+        ident,
+        digits,
+        newline,
+        quote,
+    };
+
+    // true for the bytes that end a run of the given kind
+    template <run R>
+    static inline bool stops(char c)
+    {
+        if constexpr (R == run::space) return !is_space(c);
+        if constexpr (R == run::ident) return !is_alnum(c);
+        if constexpr (R == run::digits) return !is_digit(c);
+        if constexpr (R == run::newline) return c == '\n';
+        if constexpr (R == run::quote) return c == '"';
+    }
+
+    template <run R>
+    static size_t scalar_scan(const char* src, size_t from, size_t len)
+    {
+        while (from < len && !stops<R>(src[from])) from++;
+        return from;
+    }
+
+    template <>
+    size_t scalar_scan<run::newline>(const char* src, size_t from, size_t len)
+    {
+        if (from >= len) return len;
+        const void* at = std::memchr(src + from, '\n', len - from);
+        return at != nullptr ? static_cast<const char*>(at) - src : len;
+    }
+
+#ifdef SCAN_X86
+    // unsigned a <= b per byte, sse2 only has signed compares
+    static inline __m128i le_u8(__m128i a, __m128i b)
+    {
+        return _mm_cmpeq_epi8(_mm_min_epu8(a, b), a);
+    }
+
+    // bit i set when byte i ends the run
+    template <run R>
+    static inline unsigned sse2_mask(__m128i v)
+    {
+        __m128i hit;
+
+        if constexpr (R == run::space) {
+            __m128i ctrl = le_u8(_mm_sub_epi8(v, _mm_set1_epi8('\t')), _mm_set1_epi8('\r' - '\t'));
+            hit = _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+            return ~_mm_movemask_epi8(hit) & 0xffff;
+        }
+
+        if constexpr (R == run::ident || R == run::digits) {
+            hit = le_u8(_mm_sub_epi8(v, _mm_set1_epi8('0')), _mm_set1_epi8(9));
+            if constexpr (R == run::ident) {
+                __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+                hit = _mm_or_si128(hit, le_u8(_mm_sub_epi8(lower, _mm_set1_epi8('a')), _mm_set1_epi8(25)));
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+            }
+            return ~_mm_movemask_epi8(hit) & 0xffff;
+        }
+
+        if constexpr (R == run::newline) return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        if constexpr (R == run::quote) return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    }
+
+    template <run R>
+    static size_t sse2_scan(const char* src, size_t from, size_t len)
+    {
+        while (from + 16 <= len) {
+            unsigned mask = sse2_mask<R>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + from)));
+            if (mask != 0) return from + __builtin_ctz(mask);
+            from += 16;
+        }
+
+        return scalar_scan<R>(src, from, len);
+    }
+
+    __attribute__((target("avx2")))
+    static inline __m256i le_u8(__m256i a, __m256i b)
+    {
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(a, b), a);
+    }
+
+    template <run R>
+    __attribute__((target("avx2")))
+    static inline uint32_t avx2_mask(__m256i v)
+    {
+        __m256i hit;
+
+        if constexpr (R == run::space) {
+            __m256i ctrl = le_u8(_mm256_sub_epi8(v, _mm256_set1_epi8('\t')), _mm256_set1_epi8('\r' - '\t'));
+            hit = _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+            return ~static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+        }
+
+        if constexpr (R == run::ident || R == run::digits) {
+            hit = le_u8(_mm256_sub_epi8(v, _mm256_set1_epi8('0')), _mm256_set1_epi8(9));
+            if constexpr (R == run::ident) {
+                __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+                hit = _mm256_or_si256(hit, le_u8(_mm256_sub_epi8(lower, _mm256_set1_epi8('a')), _mm256_set1_epi8(25)));
+                hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+            }
+            return ~static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+        }
+
+        if constexpr (R == run::newline) return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        if constexpr (R == run::quote) return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+    }
+
+    template <run R>
+    __attribute__((target("avx2")))
+    static size_t avx2_scan(const char* src, size_t from, size_t len)
+    {
+        while (from + 32 <= len) {
+            uint32_t mask = avx2_mask<R>(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + from)));
+            if (mask != 0) return from + __builtin_ctz(mask);
+            from += 32;
+        }
+
+        return sse2_scan<R>(src, from, len);
+    }
+#endif
+
+    const scanner_t& scalar()
+    {
+        static const scanner_t impl = {
+            "scalar",
+            scalar_scan<run::space>,
+            scalar_scan<run::ident>,
+            scalar_scan<run::digits>,
+            scalar_scan<run::newline>,
+            scalar_scan<run::quote>,
+        };
+        return impl;
+    }
+
+    static const scanner_t& pick()
+    {
+#ifdef SCAN_X86
+        static const scanner_t sse2 = {
+            "sse2",
+            sse2_scan<run::space>,
+            sse2_scan<run::ident>,
+            sse2_scan<run::digits>,
+            sse2_scan<run::newline>,
+            sse2_scan<run::quote>,
+        };
+
+        static const scanner_t avx2 = {
+            "avx2",
+            avx2_scan<run::space>,
+            avx2_scan<run::ident>,
+            avx2_scan<run::digits>,
+            avx2_scan<run::newline>,
+            avx2_scan<run::quote>,
+        };
+
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return avx2;
+        if (__builtin_cpu_supports("sse2")) return sse2;
+#endif
+        return scalar();
+    }
+
+    // isolates lexing on several threads can all get here first, whichever
+    // stores last picked the same thing
+    static std::atomic<const scanner_t*> active = nullptr;
+
+    const scanner_t& best()
+    {
+        const scanner_t* picked = active.load(std::memory_order_relaxed);
+        if (picked == nullptr) {
+            picked = &pick();
+            active.store(picked, std::memory_order_relaxed);
+        }
+
+        return *picked;
+    }
+
+    void use(const scanner_t& impl)
+    {
+        active.store(&impl, std::memory_order_relaxed);
+    }
+
+    std::vector<uint32_t> index_lines(const char* src, size_t len)
+    {
+        const scanner_t& sc = best();
+        std::vector<uint32_t> lines = {0};
+
+        for (size_t at = sc.find_newline(src, 0, len); at < len; at = sc.find_newline(src, at + 1, len)) {
+            lines.push_back(at + 1);
+        }
+
+        return lines;
+    }
+}
@@ -0,0 +1,409 @@
+#include "vm.h"
+#include "bytecode.h"
+#include "env.h"
+#include "gc.h"
+#include "interpreter.h"
+#include "runtime.h"
+#include "types.h"
+#include <error.h>
+#include <string>
+#include <vector>
+
+// the arithmetic opcodes run in binop_t order from op_add
+static inline binop_t to_binop(opcode_t op)
+{
+    return static_cast<binop_t>(static_cast<int>(op) - static_cast<int>(opcode::op_add));
+}
+
+vm::vm(interpreter* inter) : inter(inter), stack(&inter->stack)
+{
+    frames.reserve(64);
+}
+
+rt_value vm::run(chunk_t* code, environment_t* env)
+{
+    if (!stack->fits(code->max_stack)) error_util::spit("stack overflow");
+
+    size_t depth = frames.size();
+    frames.push_back(call_frame{rt_value(), code, 0, env->slots, stack->top, env});
+    return execute(depth);
+}
+
+rt_value vm::call(rt_value func, args_t args, environment_t* env)
+{
+    if (func.type() == dtype::cfunction) {
+        std::string mismatch = func.cfn()->mismatch(args);
+        if (!mismatch.empty()) error_util::spit(mismatch);
+        return func.cfn()->call(args, env);
+    }
+
+    if (!stack->fits(args.size() + 1)) error_util::spit("stack overflow");
+
+    size_t depth = frames.size();
+    stack->push(func);
+    for (rt_value arg : args) stack->push(arg);
+    call_value(args.size(), func.type() == dtype::func ? func.fn()->proto->pos : position(), env);
+
+    return execute(depth);
+}
+
+void vm::call_value(size_t argc, position_t pos, environment_t* env)
+{
+    rt_value* base = stack->top - argc - 1;
+    rt_value callee = *base;
+
+    if (callee.type() == dtype::cfunction) {
+        args_t args(base + 1, stack->top);
+        std::string mismatch = callee.cfn()->mismatch(args);
+        if (!mismatch.empty()) error(mismatch, pos, inter->source).spit();
+
+        rt_value result = at_call(pos, inter->source, [&]() { return callee.cfn()->call(args, env); });
+        stack->top = base;
+        stack->push(result);
+        return;
+    }
+
+    if (callee.type() != dtype::func || callee.fn()->chunk == nullptr) {
+        error(string_format("cannot call a value of type %s", dtype_to_str(callee.type()).c_str()), pos, inter->source).spit();
+    }
+
+    rt_function* fn = callee.fn();
+    ast_node* proto = fn->proto;
+    node_list_t& params = proto->children;
+    if (params.size() != argc) {
+        error(string_format("expected %d args, got %d", params.size(), argc), pos, inter->source).spit();
+    }
+
+    for (size_t i = 0; i < argc; i++) {
+        ast_node* id = params[i];
+        rt_value arg = base[1 + i];
+        if (id->data_type != dtype::any && arg.type() != id->data_type) {
+            error(string_format("expected type %s for argument %s, got %s", dtype_to_str(id->data_type).c_str(), std::string(id->symbol).c_str(), dtype_to_str(arg.type()).c_str()), pos, inter->source).spit();
+        }
+    }
+
+    if (frames.size() >= max_call_depth()) error(string_format("maximum call depth of %zu exceeded", max_call_depth()), pos, inter->source).spit();
+    if (!stack->fits(proto->locals + fn->chunk->max_stack)) error("stack overflow", pos, inter->source).spit();
+
+    // arguments already sit where the callee's parameter slots go
+    rt_value* slots = base + 1;
+    stack->alloc(proto->locals - argc);
+    environment_t* frame_env = fn->closure;
+
+    if (proto->captured) {
+        frame_env = make_environment(fn->closure, proto->locals);
+        std::copy(slots, slots + proto->locals, frame_env->slots);
+        slots = frame_env->slots;
+        stack->top = base;
+    }
+
+    frames.push_back(call_frame{callee, fn->chunk, 0, slots, base, frame_env});
+}
+
+void vm::undefined(call_frame_t* frame, size_t at)
+{
+    auto it = frame->code->symbols.find(at);
+    std::string name = it != frame->code->symbols.end() ? it->second : "?";
+    error(string_format("undefined variable %s", name.c_str()), frame->code->positions[at], inter->source).spit();
+}
+
+// the top of the value stack lives in sp while instructions run. it is
+// written back before anything that looks at the stack, calls, imports and
+// safepoints, and read again after
+rt_value vm::execute(size_t exit_depth)
+{
+    call_frame_t* frame = &frames.back();
+    const instr_t* code = frame->code->code.data();
+    rt_value* constants = frame->code->constants.data();
+    rt_value* slots = frame->slots;
+    size_t ip = frame->ip;
+    rt_value* sp = stack->top;
+
+    for (;;) {
+        instr_t in = code[ip++];
+
+        switch (instr_op(in)) {
+            case opcode::op_const:
+                *sp++ = constants[instr_arg(in)];
+                break;
+
+            case opcode::op_nil:
+                *sp++ = rt_value();
+                break;
+
+            case opcode::op_pop:
+                sp--;
+                break;
+
+            case opcode::op_get_local: {
+                rt_value value = slots[instr_arg(in)];
+                if (value.is_undef()) undefined(frame, ip - 1);
+                *sp++ = value;
+                break;
+            }
+
+            case opcode::op_set_local:
+                slots[instr_arg(in)] = *--sp;
+                // a captured frame's slots belong to frame->env, otherwise
+                // this just remembers the closure's frame
+                gc_heap().barrier(frame->env);
+                break;
+
+            case opcode::op_get_env: {
+                environment_t* env = frame->env;
+                for (uint32_t depth = instr_arg(in); depth > 0; depth--) env = env->parent;
+
+                rt_value value = env->slots[code[ip++]];
+                if (value.is_undef()) undefined(frame, ip - 2);
+                *sp++ = value;
+                break;
+            }
+
+            case opcode::op_check_type: {
+                dtype_t expected = static_cast<dtype_t>(instr_arg(in));
+                rt_value value = sp[-1];
+                if (value.type() != expected) {
+                    std::string& name = frame->code->symbols[ip - 1];
+                    error(string_format("expected type %s for %s, got %s", dtype_to_str(expected).c_str(), name.c_str(), dtype_to_str(value.type()).c_str()), frame->code->positions[ip - 1], inter->source).spit();
+                }
+                break;
+            }
+
+            case opcode::op_closure: {
+                rt_function* proto = constants[instr_arg(in)].fn();
+                rt_value fn = make_function(proto->body, proto->proto);
+                fn.fn()->chunk = proto->chunk;
+                fn.fn()->closure = frame->env;
+                *sp++ = fn;
+                break;
+            }
+
+            case opcode::op_add:
+            case opcode::op_sub:
+            case opcode::op_mul:
+            case opcode::op_div: {
+                rt_value right = *--sp;
+                rt_value& left = sp[-1];
+                if (left.is_small() && right.is_small() && small_arith(to_binop(instr_op(in)), left.small(), right.small(), left)) break;
+                left = binary(to_binop(instr_op(in)), left, right, frame->code->positions[ip - 1]);
+                break;
+            }
+
+            // a comparison the next instruction branches on jumps right
+            // away instead of pushing a boolean for it to pop
+            case opcode::op_eq:
+            case opcode::op_ge:
+            case opcode::op_le:
+            case opcode::op_lt:
+            case opcode::op_gt: {
+                rt_value right = *--sp;
+                rt_value& left = sp[-1];
+                if (!left.is_small() || !right.is_small()) {
+                    left = binary(to_binop(instr_op(in)), left, right, frame->code->positions[ip - 1]);
+                    break;
+                }
+
+                bool holds = small_compare(to_binop(instr_op(in)), left.small(), right.small());
+                if (instr_op(code[ip]) == opcode::op_jump_if_false) {
+                    sp--;
+                    ip = holds ? ip + 1 : instr_arg(code[ip]);
+                } else {
+                    left = rt_value(holds);
+                }
+                break;
+            }
+
+            case opcode::op_binary_local: {
+                uint32_t arg = instr_arg(in);
+                binop_t op = static_cast<binop_t>(arg & (BINARY_CONST - 1));
+                rt_value left = slots[arg >> BINARY_SLOT_SHIFT];
+                if (left.is_undef()) undefined(frame, ip - 1);
+
+                uint32_t operand = code[ip++];
+                rt_value right = arg & BINARY_CONST ? constants[operand] : slots[operand];
+                if (right.is_undef()) undefined(frame, ip - 1);
+
+                if (!left.is_small() || !right.is_small()) {
+                    *sp++ = binary(op, left, right, frame->code->positions[ip - 2]);
+                    break;
+                }
+
+                // the result usually goes straight into a local
+                if (op < binop::eq) {
+                    if (!small_arith(op, left.small(), right.small(), left)) left = binary(op, left, right, frame->code->positions[ip - 2]);
+                    if (instr_op(code[ip]) == opcode::op_set_local) {
+                        slots[instr_arg(code[ip++])] = left;
+                        gc_heap().barrier(frame->env);
+                    } else {
+                        *sp++ = left;
+                    }
+                    break;
+                }
+
+                bool holds = small_compare(op, left.small(), right.small());
+                if (instr_op(code[ip]) == opcode::op_jump_if_false) ip = holds ? ip + 1 : instr_arg(code[ip]);
+                else *sp++ = rt_value(holds);
+                break;
+            }
+
+            case opcode::op_jump:
+                if (instr_arg(in) < ip) {
+                    stack->top = sp;
+                    gc_heap().safepoint();
+                }
+                ip = instr_arg(in);
+                break;
+
+            case opcode::op_jump_if_false: {
+                if (!(*--sp).truthy()) ip = instr_arg(in);
+                break;
+            }
+
+            case opcode::op_call: {
+                stack->top = sp;
+                gc_heap().safepoint();
+                frame->ip = ip;
+                call_value(instr_arg(in), frame->code->positions[ip - 1], frame->env);
+
+                frame = &frames.back();
+                code = frame->code->code.data();
+                constants = frame->code->constants.data();
+                slots = frame->slots;
+                ip = frame->ip;
+                sp = stack->top;
+                break;
+            }
+
+            // a script function called in tail position takes over the
+            // caller's frame: the callee and its arguments slide down to
+            // where the caller's callee sat. anything else is called as
+            // usual and the op_return that follows returns its result
+            case opcode::op_tail_call: {
+                stack->top = sp;
+                gc_heap().safepoint();
+                size_t argc = instr_arg(in);
+                rt_value* callee = sp - argc - 1;
+                position_t pos = frame->code->positions[ip - 1];
+                environment_t* env = frame->env;
+
+                if (callee->type() == dtype::func) {
+                    rt_value* base = frame->base;
+                    std::move(callee, sp, base);
+                    stack->top = base + argc + 1;
+                    frames.pop_back();
+                } else {
+                    frame->ip = ip;
+                }
+
+                call_value(argc, pos, env);
+
+                frame = &frames.back();
+                code = frame->code->code.data();
+                constants = frame->code->constants.data();
+                slots = frame->slots;
+                ip = frame->ip;
+                sp = stack->top;
+                break;
+            }
+
+            case opcode::op_return: {
+                rt_value result = *--sp;
+                sp = frame->base;
+                frames.pop_back();
+
+                if (frames.size() == exit_depth) {
+                    stack->top = sp;
+                    return result;
+                }
+
+                *sp++ = result;
+                frame = &frames.back();
+                code = frame->code->code.data();
+                constants = frame->code->constants.data();
+                slots = frame->slots;
+                ip = frame->ip;
+                break;
+            }
+
+            case opcode::op_array: {
+                size_t count = instr_arg(in);
+                std::vector<rt_value> arr(sp - count, sp);
+                sp -= count;
+                *sp++ = make_array(std::move(arr));
+                break;
+            }
+
+            case opcode::op_object: {
+                size_t count = instr_arg(in);
+                object_layout_t& layout = object_layouts()[code[ip++]];
+
+                std::vector<rt_value> slots(layout.shape->keys.size());
+                for (size_t i = 0; i < count; i++) {
+                    slots[layout.slots[i]] = sp[i - count];
+                }
+
+                sp -= count;
+                *sp++ = make_object(layout.shape, std::move(slots));
+                break;
+            }
+
+            case opcode::op_get_member: {
+                rt_value& obj = sp[-1];
+                obj = get_member(obj, member_caches()[instr_arg(in)], frame->code->positions[ip - 1]);
+                break;
+            }
+
+            case opcode::op_index: {
+                rt_value idx = *--sp;
+                rt_value& arr = sp[-1];
+                arr = index(arr, idx, frame->code->positions[ip - 1]);
+                break;
+            }
+
+            case opcode::op_import: {
+                stack->top = sp;
+                rt_value module = inter->load_module(constants[instr_arg(in)].str(), frame->code->positions[ip - 1]);
+                sp = stack->top;
+                *sp++ = module;
+                break;
+            }
+        }
+    }
+}
+
+rt_value vm::binary(binop_t op, rt_value left, rt_value right, position_t pos)
+{
+    rt_value result;
+    const char* err = binary_op(op, left, right, result);
+    if (err != nullptr) error(err, pos, inter->source).spit();
+    return result;
+}
+
+rt_value vm::get_member(rt_value obj, member_cache_t& cache, position_t pos)
+{
+    if (obj.type() != dtype::object) error(string_format("not an object"), pos, inter->source).spit();
+
+    rt_object* object = obj.object();
+    int slot = cache.lookup(object->shape);
+    if (slot < 0) error(string_format("member %s not found", symbols().name(cache.key).c_str()), pos, inter->source).spit();
+
+    return object->slots[slot];
+}
+
+rt_value vm::index(rt_value arr, rt_value idx, position_t pos)
+{
+    if (arr.type() == dtype::object) {
+        if (idx.type() != dtype::string) error(string_format("not an indexable type for object"), pos, inter->source).spit();
+        rt_value* member = arr.object()->get(idx.str());
+        return member != nullptr ? *member : rt_value();
+    }
+
+    bool packed = is_packed(arr.type());
+    if (arr.type() != dtype::array && !packed) error(string_format("not an array or object"), pos, inter->source).spit();
+    if (idx.type() != dtype::integer) error(string_format("not an indexable type for array"), pos, inter->source).spit();
+    int64_t at = idx.integer();
+    size_t length = packed ? packed_length(arr) : arr.arr().size();
+    if (at < 0 || static_cast<uint64_t>(at) >= length) error(string_format("index %lld out of range", (long long)at), pos, inter->source).spit();
+
+    return packed ? packed_get(arr, at) : arr.arr()[at];
+}